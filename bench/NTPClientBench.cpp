@@ -0,0 +1,563 @@
+/*
+ Name:		NTPClientBench.cpp
+ Author:	Germán Martín (gmag11@gmail.com)
+ Maintainer:Germán Martín (gmag11@gmail.com)
+
+ Host benchmarks of NtpClientLib hot paths. For every case it reports time per call,
+ heap allocations per call and peak stack depth of a single call. Then it measures local
+ clock read throughput with several reader threads, while local clock state is left
+ alone and while another thread publishes new state continuously, and how long a single
+ getTime () call takes while server names are looked up by a slow resolver.
+
+ Usage: ntp_bench [iterations]
+*/
+
+#include <TimeLib.h>
+#include <NtpClientLib.h>
+#include <time.h>
+#include <thread>
+#include <atomic>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+#ifdef __GLIBC__
+// Count every heap allocation, including those made by operator new, by interposing libc allocator
+extern "C" void *__libc_malloc (size_t size);
+extern "C" void *__libc_calloc (size_t count, size_t size);
+extern "C" void *__libc_realloc (void *ptr, size_t size);
+
+static std::atomic<uint64_t> s_allocations (0);
+static std::atomic<uint64_t> s_allocatedBytes (0);
+static thread_local bool s_countThread = true; // Helper threads do not count
+
+extern "C" void *malloc (size_t size) {
+    if (s_countThread) {
+        s_allocations++;
+        s_allocatedBytes += size;
+    }
+    return __libc_malloc (size);
+}
+
+extern "C" void *calloc (size_t count, size_t size) {
+    if (s_countThread) {
+        s_allocations++;
+        s_allocatedBytes += count * size;
+    }
+    return __libc_calloc (count, size);
+}
+
+extern "C" void *realloc (void *ptr, size_t size) {
+    if (s_countThread) {
+        s_allocations++;
+        s_allocatedBytes += size;
+    }
+    return __libc_realloc (ptr, size);
+}
+#define ALLOCATION_COUNT_AVAILABLE true
+#else
+static uint64_t s_allocations = 0;
+static uint64_t s_allocatedBytes = 0;
+static thread_local bool s_countThread = true;
+#define ALLOCATION_COUNT_AVAILABLE false
+#endif
+
+#define STACK_PAINT_SIZE 65536
+#define STACK_PAINT_PATTERN 0xA5
+#define NOINLINE __attribute__ ((noinline))
+
+static const uint16_t BENCH_SERVER_PORT = 12399;
+
+/**
+* Gives access to protected members that hot paths depend on.
+*/
+class BenchClient : public NTPClient {
+public:
+    /**
+    * Prepares server slot 0 as if a request had just been sent, so that a response can be decoded.
+    */
+    void armRequest (uint64_t requestTimestamp) {
+        _servers[0].sent = true;
+        _servers[0].replied = false;
+        _servers[0].requestTimestamp = requestTimestamp;
+        _servers[0].sendUs = 1700000000ULL * 1000000;
+        _receiveUs = _servers[0].sendUs + 20000;
+    }
+
+    /**
+    * Sets local clock, as a sync does, and publishes it to readers.
+    */
+    void setClock (uint64_t us) {
+        setLocalClock (us);
+    }
+
+    /**
+    * Reads local clock state as nowUs () does and checks that it was not torn by a concurrent update.
+    */
+    bool readConsistent () {
+        NTPClockAnchor_t copy;
+        uint64_t elapsedMillis;
+        uint32_t elapsedMicros;
+        const NTPClockAnchor_t &anchor = readAnchor (copy, elapsedMillis, elapsedMicros);
+        return anchor.ms == anchor.us / 1000 && anchor.remUs == anchor.us % 1000 && (anchor.ntp >> 32) == anchor.us / 1000000 + SEVENTY_YEARS;
+    }
+};
+
+static BenchClient s_client;
+static char s_response[NTP_PACKET_SIZE];
+static volatile uint32_t s_sink; // Keeps results alive
+
+static uint64_t monotonicNs () {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void writeTimestamp (uint8_t *buffer, uint64_t timestamp) {
+    for (int i = 0; i < 8; i++) {
+        buffer[i] = timestamp >> (56 - 8 * i);
+    }
+}
+
+static uint64_t unixUsToNtp (uint64_t us) {
+    return ((us / 1000000 + SEVENTY_YEARS) << 32) | (((us % 1000000) << 32) / 1000000);
+}
+
+// Benchmark cases
+
+static const uint64_t ORIGINATE = unixUsToNtp (1700000000ULL * 1000000);
+
+static void benchDecode () {
+    s_client.armRequest (ORIGINATE);
+    s_sink += s_client.decodeNtpMessage (s_response);
+}
+
+static uint32_t s_moment = 1700000000;
+
+static NTPTimeZone s_tz;
+static uint32_t s_random = 1;
+
+static void benchToLocal () {
+    s_moment += 7; // Offset change is cached, so this is a comparison most of the time
+    s_sink += s_tz.toLocal (s_moment);
+}
+
+static void benchToLocalScattered () {
+    s_random = s_random * 1103515245 + 12345; // Every call lands out of cached period
+    s_sink += s_tz.toLocal (1600000000 + s_random % (20 * 365 * 86400));
+}
+
+static NTPCalendar s_calendar;
+
+static void benchTimeLibBreakTime () {
+    s_moment += 7;
+    tmElements_t tm;
+    breakTime (s_moment, tm);
+    s_sink += tm.Day + tm.Second;
+}
+
+static void benchCalendarBreakTime () {
+    s_moment += 7; // Same day most of the time, so only seconds are added
+    const NTPDateTime_t &date = s_calendar.breakTime (s_moment);
+    s_sink += date.day + date.second;
+}
+
+static void benchCalendarScattered () {
+    s_random = s_random * 1103515245 + 12345; // Every call lands on another day
+    const NTPDateTime_t &date = s_calendar.breakTime (1600000000 + s_random % (20 * 365 * 86400));
+    s_sink += date.day + date.second;
+}
+
+static void benchIsSummerTimePeriod () {
+    s_moment += 3607;
+    s_sink += s_client.isSummerTimePeriod (s_moment);
+}
+
+#ifndef NTPCLIENT_NO_HEAP
+static void benchGetTimeStr () {
+    s_moment += 7;
+    s_sink += s_client.getTimeStr (s_moment).length ();
+}
+#endif
+
+#ifndef NTPCLIENT_NO_HEAP
+static void benchGetDateStr () {
+    s_moment += 86399;
+    s_sink += s_client.getDateStr (s_moment).length ();
+}
+#endif
+
+#ifndef NTPCLIENT_NO_HEAP
+static void benchGetTimeDateString () {
+    s_moment += 86399;
+    s_sink += s_client.getTimeDateString (s_moment).length ();
+}
+#endif
+
+#ifndef NTPCLIENT_NO_HEAP
+static void benchGetUptimeString () {
+    s_sink += s_client.getUptimeString ().length ();
+}
+#endif
+
+static char s_buffer[NTP_RFC3339_STR_SIZE];
+
+static void benchGetTimeStrBuffer () {
+    s_moment += 7;
+    s_sink += s_client.getTimeStr (s_buffer, sizeof (s_buffer), s_moment);
+}
+
+static void benchGetDateStrBuffer () {
+    s_moment += 86399;
+    s_sink += s_client.getDateStr (s_buffer, sizeof (s_buffer), s_moment);
+}
+
+static void benchGetTimeDateStringBuffer () {
+    s_moment += 86399;
+    s_sink += s_client.getTimeDateString (s_buffer, sizeof (s_buffer), s_moment);
+}
+
+static void benchGetUptimeStringBuffer () {
+    s_sink += s_client.getUptimeString (s_buffer, sizeof (s_buffer));
+}
+
+static void benchGetISO8601Str () {
+    s_moment += 86399;
+    s_sink += s_client.getISO8601Str (s_buffer, sizeof (s_buffer), (uint64_t)s_moment * 1000 + 123);
+}
+
+static void benchGetRFC3339Str () {
+    s_moment += 86399;
+    s_sink += s_client.getRFC3339Str (s_buffer, sizeof (s_buffer), (uint64_t)s_moment * 1000 + 123);
+}
+
+static void benchNowUs () {
+    s_sink += s_client.nowUs ();
+}
+
+static void benchNowMs () {
+    s_sink += s_client.nowMs ();
+}
+
+static void benchNowNtp () {
+    s_sink += s_client.nowNtp ();
+}
+
+static NTPClient s_cycleClient;
+static NTPPosixTransport s_cycleTransport;
+
+static void benchRequestCycle () {
+    s_cycleClient.getTime (); // Send request
+    time_t result;
+    do {
+        result = s_cycleClient.getTime ();
+    } while (!result && s_cycleClient.getSyncStatus () == syncSent);
+    s_sink += result;
+}
+
+// Loopback server answering requests with system time, run on a helper thread
+static std::atomic<bool> s_serverRunning (true);
+
+static void fakeServer (int sock) {
+    s_countThread = false;
+    uint8_t buffer[NTP_PACKET_SIZE];
+    while (s_serverRunning) {
+        struct sockaddr_in remote;
+        socklen_t remoteLength = sizeof (remote);
+        ssize_t size = recvfrom (sock, buffer, sizeof (buffer), 0, (struct sockaddr *)&remote, &remoteLength);
+        if (size < NTP_PACKET_SIZE)
+            continue;
+        struct timespec ts;
+        clock_gettime (CLOCK_REALTIME, &ts);
+        uint64_t timestamp = unixUsToNtp ((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+        memcpy (buffer + 24, buffer + 40, 8);
+        buffer[0] = 0x24; // Version 4, server
+        buffer[1] = 1;
+        writeTimestamp (buffer + 32, timestamp);
+        writeTimestamp (buffer + 40, timestamp);
+        sendto (sock, buffer, sizeof (buffer), 0, (struct sockaddr *)&remote, remoteLength);
+    }
+}
+
+// Slow name lookups
+
+#define LOOKUP_MS 20 // Time taken by every name lookup
+#define LOOKUP_SYNCS 5
+
+/**
+* Loopback transport whose resolver takes LOOKUP_MS to answer. Blocking mode waits inside resolve (), as
+* board resolvers do. Asynchronous mode answers pending until lookup time has passed, as lwIP resolver does.
+*/
+class SlowResolveTransport : public NTPPosixTransport {
+public:
+    bool async = false;
+
+    uint8_t resolve (const char* /* name */, IPAddress *addresses, uint8_t max) {
+        delay (LOOKUP_MS);
+        return lookedUp (addresses, max);
+    }
+
+    int resolveAsync (const char* name, IPAddress *addresses, uint8_t max) {
+        if (!async)
+            return resolve (name, addresses, max);
+        if (strcmp (name, _name)) {
+            strncpy (_name, name, sizeof (_name) - 1);
+            _started = millis ();
+            return NTP_RESOLVE_PENDING;
+        }
+        if (millis () - _started < LOOKUP_MS)
+            return NTP_RESOLVE_PENDING;
+        _name[0] = '\0';
+        return lookedUp (addresses, max);
+    }
+
+protected:
+    char _name[16] = "";        ///< Name being looked up
+    uint32_t _started = 0;      ///< millis () when lookup started
+
+    uint8_t lookedUp (IPAddress *addresses, uint8_t max) {
+        if (!max)
+            return 0;
+        addresses[0] = IPAddress (127, 0, 0, 1);
+        return 1;
+    }
+};
+
+static NTPClient s_dnsClient;
+static SlowResolveTransport s_dnsTransport;
+
+/**
+* Syncs several times with every server name expired from DNS cache.
+* @param[out] Slowest getTime () call, in nanoseconds.
+* @param[out] Mean time from first getTime () call to sync, in nanoseconds.
+*/
+static void syncWithLookups (bool async, uint64_t &slowest, uint64_t &mean) {
+    s_dnsTransport.async = async;
+    slowest = 0;
+    uint64_t total = 0;
+    for (int i = 0; i < LOOKUP_SYNCS; i++) {
+        s_dnsClient.flushDnsCache ();
+        uint64_t start = monotonicNs ();
+        time_t result;
+        do {
+            uint64_t call = monotonicNs ();
+            result = s_dnsClient.getTime ();
+            call = monotonicNs () - call;
+            if (call > slowest)
+                slowest = call;
+        } while (!result && s_dnsClient.getSyncStatus () != syncIdle);
+        total += monotonicNs () - start;
+    }
+    mean = total / LOOKUP_SYNCS;
+}
+
+static void runSlowLookups () {
+    s_dnsClient.setTransport (&s_dnsTransport);
+    for (int i = 0; i < NTP_MAX_SERVERS; i++) {
+        char name[8];
+        snprintf (name, sizeof (name), "slow%d", i);
+        s_dnsClient.setNtpServerName (name, i);
+    }
+    s_dnsClient.setNtpServerPort (BENCH_SERVER_PORT);
+    s_dnsClient.setPersistentSocket (true);
+    s_dnsClient.setBurst (1);
+    printf ("\ngetTime () with %d server names taking %d ms to resolve. Milliseconds\n", NTP_MAX_SERVERS, LOOKUP_MS);
+    printf ("%-14s %14s %14s\n", "resolver", "slowest call", "mean sync");
+    uint64_t slowest, mean;
+    syncWithLookups (false, slowest, mean);
+    printf ("%-14s %14.2f %14.2f\n", "blocking", slowest / 1e6, mean / 1e6);
+    syncWithLookups (true, slowest, mean);
+    printf ("%-14s %14.2f %14.2f\n", "asynchronous", slowest / 1e6, mean / 1e6);
+}
+
+// Concurrent local clock readers
+
+#define READ_DURATION_MS 300
+#define READ_CHECK_EVERY 64 // One read out of this many checks state consistency
+
+static BenchClient s_readClient;
+static std::atomic<bool> s_readersRunning (false);
+static std::atomic<uint64_t> s_reads (0);
+static std::atomic<uint64_t> s_torn (0);
+
+static void reader () {
+    s_countThread = false;
+    uint64_t reads = 0;
+    uint64_t torn = 0;
+    while (s_readersRunning) {
+        for (int i = 0; i < READ_CHECK_EVERY - 1; i++) {
+            s_sink += s_readClient.nowUs ();
+        }
+        torn += !s_readClient.readConsistent ();
+        reads += READ_CHECK_EVERY;
+    }
+    s_reads += reads;
+    s_torn += torn;
+}
+
+static void writer () {
+    s_countThread = false;
+    uint64_t us = 1700000000ULL * 1000000;
+    while (s_readersRunning) {
+        us += 1000003; // Every field changes on every update
+        s_readClient.setClock (us);
+    }
+}
+
+/**
+* Runs reader threads for a while and gets reads per second of all of them together.
+*/
+static double readThroughput (unsigned threads, bool busyWriter) {
+    std::thread readers[8];
+    std::thread updater;
+    s_reads = 0;
+    s_readersRunning = true;
+    for (unsigned i = 0; i < threads; i++) {
+        readers[i] = std::thread (reader);
+    }
+    if (busyWriter)
+        updater = std::thread (writer);
+    uint64_t start = monotonicNs ();
+    delay (READ_DURATION_MS);
+    s_readersRunning = false;
+    for (unsigned i = 0; i < threads; i++) {
+        readers[i].join ();
+    }
+    uint64_t elapsed = monotonicNs () - start;
+    if (busyWriter)
+        updater.join ();
+    return s_reads * 1e9 / elapsed;
+}
+
+static void runConcurrentReads () {
+    unsigned cores = std::thread::hardware_concurrency ();
+    printf ("\nnowUs () readers on %u cores. Million reads per second, all threads together\n", cores);
+    printf ("%-8s %14s %14s\n", "threads", "quiet", "busy writer");
+    for (unsigned threads = 1; threads <= 8; threads *= 2) {
+        double quiet = readThroughput (threads, false);
+        double busy = readThroughput (threads, true);
+        printf ("%-8u %14.1f %14.1f\n", threads, quiet / 1e6, busy / 1e6);
+    }
+    printf ("Torn reads: %llu\n", (unsigned long long)s_torn.load ());
+}
+
+// Measurement
+
+typedef void (*benchFunction_t)();
+
+static volatile uintptr_t s_paintedLow; // Lowest painted address
+
+/**
+* Paints stack area below caller frame with a known pattern.
+*/
+static NOINLINE void paintStack () {
+    volatile uint8_t area[STACK_PAINT_SIZE];
+    for (size_t i = 0; i < STACK_PAINT_SIZE; i++) {
+        area[i] = STACK_PAINT_PATTERN;
+    }
+    s_paintedLow = (uintptr_t)area;
+}
+
+/**
+* Runs function once over painted stack and gets how deep it went, in bytes below caller frame.
+*/
+static NOINLINE size_t measureStack (benchFunction_t function) {
+    volatile uint8_t marker;
+    uint8_t *base = (uint8_t *)&marker;
+    paintStack ();
+    function ();
+    uint8_t *p = (uint8_t *)s_paintedLow;
+    while (p < base && *p == STACK_PAINT_PATTERN) {
+        p++;
+    }
+    return base - p;
+}
+
+static void run (const char *name, benchFunction_t function, uint32_t iterations) {
+    for (uint32_t i = 0; i < iterations / 10 + 1; i++) {
+        function (); // Warm up caches
+    }
+    size_t stack = measureStack (function);
+
+    uint64_t allocations = s_allocations;
+    uint64_t allocatedBytes = s_allocatedBytes;
+    uint64_t start = monotonicNs ();
+    for (uint32_t i = 0; i < iterations; i++) {
+        function ();
+    }
+    uint64_t elapsed = monotonicNs () - start;
+    allocations = s_allocations - allocations;
+    allocatedBytes = s_allocatedBytes - allocatedBytes;
+
+    printf ("%-24s %10.1f %12.2f %12.1f %10u\n", name, (double)elapsed / iterations,
+            (double)allocations / iterations, (double)allocatedBytes / iterations, (unsigned)stack);
+}
+
+int main (int argc, char *argv[]) {
+    uint32_t iterations = argc > 1 ? atoi (argv[1]) : 200000;
+
+    // Canned server response for decode benchmark
+    memset (s_response, 0, sizeof (s_response));
+    s_response[0] = 0x24;
+    s_response[1] = 2;
+    s_response[5] = 0x01; // Root delay 1/256 s
+    s_response[9] = 0x01; // Root dispersion 1/256 s
+    writeTimestamp ((uint8_t *)s_response + 24, ORIGINATE);
+    writeTimestamp ((uint8_t *)s_response + 32, unixUsToNtp (1700000000ULL * 1000000 + 10000));
+    writeTimestamp ((uint8_t *)s_response + 40, unixUsToNtp (1700000000ULL * 1000000 + 10100));
+    s_client.setNtpServerName ("bench", 0);
+
+    int sock = socket (AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in local;
+    memset (&local, 0, sizeof (local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    local.sin_port = htons (BENCH_SERVER_PORT);
+    if (sock < 0 || bind (sock, (struct sockaddr *)&local, sizeof (local)) < 0) {
+        perror ("bind");
+        return 1;
+    }
+    struct timeval timeout = { 0, 100000 };
+    setsockopt (sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof (timeout));
+    std::thread server (fakeServer, sock);
+
+    s_cycleClient.setTransport (&s_cycleTransport);
+    s_cycleClient.setNtpServerName ("127.0.0.1", 0);
+    s_cycleClient.setNtpServerPort (BENCH_SERVER_PORT);
+    s_cycleClient.setPersistentSocket (true);
+
+    printf ("%u iterations. Heap allocation count %s. Library static RAM %u bytes\n\n", iterations,
+            ALLOCATION_COUNT_AVAILABLE ? "enabled" : "not available", (unsigned)NTPClient::getStaticRamUsage ());
+    printf ("%-24s %10s %12s %12s %10s\n", "case", "ns/op", "allocs/op", "bytes/op", "stack");
+    run ("decodeNtpMessage", benchDecode, iterations);
+    s_tz.setRules (NTP_TZ_CET);
+    run ("toLocal", benchToLocal, iterations);
+    run ("toLocal (scattered)", benchToLocalScattered, iterations);
+    run ("breakTime (Time library)", benchTimeLibBreakTime, iterations);
+    run ("NTPCalendar::breakTime", benchCalendarBreakTime, iterations);
+    run ("breakTime (scattered)", benchCalendarScattered, iterations);
+    run ("isSummerTimePeriod", benchIsSummerTimePeriod, iterations);
+#ifndef NTPCLIENT_NO_HEAP
+    run ("getTimeStr", benchGetTimeStr, iterations);
+    run ("getDateStr", benchGetDateStr, iterations);
+    run ("getTimeDateString", benchGetTimeDateString, iterations);
+    run ("getUptimeString", benchGetUptimeString, iterations);
+#endif
+    run ("getTimeStr (buffer)", benchGetTimeStrBuffer, iterations);
+    run ("getDateStr (buffer)", benchGetDateStrBuffer, iterations);
+    run ("getTimeDateString (buf)", benchGetTimeDateStringBuffer, iterations);
+    run ("getUptimeString (buffer)", benchGetUptimeStringBuffer, iterations);
+    run ("getISO8601Str", benchGetISO8601Str, iterations);
+    run ("getRFC3339Str", benchGetRFC3339Str, iterations);
+    run ("request cycle (loopback)", benchRequestCycle, iterations / 100 + 1);
+    run ("nowUs", benchNowUs, iterations);
+    run ("nowMs", benchNowMs, iterations);
+    run ("nowNtp", benchNowNtp, iterations);
+    runConcurrentReads ();
+    runSlowLookups ();
+
+    s_serverRunning = false;
+    server.join ();
+    close (sock);
+    return 0;
+}
@@ -76,6 +76,8 @@ void loop () {
     static int i = 0;
     static int last = 0;
 
+    NTP.loop (); // Process NTP response as soon as it arrives
+
     if ((millis () - last) > 5100) {
         //Serial.println(millis() - last);
         last = millis ();
@@ -122,6 +122,8 @@ void loop () {
         NTP.setInterval (63);
     }
 
+    NTP.loop (); // Process NTP response as soon as it arrives
+
     if (syncEventTriggered) {
         processSyncEvent (ntpEvent);
         syncEventTriggered = false;
@@ -0,0 +1,103 @@
+/*
+ Name:		NTPClientHost.cpp
+ Author:	gmag11@gmail.com
+
+ NtpClientLib running on Linux. Build it with CMake from repository root and start
+ ntp_test_server first, or point it to any reachable NTP server:
+
+     ntp_client_host [server] [port] [seconds] [serve port] [broadcast port] [multicast group]
+
+ Default is 127.0.0.1 on port 12300, where ntp_test_server listens by default. If serve port
+ is given, time is served to other clients on that port once synced. If broadcast port is given
+ (serve port may be 0), server is not polled and time is taken from broadcasts instead, as sent by
+ ntp_test_server -b 127.0.0.1:port.
+
+ If NTP_STATE_FILE environment variable is set, sync state is kept in that file, so that time is
+ valid from start on next run even if server cannot be reached. If NTP_WORKER is set, sync runs on a
+ background thread and NTP.loop () below does nothing. Worker is not available on NTPCLIENT_NO_HEAP builds.
+*/
+
+#include <TimeLib.h>
+#include <NtpClientLib.h>
+
+static int syncs = 0;
+
+int main (int argc, char *argv[]) {
+    const char *server = argc > 1 ? argv[1] : "127.0.0.1";
+    uint16_t port = argc > 2 ? atoi (argv[2]) : 12300;
+    uint32_t duration = argc > 3 ? atoi (argv[3]) * 1000UL : 60000UL;
+    uint16_t servePort = argc > 4 ? atoi (argv[4]) : 0;
+    uint16_t broadcastPort = argc > 5 ? atoi (argv[5]) : 0;
+    IPAddress group;
+    if (argc > 6 && !group.fromString (argv[6])) {
+        Serial.println ("Invalid multicast group");
+        return 1;
+    }
+
+    // Called from NTP.loop (), after time has been set. It may take as long as needed
+    NTP.onNTPSyncEvent ([](const NTPSyncEventInfo_t &info) {
+        if (info.event == timeSyncd) {
+            syncs++;
+            Serial.printf ("Sync %d: server %d, stratum %u, offset %lld us, delay %u us, poll %d s, drift %.2f ppm\n", syncs,
+                           info.server, info.stratum, (long long)info.offset, info.delay, NTP.getPollInterval (), NTP.getDrift ());
+        } else {
+            Serial.printf ("Sync error: %d\n", info.event);
+        }
+    });
+    const char *stateFile = getenv ("NTP_STATE_FILE");
+    NTPFileStorage storage (stateFile);
+    if (stateFile)
+        NTP.setStorage (&storage);
+    NTP.setNtpServerPort (port);
+    if (!NTP.begin (server, 0, false)) {
+        Serial.println ("Cannot start NTP client");
+        return 1;
+    }
+    if (NTP.isProvisional () && NTP.getMaxError () != 0xFFFFFFFF)
+        Serial.printf ("Time restored from %s. Maximum error %u ms\n", stateFile, NTP.getMaxError ());
+    else if (NTP.isProvisional ())
+        Serial.printf ("Time restored from %s. Maximum error unknown\n", stateFile);
+    NTP.setInterval (10, 60);
+    if (broadcastPort && !NTP.beginBroadcast (broadcastPort, group)) {
+        Serial.println ("Cannot listen to broadcasts");
+        return 1;
+    }
+    if (servePort && !NTP.beginServer (servePort)) {
+        Serial.println ("Cannot start SNTP server");
+        return 1;
+    }
+#ifdef NTPCLIENT_WORKER
+    if (getenv ("NTP_WORKER") && !NTP.beginWorker ()) {
+        Serial.println ("Cannot start background worker");
+        return 1;
+    }
+#endif
+
+    uint32_t start = millis ();
+    uint32_t last = 0;
+    uint32_t worstLoopUs = 0;
+    while (millis () - start < duration) {
+        uint32_t loopStart = micros ();
+        NTP.loop ();
+        uint32_t loopUs = micros () - loopStart;
+        if (loopUs > worstLoopUs)
+            worstLoopUs = loopUs;
+
+        if (millis () - last >= 5000) {
+            last = millis ();
+            char timeStr[NTP_ISO8601_STR_SIZE];
+            NTP.getISO8601Str (timeStr, sizeof (timeStr));
+            Serial.printf ("%s%s. Worst loop () time %u us\n", timeStr, NTP.isProvisional () ? " (provisional)" : "", worstLoopUs);
+        }
+        delay (1);
+    }
+#ifdef NTPCLIENT_WORKER
+    NTP.stopWorker (); // Client state below is only safe to read from the thread that runs loop ()
+#endif
+    char stats[NTP_STATS_STR_SIZE];
+    NTP.getStatsStr (stats, sizeof (stats));
+    Serial.printf ("%s", stats);
+    NTP.saveState ();
+    NTP.stop ();
+    return syncs ? 0 : 1;
+}
@@ -0,0 +1,92 @@
+/*
+Copyright 2018 German Martin (gmag11@gmail.com). All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met :
+
+1. Redistributions of source code must retain the above copyright notice, this list of
+conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list
+of conditions and the following disclaimer in the documentation and / or other materials
+provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ''AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL <COPYRIGHT HOLDER> OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+	SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+	ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT(INCLUDING
+		NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+	ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+	The views and conclusions contained in the software and documentation are those of the
+	authors and should not be interpreted as representing official policies, either expressed
+	or implied, of German Martin
+*/
+
+/*
+ Name:		NTPClientLatency.ino
+ Created:	18/10/2026
+ Author:	gmag11@gmail.com
+ Editor:	http://www.visualmicro.com
+
+ Measures worst case loop() duration while NTP requests are in progress.
+ Set NTP_SERVER to an address that never answers (default) or to a slow server
+ to check that sync timeouts do not stall the sketch.
+*/
+
+#include <TimeLib.h> //TimeLib library is needed https://github.com/PaulStoffregen/Time
+#include <NtpClientLib.h> //Include NtpClient library header
+#include <ESP8266WiFi.h>
+
+#define YOUR_WIFI_SSID "YOUR_WIFI_SSID"
+#define YOUR_WIFI_PASSWD "YOUR_WIFI_PASSWD"
+
+#define NTP_SERVER "192.0.2.1" // TEST-NET-1 address, no server will ever answer
+#define REPORT_PERIOD 10000 // Report interval in milliseconds
+
+bool wifiFirstConnected = false;
+uint32_t maxLoopTime = 0; // Worst loop() duration in current report period, in microseconds
+uint32_t loopCount = 0;
+uint32_t lastReport = 0;
+
+void setup () {
+	static WiFiEventHandler gotIpHandler;
+
+	Serial.begin (115200);
+	Serial.println ();
+
+	WiFi.mode (WIFI_STA);
+	WiFi.begin (YOUR_WIFI_SSID, YOUR_WIFI_PASSWD);
+
+	gotIpHandler = WiFi.onStationModeGotIP ([](WiFiEventStationModeGotIP ipInfo) {
+		wifiFirstConnected = true;
+	});
+}
+
+void loop () {
+	uint32_t start = micros ();
+
+	if (wifiFirstConnected) {
+		wifiFirstConnected = false;
+		NTP.begin (NTP_SERVER);
+		NTP.setInterval (10, 10); // Retry as fast as allowed to get many timeouts
+	}
+	NTP.loop (); // Process NTP response without waiting for it
+	now (); // Time library triggers new requests from here
+
+	uint32_t elapsed = micros () - start;
+	if (elapsed > maxLoopTime) {
+		maxLoopTime = elapsed;
+	}
+	loopCount++;
+
+	if (millis () - lastReport >= REPORT_PERIOD) {
+		lastReport = millis ();
+		Serial.printf ("Loops: %u. Worst loop() latency: %u us. Sync status: %d\n", loopCount, maxLoopTime, NTP.getSyncStatus ());
+		maxLoopTime = 0;
+		loopCount = 0;
+	}
+}
@@ -0,0 +1,92 @@
+/*
+ Name:		Arduino.cpp
+ Author:	Germán Martín (gmag11@gmail.com)
+ Maintainer:Germán Martín (gmag11@gmail.com)
+
+ Minimal Arduino core replacement to build NtpClientLib on Linux and other POSIX hosts.
+*/
+
+#include "Arduino.h"
+#include <stdarg.h>
+#include <time.h>
+#include <sched.h>
+
+HardwareSerial Serial;
+
+static uint64_t monotonicUs () {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static const uint64_t s_startUs = monotonicUs ();
+
+uint32_t millis () {
+    return (uint32_t)((monotonicUs () - s_startUs) / 1000);
+}
+
+uint32_t micros () {
+    return (uint32_t)(monotonicUs () - s_startUs);
+}
+
+void delay (uint32_t ms) {
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long)(ms % 1000) * 1000000;
+    nanosleep (&ts, NULL);
+}
+
+void yield () {
+    sched_yield ();
+}
+
+bool IPAddress::fromString (const char *address) {
+    unsigned int bytes[4];
+    char extra;
+    if (sscanf (address, "%u.%u.%u.%u%c", &bytes[0], &bytes[1], &bytes[2], &bytes[3], &extra) != 4)
+        return false;
+    for (int i = 0; i < 4; i++) {
+        if (bytes[i] > 255)
+            return false;
+    }
+    *this = IPAddress (bytes[0], bytes[1], bytes[2], bytes[3]);
+    return true;
+}
+
+String IPAddress::toString () const {
+    char str[16];
+    snprintf (str, sizeof (str), "%u.%u.%u.%u", (*this)[0], (*this)[1], (*this)[2], (*this)[3]);
+    return str;
+}
+
+int HardwareSerial::printf (const char *format, ...) {
+    va_list args;
+    va_start (args, format);
+    int size = vprintf (format, args);
+    va_end (args);
+    return size;
+}
+
+size_t HardwareSerial::print (const char *str) {
+    return fputs (str, stdout) < 0 ? 0 : strlen (str);
+}
+
+size_t HardwareSerial::print (char c) {
+    return putchar (c) == EOF ? 0 : 1;
+}
+
+size_t HardwareSerial::print (long value) {
+    return ::printf ("%ld", value);
+}
+
+size_t HardwareSerial::print (unsigned long value) {
+    return ::printf ("%lu", value);
+}
+
+size_t HardwareSerial::print (double value, int digits) {
+    return ::printf ("%.*f", digits, value);
+}
+
+void HardwareSerial::flush () {
+    fflush (stdout);
+}
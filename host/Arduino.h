@@ -0,0 +1,117 @@
+/*
+ Name:		Arduino.h
+ Author:	Germán Martín (gmag11@gmail.com)
+ Maintainer:Germán Martín (gmag11@gmail.com)
+
+ Minimal Arduino core replacement to build NtpClientLib on Linux and other POSIX hosts.
+ Only what the library and its host examples use is provided.
+*/
+
+#ifndef _Host_Arduino_h
+#define _Host_Arduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+/**
+* Milliseconds since program start, from monotonic clock. Wraps after 49 days like on boards.
+*/
+uint32_t millis ();
+
+/**
+* Microseconds since program start, from monotonic clock. Wraps after 71 minutes like on boards.
+*/
+uint32_t micros ();
+
+void delay (uint32_t ms);
+
+void yield ();
+
+class String {
+public:
+    String (const char *str = "") : _str (str ? str : "") {}
+    String (const std::string &str) : _str (str) {}
+    String (char c) : _str (1, c) {}
+    String (int value) : _str (std::to_string (value)) {}
+    String (unsigned int value) : _str (std::to_string (value)) {}
+    String (long value) : _str (std::to_string (value)) {}
+    String (unsigned long value) : _str (std::to_string (value)) {}
+    String (long long value) : _str (std::to_string (value)) {}
+    String (unsigned long long value) : _str (std::to_string (value)) {}
+
+    unsigned int length () const { return _str.length (); }
+    const char* c_str () const { return _str.c_str (); }
+    void toCharArray (char *buffer, unsigned int size) const {
+        if (!size)
+            return;
+        strncpy (buffer, _str.c_str (), size - 1);
+        buffer[size - 1] = '\0';
+    }
+    char operator[] (unsigned int index) const { return index < _str.length () ? _str[index] : '\0'; }
+
+    String& operator+= (const String &rhs) { _str += rhs._str; return *this; }
+    String& operator+= (const char *rhs) { _str += rhs; return *this; }
+    String& operator+= (char rhs) { _str += rhs; return *this; }
+    friend String operator+ (const String &lhs, const String &rhs) { return String (lhs._str + rhs._str); }
+    friend String operator+ (const String &lhs, const char *rhs) { return String (lhs._str + rhs); }
+    friend String operator+ (const char *lhs, const String &rhs) { return String (lhs + rhs._str); }
+    bool operator== (const String &rhs) const { return _str == rhs._str; }
+    bool operator!= (const String &rhs) const { return _str != rhs._str; }
+
+protected:
+    std::string _str;
+};
+
+class IPAddress {
+public:
+    IPAddress () : _address (0) {}
+    IPAddress (uint8_t first, uint8_t second, uint8_t third, uint8_t fourth) {
+        uint8_t *bytes = (uint8_t *)&_address;
+        bytes[0] = first;
+        bytes[1] = second;
+        bytes[2] = third;
+        bytes[3] = fourth;
+    }
+    IPAddress (uint32_t address) : _address (address) {} ///< Address in network byte order, as in struct in_addr
+
+    operator uint32_t () const { return _address; }
+    bool operator== (const IPAddress &rhs) const { return _address == rhs._address; }
+    bool operator!= (const IPAddress &rhs) const { return _address != rhs._address; }
+    uint8_t operator[] (int index) const { return ((const uint8_t *)&_address)[index]; }
+
+    bool fromString (const char *address);
+    String toString () const;
+
+protected:
+    uint32_t _address;
+};
+
+class HardwareSerial {
+public:
+    void begin (unsigned long) {}
+    int printf (const char *format, ...) __attribute__ ((format (printf, 2, 3)));
+    size_t print (const char *str);
+    size_t print (const String &str) { return print (str.c_str ()); }
+    size_t print (char c);
+    size_t print (int value) { return print ((long)value); }
+    size_t print (unsigned int value) { return print ((unsigned long)value); }
+    size_t print (long value);
+    size_t print (unsigned long value);
+    size_t print (double value, int digits = 2);
+    size_t print (const IPAddress &address) { return print (address.toString ()); }
+    template <typename T> size_t println (const T &value) { return print (value) + println (); }
+    size_t println () { return print ("\n"); }
+    void flush ();
+};
+
+extern HardwareSerial Serial;
+
+#endif // _Host_Arduino_h
@@ -0,0 +1,399 @@
+/*
+ Name:		NTPFleetSim.cpp
+ Author:	Germán Martín (gmag11@gmail.com)
+ Maintainer:Germán Martín (gmag11@gmail.com)
+
+ Fleet scale load simulator. Runs thousands of NTPClient instances in one process against an
+ in-process stand-in server, on simulated time, so that hours of fleet operation take seconds.
+ Every client has its own clock with a random frequency error of up to -d ppm, and every packet
+ may be lost (-l) or delayed (-r base plus up to -j jitter, each way). Server may be given a
+ capacity (-c); requests above it in a second are dropped, as an overloaded server would do.
+
+ By default all clients boot at once, as after a power cut. Use -b to spread boots over some
+ seconds, and -J to change the random spread of client poll intervals (NTP_POLL_SPREAD percent by
+ default) that breaks such herds up. Reports server requests per second and thundering herd peaks, and the distribution
+ of client clock error against true time once -w seconds of warm up have passed. Report period -p
+ is rounded up to a multiple of the 10 s sampling period.
+
+ Usage: ntp_fleet_sim [-n clients] [-t seconds] [-d drift_ppm] [-l loss_percent] [-r delay_ms]
+                      [-j jitter_ms] [-b boot_spread_s] [-c capacity_qps] [-i min_poll_s]
+                      [-I max_poll_s] [-J poll_spread_percent] [-B burst] [-s slew_ms] [-w warm_up_s]
+                      [-p report_s] [-S seed]
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <random>
+#include <vector>
+#include <NtpClientLib.h>
+
+#define NTP_PACKET_SIZE 48
+#define SIM_EPOCH 1790000000ULL // Simulated time starts on 2026-09-21 UTC
+#define SIM_BUSY_TICK 10000     // Clients waiting for a response run loop () every this number of microseconds
+#define SIM_IDLE_TICK 100000    // Idle clients run loop () every this number of microseconds
+#define SIM_SERVER_TIME 20      // Server processing time, in microseconds
+#define SIM_SAMPLE_PERIOD 10    // Client clock error is sampled every this number of seconds
+#define SIM_SAMPLE_EVENT UINT32_MAX // Event queue entry that samples clock error instead of running a client
+
+static uint64_t s_trueUs = 0;   // Simulated true time since simulation start, in microseconds
+static std::mt19937 s_random;
+static const IPAddress s_serverAddress (10, 0, 0, 1);
+
+static uint32_t randomBelow (uint32_t limit) {
+    return limit ? s_random () % limit : 0;
+}
+
+static uint64_t ntpTimestamp (uint64_t trueUs) {
+    uint64_t seconds = SIM_EPOCH + SEVENTY_YEARS + trueUs / 1000000;
+    uint64_t fraction = ((trueUs % 1000000) << 32) / 1000000;
+    return (seconds << 32) | fraction;
+}
+
+static void writeTimestamp (uint8_t *buffer, uint64_t timestamp) {
+    for (int i = 0; i < 8; i++) {
+        buffer[i] = timestamp >> (56 - 8 * i);
+    }
+}
+
+// Local clock of a simulated device. It starts on boot and runs off true time by a fixed frequency error
+class SimClock : public NTPClock {
+public:
+    uint64_t bootUs = 0;        // True time of boot
+    int32_t driftPpb = 0;       // Frequency error, in parts per billion
+
+    uint32_t millis () { return localUs () / 1000; }
+    uint32_t micros () { return localUs (); }
+
+    uint64_t localUs () {
+        int64_t elapsed = s_trueUs - bootUs;
+        return elapsed + elapsed * driftPpb / 1000000000;
+    }
+};
+
+typedef struct {
+    uint64_t deliverUs;         // True time when packet reaches client
+    uint8_t data[NTP_PACKET_SIZE];
+} SimPacket_t;
+
+// Stand-in server shared by all clients. Counts accepted requests per second and per 100 ms
+class SimServer {
+public:
+    uint32_t loss = 0;          // Loss probability of every packet, in percent
+    uint32_t delayUs = 0;       // Minimum one way delay
+    uint32_t jitterUs = 0;      // Maximum random delay added to every packet
+    uint32_t capacity = 0;      // Requests answered per second. 0 means unlimited
+    std::vector<uint32_t> perSecond; // Accepted requests, by second of arrival
+    std::vector<uint32_t> perTenth; // Accepted requests, by 100 ms slot of arrival
+    uint64_t lost = 0;          // Requests or responses lost in the network
+    uint64_t overloaded = 0;    // Requests dropped above capacity
+
+    void handle (const uint8_t *request, size_t length, std::vector<SimPacket_t> &inbox);
+
+protected:
+    uint32_t oneWayDelay () { return delayUs + randomBelow (jitterUs + 1); }
+    bool dropped () { return loss && randomBelow (100) < loss; }
+};
+
+// Datagram transport of a simulated device. Responses wait in an inbox until their delivery time
+class SimTransport : public NTPTransport {
+public:
+    SimServer *server = NULL;
+    std::vector<SimPacket_t> inbox;
+
+    bool begin (uint16_t /* port */) { return true; }
+    void stop () { inbox.clear (); } // Responses to a closed socket are lost
+
+    uint8_t resolve (const char* /* name */, IPAddress *addresses, uint8_t max) {
+        if (!max)
+            return 0;
+        addresses[0] = s_serverAddress;
+        return 1;
+    }
+
+    bool send (const IPAddress &address, uint16_t /* port */, const uint8_t *buffer, size_t length) {
+        if (address == s_serverAddress)
+            server->handle (buffer, length, inbox);
+        return true;
+    }
+
+    int receive (uint8_t *buffer, size_t length, IPAddress &address, uint16_t &port) {
+        for (size_t i = 0; i < inbox.size (); i++) {
+            if (inbox[i].deliverUs <= s_trueUs) {
+                size_t size = length < NTP_PACKET_SIZE ? length : NTP_PACKET_SIZE;
+                memcpy (buffer, inbox[i].data, size);
+                inbox.erase (inbox.begin () + i);
+                address = s_serverAddress;
+                port = DEFAULT_NTP_SERVER_PORT;
+                return size;
+            }
+        }
+        return 0;
+    }
+
+    // Earliest delivery still ahead. Packets that are already due and were not read are discarded
+    uint64_t nextDelivery () {
+        uint64_t next = UINT64_MAX;
+        for (size_t i = 0; i < inbox.size ();) {
+            if (inbox[i].deliverUs <= s_trueUs) {
+                inbox.erase (inbox.begin () + i);
+            } else {
+                next = std::min (next, inbox[i].deliverUs);
+                i++;
+            }
+        }
+        return next;
+    }
+};
+
+void SimServer::handle (const uint8_t *request, size_t length, std::vector<SimPacket_t> &inbox) {
+    if (length < NTP_PACKET_SIZE || (request[0] & 0x07) != 3) // Only client mode requests
+        return;
+    if (dropped ()) {
+        lost++;
+        return;
+    }
+    uint64_t arrival = s_trueUs + oneWayDelay ();
+    size_t second = arrival / 1000000;
+    if (perSecond.size () <= second) {
+        perSecond.resize (second + 1);
+        perTenth.resize ((second + 1) * 10);
+    }
+    if (capacity && perSecond[second] >= capacity) {
+        overloaded++;
+        return;
+    }
+    perSecond[second]++;
+    perTenth[arrival / 100000]++;
+    if (dropped ()) {
+        lost++;
+        return;
+    }
+
+    SimPacket_t response;
+    uint8_t *packet = response.data;
+    memset (packet, 0, NTP_PACKET_SIZE);
+    packet[0] = (request[0] & 0x38) | 4; // LI 0, same version, server mode
+    packet[1] = 1; // Stratum
+    packet[2] = request[2];
+    packet[3] = 0xEC; // Precision, about 60 ns
+    packet[9] = 0x01; // Root dispersion, 1/256 s
+    memcpy (packet + 12, "LOCL", 4);
+    writeTimestamp (packet + 16, ntpTimestamp (arrival));
+    memcpy (packet + 24, request + 40, 8); // Originate is client transmit
+    writeTimestamp (packet + 32, ntpTimestamp (arrival));
+    writeTimestamp (packet + 40, ntpTimestamp (arrival + SIM_SERVER_TIME));
+    response.deliverUs = arrival + SIM_SERVER_TIME + oneWayDelay ();
+    inbox.push_back (response);
+}
+
+typedef struct {
+    NTPClient client;
+    SimClock clock;
+    SimTransport transport;
+    bool booted;
+} SimNode_t;
+
+static uint64_t percentile (std::vector<uint64_t> &values, double fraction) {
+    if (values.empty ())
+        return 0;
+    size_t index = (size_t)(fraction * (values.size () - 1));
+    std::nth_element (values.begin (), values.begin () + index, values.end ());
+    return values[index];
+}
+
+// Highest accepted request count of any slot in [first, last)
+static uint32_t peakCount (const std::vector<uint32_t> &counts, size_t first, size_t last, size_t *at = NULL) {
+    uint32_t peak = 0;
+    for (size_t i = first; i < last && i < counts.size (); i++) {
+        if (counts[i] > peak) {
+            peak = counts[i];
+            if (at)
+                *at = i;
+        }
+    }
+    return peak;
+}
+
+static uint64_t sumCount (const std::vector<uint32_t> &counts, size_t first, size_t last) {
+    uint64_t sum = 0;
+    for (size_t i = first; i < last && i < counts.size (); i++) {
+        sum += counts[i];
+    }
+    return sum;
+}
+
+int main (int argc, char *argv[]) {
+    uint32_t clients = 1000;
+    uint32_t duration = 3600;
+    double driftPpm = 50;
+    uint32_t delayMs = 2;
+    uint32_t jitterMs = 1;
+    uint32_t bootSpread = 0;
+    int minPoll = DEFAULT_NTP_SHORTINTERVAL;
+    int maxPoll = DEFAULT_NTP_INTERVAL;
+    int burst = 0;
+    int spread = -1;
+    int slewMs = -1;
+    uint32_t warmUp = 300;
+    uint32_t reportPeriod = 300;
+    uint32_t seed = 1;
+    SimServer server;
+    server.loss = 1;
+    int opt;
+    while ((opt = getopt (argc, argv, "n:t:d:l:r:j:b:c:i:I:J:B:s:w:p:S:")) != -1) {
+        switch (opt) {
+        case 'n': clients = atoi (optarg) > 0 ? atoi (optarg) : 1; break;
+        case 't': duration = atoi (optarg) > 0 ? atoi (optarg) : 1; break;
+        case 'd': driftPpm = atof (optarg); break;
+        case 'l': server.loss = atoi (optarg); break;
+        case 'r': delayMs = atoi (optarg); break;
+        case 'j': jitterMs = atoi (optarg); break;
+        case 'b': bootSpread = atoi (optarg); break;
+        case 'c': server.capacity = atoi (optarg); break;
+        case 'i': minPoll = atoi (optarg); break;
+        case 'I': maxPoll = atoi (optarg); break;
+        case 'J': spread = atoi (optarg); break;
+        case 'B': burst = atoi (optarg); break;
+        case 's': slewMs = atoi (optarg); break;
+        case 'w': warmUp = atoi (optarg); break;
+        case 'p': reportPeriod = atoi (optarg) > 0 ? atoi (optarg) : 1; break;
+        case 'S': seed = atoi (optarg); break;
+        default:
+            fprintf (stderr, "Usage: %s [-n clients] [-t seconds] [-d drift_ppm] [-l loss_percent] [-r delay_ms] [-j jitter_ms] [-b boot_spread_s]"
+                             " [-c capacity_qps] [-i min_poll_s] [-I max_poll_s] [-J poll_spread_percent] [-B burst] [-s slew_ms] [-w warm_up_s] [-p report_s] [-S seed]\n", argv[0]);
+            return 1;
+        }
+    }
+    reportPeriod = (reportPeriod + SIM_SAMPLE_PERIOD - 1) / SIM_SAMPLE_PERIOD * SIM_SAMPLE_PERIOD; // Reports are taken on samples
+    s_random.seed (seed);
+    server.delayUs = delayMs * 1000;
+    server.jitterUs = jitterMs * 1000;
+
+    // Clients are not copyable, so the whole fleet is allocated at once
+    std::unique_ptr<SimNode_t[]> nodes (new SimNode_t[clients]);
+    typedef std::pair<uint64_t, uint32_t> SimEvent_t; // True time, client index
+    std::priority_queue<SimEvent_t, std::vector<SimEvent_t>, std::greater<SimEvent_t> > events;
+    for (uint32_t i = 0; i < clients; i++) {
+        SimNode_t &node = nodes[i];
+        node.clock.driftPpb = (int32_t)((s_random () / 4294967295.0 * 2 - 1) * driftPpm * 1000);
+        node.transport.server = &server;
+        node.booted = false;
+        node.client.setTimeLibSync (false); // Time library holds a single clock, shared by the whole process
+        node.client.setClock (&node.clock);
+        node.client.setTransport (&node.transport);
+        if (burst)
+            node.client.setBurst (burst);
+        if (spread >= 0)
+            node.client.setPollSpread (spread);
+        if (slewMs >= 0)
+            node.client.setSlewMode (slewMs > 0, slewMs);
+        events.push (SimEvent_t ((uint64_t)randomBelow (bootSpread * 1000) * 1000, i));
+    }
+    events.push (SimEvent_t (SIM_SAMPLE_PERIOD * 1000000ULL, SIM_SAMPLE_EVENT));
+
+    printf ("Simulating %u clients for %u s. Drift up to %.1f ppm, loss %u%%, delay %u+%u ms, boot spread %u s, capacity %u qps, poll spread %u%%\n",
+            clients, duration, driftPpm, server.loss, delayMs, jitterMs, bootSpread, server.capacity, nodes[0].client.getPollSpread ());
+    printf ("%8s %8s %8s %8s %8s %10s %10s\n", "time s", "mean qps", "peak qps", "synced", "lost", "p50 err us", "p99 err us");
+
+    std::vector<uint64_t> errors; // Absolute clock errors sampled after warm up
+    std::vector<uint64_t> sample; // Absolute clock errors of last sample
+    uint64_t periodLost = 0;
+    uint64_t endUs = (uint64_t)duration * 1000000;
+    clock_t started = clock ();
+    while (!events.empty () && events.top ().first < endUs) {
+        SimEvent_t event = events.top ();
+        events.pop ();
+        s_trueUs = event.first;
+
+        if (event.second == SIM_SAMPLE_EVENT) {
+            uint64_t trueUtcUs = SIM_EPOCH * 1000000 + s_trueUs;
+            uint32_t synced = 0;
+            sample.clear ();
+            for (uint32_t i = 0; i < clients; i++) {
+                NTPClient &client = nodes[i].client;
+                if (!nodes[i].booted || client.getTimeSinceLastSync () < 0)
+                    continue;
+                int64_t error = (int64_t)(client.nowUs () - trueUtcUs);
+                uint64_t magnitude = error < 0 ? -error : error;
+                sample.push_back (magnitude);
+                if (s_trueUs >= (uint64_t)warmUp * 1000000)
+                    errors.push_back (magnitude);
+                synced++;
+            }
+            uint32_t second = s_trueUs / 1000000;
+            if (second % reportPeriod == 0) {
+                uint32_t first = second - reportPeriod;
+                printf ("%8u %8.1f %8u %8u %8llu %10llu %10llu\n", second, (double)sumCount (server.perSecond, first, second) / reportPeriod,
+                        peakCount (server.perSecond, first, second), synced, (unsigned long long)(server.lost + server.overloaded - periodLost),
+                        (unsigned long long)percentile (sample, 0.5), (unsigned long long)percentile (sample, 0.99));
+                periodLost = server.lost + server.overloaded;
+            }
+            events.push (SimEvent_t (s_trueUs + SIM_SAMPLE_PERIOD * 1000000ULL, SIM_SAMPLE_EVENT));
+            continue;
+        }
+
+        SimNode_t &node = nodes[event.second];
+        if (!node.booted) {
+            node.booted = true;
+            node.clock.bootUs = s_trueUs;
+            if (!node.client.begin ("sim", 0, false, 0, &node.transport)) {
+                fprintf (stderr, "Cannot start client %u\n", event.second);
+                return 1;
+            }
+            node.client.setInterval (minPoll, maxPoll);
+            node.client.getTime (); // First request, as Time library would do on sync provider set
+        }
+        node.client.loop ();
+        NTPSyncStatus_t status = node.client.getSyncStatus ();
+        uint64_t next = s_trueUs + (status == syncSent || status == syncResolving ? SIM_BUSY_TICK : SIM_IDLE_TICK);
+        events.push (SimEvent_t (std::min (next, node.transport.nextDelivery ()), event.second));
+    }
+    double elapsed = (double)(clock () - started) / CLOCKS_PER_SEC;
+
+    uint64_t requests = sumCount (server.perSecond, 0, duration);
+    size_t peakSecond = 0;
+    size_t peakTenth = 0;
+    uint32_t peak = peakCount (server.perSecond, 0, duration, &peakSecond);
+    uint32_t peakBurst = peakCount (server.perTenth, 0, (size_t)duration * 10, &peakTenth);
+    uint32_t peakSteady = peakCount (server.perSecond, warmUp, duration); // Boot herd left out
+    double mean = (double)requests / duration;
+    uint32_t herdSeconds = 0;
+    for (size_t i = 0; i < duration && i < server.perSecond.size (); i++) {
+        if (server.perSecond[i] > 2 * mean)
+            herdSeconds++;
+    }
+    uint64_t syncs = 0;
+    uint64_t timeouts = 0;
+    uint64_t noResponse = 0;
+    uint32_t unsynced = 0;
+    for (uint32_t i = 0; i < clients; i++) {
+        const NTPStats_t &stats = nodes[i].client.getStats ();
+        syncs += stats.syncs;
+        noResponse += stats.noResponse;
+        for (int j = 0; j < NTP_MAX_SERVERS; j++) {
+            timeouts += stats.servers[j].timeouts;
+        }
+        if (nodes[i].client.getTimeSinceLastSync () < 0)
+            unsynced++;
+    }
+
+    printf ("\nServer: %llu requests, mean %.1f qps, peak %u qps at %zu s, peak 100 ms rate %u qps at %.1f s\n",
+            (unsigned long long)requests, mean, peak, peakSecond, peakBurst * 10, peakTenth / 10.0);
+    printf ("Herd: peak is %.1f times mean, %u s above twice mean, peak after %u s warm up %u qps. Lost %llu, dropped above capacity %llu\n",
+            mean ? peak / mean : 0, herdSeconds, warmUp, peakSteady, (unsigned long long)server.lost, (unsigned long long)server.overloaded);
+    printf ("Clients: %llu syncs, %llu timeouts, %llu syncs without response, %u never synced\n",
+            (unsigned long long)syncs, (unsigned long long)timeouts, (unsigned long long)noResponse, unsynced);
+    printf ("Clock error after %u s: p50 %llu us, p90 %llu us, p99 %llu us, p99.9 %llu us, max %llu us (%zu samples)\n", warmUp,
+            (unsigned long long)percentile (errors, 0.5), (unsigned long long)percentile (errors, 0.9), (unsigned long long)percentile (errors, 0.99),
+            (unsigned long long)percentile (errors, 0.999), (unsigned long long)percentile (errors, 1), errors.size ());
+    printf ("Simulated %u s in %.1f s\n", duration, elapsed);
+    return 0;
+}
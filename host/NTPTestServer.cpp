@@ -0,0 +1,171 @@
+/*
+ Name:		NTPTestServer.cpp
+ Author:	Germán Martín (gmag11@gmail.com)
+ Maintainer:Germán Martín (gmag11@gmail.com)
+
+ Stand-in NTP server to test NtpClientLib on a host without Internet access. It answers
+ client requests with system time, optionally shifted, delayed or dropped to exercise
+ client error handling. With -b it also sends broadcast packets every -i seconds to given
+ address, that may be a broadcast, multicast or plain unicast one like 127.0.0.1. With -k it
+ answers every request with a Kiss-o'-Death packet carrying given code, like RATE or DENY.
+ With -a it listens on given local address only, so that several servers may share a port
+ on loopback addresses 127.0.0.1, 127.0.0.2 and so on.
+
+ Usage: ntp_test_server [-p port] [-o offset_ms] [-d delay_ms] [-l loss_percent] [-s stratum]
+                        [-b address:port] [-i interval_s] [-k kiss_code] [-a address]
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define NTP_PACKET_SIZE 48
+#define SEVENTY_YEARS 2208988800ULL
+
+static uint64_t ntpNow (int64_t offsetMs) {
+    struct timespec ts;
+    clock_gettime (CLOCK_REALTIME, &ts);
+    int64_t us = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000 + offsetMs * 1000;
+    uint64_t seconds = us / 1000000 + SEVENTY_YEARS;
+    uint64_t fraction = ((uint64_t)(us % 1000000) << 32) / 1000000;
+    return (seconds << 32) | fraction;
+}
+
+static void writeTimestamp (uint8_t *buffer, uint64_t timestamp) {
+    for (int i = 0; i < 8; i++) {
+        buffer[i] = timestamp >> (56 - 8 * i);
+    }
+}
+
+static void fillHeader (uint8_t *packet, uint8_t mode, int stratum, uint64_t reference) {
+    packet[0] = mode; // LI 0, version and mode
+    packet[1] = stratum;
+    packet[3] = 0xEC; // Precision, about 60 ns
+    packet[9] = 0x01; // Root dispersion, 1/256 s
+    memcpy (packet + 12, "LOCL", 4);
+    writeTimestamp (packet + 16, reference);
+}
+
+int main (int argc, char *argv[]) {
+    int port = 12300;
+    int64_t offsetMs = 0;
+    int delayMs = 0;
+    int loss = 0;
+    int stratum = 1;
+    int interval = 4;
+    const char *kiss = NULL;
+    struct sockaddr_in broadcast;
+    memset (&broadcast, 0, sizeof (broadcast));
+    struct in_addr listen;
+    listen.s_addr = htonl (INADDR_ANY);
+    char *colon;
+    int opt;
+    while ((opt = getopt (argc, argv, "p:o:d:l:s:b:i:k:a:")) != -1) {
+        switch (opt) {
+        case 'p': port = atoi (optarg); break;
+        case 'o': offsetMs = atoll (optarg); break;
+        case 'd': delayMs = atoi (optarg); break;
+        case 'l': loss = atoi (optarg); break;
+        case 's': stratum = atoi (optarg); break;
+        case 'b':
+            colon = strchr (optarg, ':');
+            if (colon)
+                *colon = 0;
+            broadcast.sin_family = AF_INET;
+            broadcast.sin_port = htons (colon ? atoi (colon + 1) : 123);
+            if (!inet_aton (optarg, &broadcast.sin_addr)) {
+                fprintf (stderr, "Invalid broadcast address %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'i': interval = atoi (optarg) > 0 ? atoi (optarg) : 1; break;
+        case 'k': kiss = optarg; break;
+        case 'a':
+            if (!inet_aton (optarg, &listen)) {
+                fprintf (stderr, "Invalid listen address %s\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            fprintf (stderr, "Usage: %s [-p port] [-o offset_ms] [-d delay_ms] [-l loss_percent] [-s stratum] [-b address:port] [-i interval_s] [-k kiss_code] [-a address]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    int sock = socket (AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in local;
+    memset (&local, 0, sizeof (local));
+    local.sin_family = AF_INET;
+    local.sin_addr = listen;
+    local.sin_port = htons (port);
+    if (sock < 0 || bind (sock, (struct sockaddr *)&local, sizeof (local)) < 0) {
+        perror ("bind");
+        return 1;
+    }
+    int enable = 1;
+    setsockopt (sock, SOL_SOCKET, SO_BROADCAST, &enable, sizeof (enable));
+    printf ("NTP test server listening on port %d. Offset %lld ms, delay %d ms, loss %d%%\n", port, (long long)offsetMs, delayMs, loss);
+    if (broadcast.sin_family)
+        printf ("Broadcasting to %s:%d every %d s\n", inet_ntoa (broadcast.sin_addr), ntohs (broadcast.sin_port), interval);
+    fflush (stdout);
+
+    uint8_t buffer[NTP_PACKET_SIZE];
+    time_t nextBroadcast = 0;
+    for (;;) {
+        if (broadcast.sin_family) {
+            time_t current = time (NULL);
+            if (current >= nextBroadcast) {
+                nextBroadcast = current + interval;
+                uint8_t packet[NTP_PACKET_SIZE];
+                memset (packet, 0, sizeof (packet));
+                uint64_t transmit = ntpNow (offsetMs);
+                fillHeader (packet, 0x25, stratum, transmit); // Version 4, broadcast mode
+                for (int poll = interval; poll > 1; poll >>= 1) {
+                    packet[2]++; // Poll, as log2 seconds
+                }
+                writeTimestamp (packet + 40, transmit);
+                if (!loss || rand () % 100 >= loss)
+                    sendto (sock, packet, sizeof (packet), 0, (struct sockaddr *)&broadcast, sizeof (broadcast));
+            }
+            // Wait for requests until next broadcast is due
+            fd_set readable;
+            FD_ZERO (&readable);
+            FD_SET (sock, &readable);
+            struct timeval timeout = { nextBroadcast - current, 0 };
+            if (select (sock + 1, &readable, NULL, NULL, &timeout) <= 0)
+                continue;
+        }
+        struct sockaddr_in remote;
+        socklen_t remoteLength = sizeof (remote);
+        ssize_t size = recvfrom (sock, buffer, sizeof (buffer), 0, (struct sockaddr *)&remote, &remoteLength);
+        uint64_t receive = ntpNow (offsetMs);
+        if (size < NTP_PACKET_SIZE || (buffer[0] & 0x07) != 3) // Only client mode requests
+            continue;
+        if (loss && rand () % 100 < loss)
+            continue;
+        if (delayMs)
+            usleep (delayMs * 1000);
+
+        uint8_t response[NTP_PACKET_SIZE];
+        memset (response, 0, sizeof (response));
+        fillHeader (response, (buffer[0] & 0x38) | 4, stratum, receive); // Same version, server mode
+        response[2] = buffer[2];
+        if (kiss) {
+            response[0] |= 0xC0; // Unsynchronized
+            response[1] = 0; // Stratum 0 makes reference ID a kiss code
+            memset (response + 12, ' ', 4);
+            memcpy (response + 12, kiss, strlen (kiss) < 4 ? strlen (kiss) : 4);
+        }
+        memcpy (response + 24, buffer + 40, 8); // Originate is client transmit
+        writeTimestamp (response + 32, receive);
+        writeTimestamp (response + 40, ntpNow (offsetMs));
+        sendto (sock, response, sizeof (response), 0, (struct sockaddr *)&remote, remoteLength);
+    }
+}
@@ -0,0 +1,177 @@
+/*
+ Name:		TimeLib.cpp
+ Author:	Germán Martín (gmag11@gmail.com)
+ Maintainer:Germán Martín (gmag11@gmail.com)
+
+ Host replacement for Paul Stoffregen's Time library. Clock runs on millis () and calls sync
+ provider exactly as the original library does, and calendar conversion is done with its loops.
+*/
+
+#include "TimeLib.h"
+
+static uint32_t sysTime = 0;
+static uint32_t prevMillis = 0;
+static uint32_t nextSyncTime = 0;
+static uint32_t syncInterval = 300; // Same default as Time library
+static timeStatus_t Status = timeNotSet;
+static getExternalTime getTimePtr = NULL;
+
+static tmElements_t tm;
+static time_t cacheTime = -1; // Time broken into tm
+
+static void refreshCache (time_t t) {
+    if (t != cacheTime) {
+        breakTime (t, tm);
+        cacheTime = t;
+    }
+}
+
+int hour () { return hour (now ()); }
+int hour (time_t t) { refreshCache (t); return tm.Hour; }
+int hourFormat12 () { return hourFormat12 (now ()); }
+int hourFormat12 (time_t t) {
+    refreshCache (t);
+    if (tm.Hour == 0)
+        return 12;
+    return tm.Hour > 12 ? tm.Hour - 12 : tm.Hour;
+}
+uint8_t isAM () { return !isPM (now ()); }
+uint8_t isAM (time_t t) { return !isPM (t); }
+uint8_t isPM () { return isPM (now ()); }
+uint8_t isPM (time_t t) { return hour (t) >= 12; }
+int minute () { return minute (now ()); }
+int minute (time_t t) { refreshCache (t); return tm.Minute; }
+int second () { return second (now ()); }
+int second (time_t t) { refreshCache (t); return tm.Second; }
+int day () { return day (now ()); }
+int day (time_t t) { refreshCache (t); return tm.Day; }
+int weekday () { return weekday (now ()); }
+int weekday (time_t t) { refreshCache (t); return tm.Wday; }
+int month () { return month (now ()); }
+int month (time_t t) { refreshCache (t); return tm.Month; }
+int year () { return year (now ()); }
+int year (time_t t) { refreshCache (t); return tmYearToCalendar (tm.Year); }
+
+// Calendar conversion uses same year and month loops as Time library, so that benchmarks compare
+// against the code that runs on boards, not against libc
+#define LEAP_YEAR(Y) (((1970 + (Y)) > 0) && !((1970 + (Y)) % 4) && (((1970 + (Y)) % 100) || !((1970 + (Y)) % 400)))
+
+static const uint8_t monthDays[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+void breakTime (time_t timeInput, tmElements_t &tm) {
+    uint32_t time = (uint32_t)timeInput;
+    tm.Second = time % 60;
+    time /= 60; // Minutes
+    tm.Minute = time % 60;
+    time /= 60; // Hours
+    tm.Hour = time % 24;
+    time /= 24; // Days
+    tm.Wday = ((time + 4) % 7) + 1; // Sunday is day 1
+
+    uint8_t year = 0;
+    unsigned long days = 0;
+    while ((unsigned)(days += (LEAP_YEAR (year) ? 366 : 365)) <= time) {
+        year++;
+    }
+    tm.Year = year; // Offset from 1970
+    days -= LEAP_YEAR (year) ? 366 : 365;
+    time -= days; // Days in this year, starting at 0
+
+    uint8_t month;
+    for (month = 0; month < 12; month++) {
+        uint8_t monthLength;
+        if (month == 1) // February
+            monthLength = LEAP_YEAR (year) ? 29 : 28;
+        else
+            monthLength = monthDays[month];
+        if (time >= monthLength)
+            time -= monthLength;
+        else
+            break;
+    }
+    tm.Month = month + 1; // January is month 1
+    tm.Day = time + 1;
+}
+
+time_t makeTime (const tmElements_t &tm) {
+    // Seconds from 1970 till 1 jan 00:00:00 of given year
+    uint32_t seconds = tm.Year * (SECS_PER_DAY * 365);
+    for (int i = 0; i < tm.Year; i++) {
+        if (LEAP_YEAR (i))
+            seconds += SECS_PER_DAY; // Extra day of leap years
+    }
+    // Days of this year. Months start from 1
+    for (int i = 1; i < tm.Month; i++) {
+        if (i == 2 && LEAP_YEAR (tm.Year))
+            seconds += SECS_PER_DAY * 29;
+        else
+            seconds += SECS_PER_DAY * monthDays[i - 1];
+    }
+    seconds += (tm.Day - 1) * SECS_PER_DAY;
+    seconds += tm.Hour * SECS_PER_HOUR;
+    seconds += tm.Minute * SECS_PER_MIN;
+    seconds += tm.Second;
+    return (time_t)seconds;
+}
+
+time_t now () {
+    // Calculate number of seconds passed since last call to now ()
+    while (millis () - prevMillis >= 1000) {
+        sysTime++;
+        prevMillis += 1000;
+    }
+    if (nextSyncTime <= sysTime) {
+        if (getTimePtr != NULL) {
+            time_t t = getTimePtr ();
+            if (t != 0) {
+                setTime (t);
+            } else {
+                nextSyncTime = sysTime + syncInterval;
+                Status = (Status == timeNotSet) ? timeNotSet : timeNeedsSync;
+            }
+        }
+    }
+    return (time_t)sysTime;
+}
+
+void setTime (time_t t) {
+    sysTime = (uint32_t)t;
+    nextSyncTime = (uint32_t)t + syncInterval;
+    Status = timeSet;
+    prevMillis = millis ();
+}
+
+void setTime (int hr, int min, int sec, int dy, int mnth, int yr) {
+    tmElements_t elements;
+    if (yr > 99)
+        yr = yr - 1970;
+    else
+        yr += 30;
+    elements.Year = yr;
+    elements.Month = mnth;
+    elements.Day = dy;
+    elements.Hour = hr;
+    elements.Minute = min;
+    elements.Second = sec;
+    setTime (makeTime (elements));
+}
+
+void adjustTime (long adjustment) {
+    sysTime += adjustment;
+}
+
+timeStatus_t timeStatus () {
+    now ();
+    return Status;
+}
+
+void setSyncProvider (getExternalTime getTimeFunction) {
+    getTimePtr = getTimeFunction;
+    nextSyncTime = sysTime;
+    now ();
+}
+
+void setSyncInterval (time_t interval) {
+    syncInterval = (uint32_t)interval;
+    nextSyncTime = sysTime + syncInterval;
+}
@@ -0,0 +1,76 @@
+/*
+ Name:		TimeLib.h
+ Author:	Germán Martín (gmag11@gmail.com)
+ Maintainer:Germán Martín (gmag11@gmail.com)
+
+ Host replacement for Paul Stoffregen's Time library (https://github.com/PaulStoffregen/Time).
+ Same API and sync provider behaviour, so NtpClientLib runs unchanged on POSIX hosts.
+*/
+
+#ifndef _Host_TimeLib_h
+#define _Host_TimeLib_h
+
+#include "Arduino.h"
+#include <time.h>
+
+typedef enum { timeNotSet, timeNeedsSync, timeSet } timeStatus_t;
+
+typedef enum { dowInvalid, dowSunday, dowMonday, dowTuesday, dowWednesday, dowThursday, dowFriday, dowSaturday } timeDayOfWeek_t;
+
+typedef struct {
+    uint8_t Second;
+    uint8_t Minute;
+    uint8_t Hour;
+    uint8_t Wday;   // day of week, sunday is day 1
+    uint8_t Day;
+    uint8_t Month;
+    uint8_t Year;   // offset from 1970
+} tmElements_t;
+
+typedef time_t (*getExternalTime)();
+
+#define tmYearToCalendar(Y) ((Y) + 1970)
+#define CalendarYrToTm(Y)   ((Y) - 1970)
+
+#define SECS_PER_MIN  ((time_t)(60UL))
+#define SECS_PER_HOUR ((time_t)(3600UL))
+#define SECS_PER_DAY  ((time_t)(SECS_PER_HOUR * 24UL))
+#define DAYS_PER_WEEK ((time_t)(7UL))
+#define SECS_PER_WEEK ((time_t)(SECS_PER_DAY * DAYS_PER_WEEK))
+#define SECS_PER_YEAR ((time_t)(SECS_PER_DAY * 365UL))
+#define SECS_YR_2000  ((time_t)(946684800UL))
+
+int hour ();
+int hour (time_t t);
+int hourFormat12 ();
+int hourFormat12 (time_t t);
+uint8_t isAM ();
+uint8_t isAM (time_t t);
+uint8_t isPM ();
+uint8_t isPM (time_t t);
+int minute ();
+int minute (time_t t);
+int second ();
+int second (time_t t);
+int day ();
+int day (time_t t);
+int weekday ();
+int weekday (time_t t);
+int month ();
+int month (time_t t);
+int year ();
+int year (time_t t);
+
+time_t now ();
+void setTime (time_t t);
+void setTime (int hr, int min, int sec, int day, int month, int yr);
+void adjustTime (long adjustment);
+
+timeStatus_t timeStatus ();
+void setSyncProvider (getExternalTime getTimeFunction);
+void setSyncInterval (time_t interval);
+
+void breakTime (time_t time, tmElements_t &tm);
+time_t makeTime (const tmElements_t &tm);
+
+#endif // _Host_TimeLib_h
@@ -0,0 +1,104 @@
+/*
+Copyright 2016 German Martin (gmag11@gmail.com). All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met :
+
+1. Redistributions of source code must retain the above copyright notice, this list of
+conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list
+of conditions and the following disclaimer in the documentation and / or other materials
+provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ''AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL <COPYRIGHT HOLDER> OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT(INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those of the
+authors and should not be interpreted as representing official policies, either expressed
+or implied, of German Martin
+*/
+//
+//
+//
+
+#include "NTPCalendar.h"
+
+uint8_t ntpDaysInMonth (int16_t year, uint8_t month) {
+    static const uint8_t monthDays[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    return monthDays[month - 1] + (month == 2 && ntpIsLeapYear (year));
+}
+
+// Years are counted from March, so that leap day is the last one of the year. Every 400 years
+// (an era) calendar repeats itself
+int32_t ntpDaysFromCivil (int16_t year, uint8_t month, uint8_t day) {
+    year -= month <= 2;
+    int32_t era = (year >= 0 ? year : year - 399) / 400;
+    uint16_t yearOfEra = year - era * 400;
+    uint16_t dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    uint32_t dayOfEra = (uint32_t)yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + (int32_t)dayOfEra - 719468;
+}
+
+void ntpCivilFromDays (int32_t days, NTPDateTime_t &date) {
+    date.weekday = (uint8_t)((days % 7 + 11) % 7) + 1; // 1970-01-01 was Thursday
+    days += 719468;
+    int32_t era = (days >= 0 ? days : days - 146096) / 146097;
+    uint32_t dayOfEra = days - era * 146097;
+    uint16_t yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    uint16_t dayOfYear = dayOfEra - ((uint32_t)yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100);
+    uint8_t monthIndex = (5 * dayOfYear + 2) / 153; // March = 0
+    date.day = dayOfYear - (153 * monthIndex + 2) / 5 + 1;
+    date.month = monthIndex < 10 ? monthIndex + 3 : monthIndex - 9;
+    date.year = yearOfEra + era * 400 + (date.month <= 2);
+}
+
+int16_t ntpYearFromDays (int32_t days) {
+    NTPDateTime_t date;
+    ntpCivilFromDays (days, date);
+    return date.year;
+}
+
+int32_t ntpDaysFromTime (time_t moment) {
+    if (moment >= 0 && (uint64_t)moment <= UINT32_MAX)
+        return (uint32_t)moment / NTP_SECS_PER_DAY; // 32 bit division is much cheaper on small boards
+    int64_t value = moment;
+    return value >= 0 ? value / NTP_SECS_PER_DAY : -((-value + NTP_SECS_PER_DAY - 1) / NTP_SECS_PER_DAY);
+}
+
+const NTPDateTime_t& NTPCalendar::breakTime (time_t moment) {
+    if (moment >= _dayStart && moment < _dayEnd) {
+        if (moment >= _moment && moment - _moment < 60) {
+            // Usual case: called again a few seconds later
+            _date.second += moment - _moment;
+            if (_date.second >= 60) {
+                _date.second -= 60;
+                if (++_date.minute >= 60) {
+                    _date.minute = 0;
+                    _date.hour++; // Still same day, so it cannot reach 24
+                }
+            }
+            _moment = moment;
+            return _date;
+        }
+    } else {
+        int32_t days = ntpDaysFromTime (moment);
+        ntpCivilFromDays (days, _date);
+        _dayStart = (time_t)days * NTP_SECS_PER_DAY;
+        _dayEnd = _dayStart + NTP_SECS_PER_DAY;
+    }
+    uint32_t secondOfDay = moment - _dayStart;
+    _date.hour = secondOfDay / 3600;
+    uint16_t secondOfHour = secondOfDay - _date.hour * 3600UL;
+    _date.minute = secondOfHour / 60;
+    _date.second = secondOfHour - _date.minute * 60;
+    _moment = moment;
+    return _date;
+}
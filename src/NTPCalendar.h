@@ -0,0 +1,117 @@
+/*
+Copyright 2016 German Martin (gmag11@gmail.com). All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met :
+
+1. Redistributions of source code must retain the above copyright notice, this list of
+conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list
+of conditions and the following disclaimer in the documentation and / or other materials
+provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ''AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL <COPYRIGHT HOLDER> OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT(INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those of the
+authors and should not be interpreted as representing official policies, either expressed
+or implied, of German Martin
+*/
+/*
+ Name:		NTPCalendar.h
+ Author:	Germán Martín (gmag11@gmail.com)
+ Maintainer:Germán Martín (gmag11@gmail.com)
+
+ Loop free Gregorian calendar conversions and a cached broken-down time.
+*/
+
+#ifndef _NTPCalendar_h
+#define _NTPCalendar_h
+
+#include <stdint.h>
+#include <time.h>
+
+#define NTP_SECS_PER_DAY 86400L
+
+typedef struct {
+    int16_t year;               ///< Calendar year, like 2018
+    uint8_t month;              ///< Month (1 to 12)
+    uint8_t day;                ///< Day of month (1 to 31)
+    uint8_t hour;               ///< Hour (0 to 23)
+    uint8_t minute;             ///< Minute (0 to 59)
+    uint8_t second;             ///< Second (0 to 59)
+    uint8_t weekday;            ///< Day of week (1 = Sunday), as in Time library
+} NTPDateTime_t;
+
+/**
+* Checks if a year has 366 days.
+* @param[in] Calendar year.
+*/
+inline bool ntpIsLeapYear (int16_t year) {
+    return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+/**
+* Gets number of days of a month.
+* @param[in] Calendar year.
+* @param[in] Month (1 to 12).
+*/
+uint8_t ntpDaysInMonth (int16_t year, uint8_t month);
+
+/**
+* Gets days since 1970-01-01 of a civil date, valid for any proleptic Gregorian date.
+* @param[in] Calendar year.
+* @param[in] Month (1 to 12).
+* @param[in] Day of month (1 to 31).
+*/
+int32_t ntpDaysFromCivil (int16_t year, uint8_t month, uint8_t day);
+
+/**
+* Gets civil date of a day given as days since 1970-01-01.
+* @param[in] Days since 1970-01-01.
+* @param[out] Date. Year, month, day and weekday are set. Time of day is not changed.
+*/
+void ntpCivilFromDays (int32_t days, NTPDateTime_t &date);
+
+/**
+* Gets year that contains a day given as days since 1970-01-01.
+* @param[in] Days since 1970-01-01.
+*/
+int16_t ntpYearFromDays (int32_t days);
+
+/**
+* Gets day that contains a given instant, as days since 1970-01-01. Rounds towards past for
+* instants before 1970.
+* @param[in] Time in UNIX format.
+*/
+int32_t ntpDaysFromTime (time_t moment);
+
+/**
+* Breaks time in UNIX format into calendar fields. Last result is kept, so calls for the same day
+* only have to calculate time of day, and calls a few seconds later just add them.
+*/
+class NTPCalendar {
+public:
+    /**
+    * Breaks time into calendar fields.
+    * @param[in] Time in UNIX format.
+    * @param[out] Calendar fields. Valid until next call.
+    */
+    const NTPDateTime_t& breakTime (time_t moment);
+
+protected:
+    NTPDateTime_t _date;        ///< Last result
+    time_t _moment = 0;         ///< Time of last result
+    time_t _dayStart = 1;       ///< First second of day of last result. Greater than _dayEnd until first call
+    time_t _dayEnd = 0;         ///< First second after day of last result
+};
+
+#endif // _NTPCalendar_h
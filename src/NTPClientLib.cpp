@@ -40,55 +40,192 @@ or implied, of German Martin
 #endif
 
 
+static NTPClient *s_timeLibClient = NULL; // Client that Time library gets time from
+
 NTPClient::NTPClient () {
+    _clock = &_defaultClock;
+    stirRandom ((uint32_t)(uintptr_t)this); // Differs between clients in the same program
+#ifdef NTPCLIENT_WORKER
+    _anchorSeq.store (0);
+    _workerRunning.store (false);
+#endif
+    publishAnchor ();
 }
 
-bool NTPClient::setNtpServerName (String ntpServerName) {
-    char * name = (char *)malloc ((ntpServerName.length () + 1) * sizeof (char));
+NTPClient::~NTPClient () {
+    stop ();
+    for (int i = 0; i < NTP_MAX_SERVERS; i++) {
+        releaseDnsCacheEntry (_servers[i].name);
+#ifndef NTPCLIENT_NO_HEAP
+        free (_servers[i].name);
+#endif
+        _servers[i].name = NULL;
+    }
+}
+
+bool NTPClient::setNtpServerName (const char* ntpServerName, int idx) {
+    if (idx < 0 || idx >= NTP_MAX_SERVERS || ntpServerName == NULL)
+        return false;
+    if (!ntpServerName[0]) {
+        if (idx == 0)
+            return false; // Main server cannot be disabled
+        releaseDnsCacheEntry (_servers[idx].name);
+#ifndef NTPCLIENT_NO_HEAP
+        free (_servers[idx].name);
+#endif
+        _servers[idx].name = NULL;
+        _servers[idx].parkedUntil = 0;
+        _servers[idx].kods = 0;
+        _stats.resetServer (idx);
+        DEBUGLOG ("NTP server %d disabled\n", idx);
+        return true;
+    }
+#ifdef NTPCLIENT_NO_HEAP
+    if (strlen (ntpServerName) >= NTP_SERVER_NAME_SIZE) {
+        DEBUGLOG ("NTP server name too long\n");
+        return false;
+    }
+    if (!_servers[idx].name || strcmp (_servers[idx].name, ntpServerName)) {
+        _stats.resetServer (idx);
+        _servers[idx].parkedUntil = 0;
+        _servers[idx].kods = 0;
+    }
+    releaseDnsCacheEntry (_servers[idx].name);
+    strcpy (_serverNames[idx], ntpServerName);
+    _servers[idx].name = _serverNames[idx];
+#else
+    char * name = (char *)malloc ((strlen (ntpServerName) + 1) * sizeof (char));
     if (!name)
         return false;
-    ntpServerName.toCharArray (name, ntpServerName.length () + 1);
-    DEBUGLOG ("NTP server set to %s\n", name);
-    free (_ntpServerName);
-    _ntpServerName = name;
+    strcpy (name, ntpServerName);
+    if (!_servers[idx].name || strcmp (_servers[idx].name, ntpServerName)) {
+        _stats.resetServer (idx);
+        _servers[idx].parkedUntil = 0;
+        _servers[idx].kods = 0;
+    }
+    releaseDnsCacheEntry (_servers[idx].name);
+    free (_servers[idx].name);
+    _servers[idx].name = name;
+#endif
+    DEBUGLOG ("NTP server %d set to %s\n", idx, _servers[idx].name);
     return true;
 }
 
-bool NTPClient::setNtpServerName (char* ntpServerName) {
-    char *name = ntpServerName;
-    if (name == NULL)
-        return false;
-    DEBUGLOG ("NTP server set to %s\n", name);
-    free (_ntpServerName);
-    _ntpServerName = name;
-    return true;
+#ifndef NTPCLIENT_NO_HEAP
+String NTPClient::getNtpServerName (int idx) {
+    if (idx < 0 || idx >= NTP_MAX_SERVERS || !_servers[idx].name)
+        return "";
+    return String (_servers[idx].name);
 }
+#endif
 
-String NTPClient::getNtpServerName () {
-    return String (_ntpServerName);
+const char* NTPClient::getNtpServerNamePtr (int idx) {
+    if (idx < 0 || idx >= NTP_MAX_SERVERS)
+        return NULL;
+    return _servers[idx].name;
 }
 
-char* NTPClient::getNtpServerNamePtr () {
-    return _ntpServerName;
+size_t NTPClient::getStaticRamUsage () {
+    size_t size = sizeof (NTPClient); // NTP object, default clock included
+    size += sizeof (s_timeLibClient);
+#ifdef NTPCLIENT_WORKER
+    size += sizeof (NTPClient *); // Worker client of each thread, counted once
+#endif
+#if NETWORK_TYPE == NETWORK_ESP8266 || NETWORK_TYPE == NETWORK_ESP32
+    size += NTPUdpTransport::getStaticRamUsage ();
+#endif
+#if defined ARDUINO_ARCH_ESP8266 || defined ARDUINO_ARCH_ESP32
+    size += NTPRtcStorage::getStaticRamUsage ();
+#endif
+    return size;
 }
 
 bool NTPClient::setTimeZone (int8_t timeZone, int8_t minutes) {
     if ((timeZone >= -12) && (timeZone <= 14) && (minutes >= -59) && (minutes <= 59)) {
-        // Temporarily set time to new time zone, before trying to synchronize
-        int8_t timeDiff = timeZone - _timeZone;
         _timeZone = timeZone;
         _minutesOffset = minutes;
-        setTime (now () + timeDiff * SECS_PER_HOUR + minutes * SECS_PER_MIN);
-        if (udp && (timeStatus () != timeNotSet)) {
-            setTime (getTime ());
-        }
+        applyTimeZone (legacyTimeZoneRules ());
         DEBUGLOG ("NTP time zone set to: %d\r\n", timeZone);
         return true;
     }
     return false;
 }
 
-boolean sendNTPpacket (const char* address, UDP *udp) {
+bool NTPClient::setTimeZoneRules (const char *tz) {
+    NTPTzRules_t rules;
+    if (!NTPTimeZone::parse (tz, rules))
+        return false;
+    setTimeZoneRules (rules);
+    DEBUGLOG ("NTP time zone set to: %s\n", tz);
+    return true;
+}
+
+void NTPClient::setTimeZoneRules (const NTPTzRules_t &rules) {
+    _timeZone = rules.stdOffset / SECS_PER_HOUR;
+    _minutesOffset = (rules.stdOffset % SECS_PER_HOUR) / SECS_PER_MIN;
+    _daylight = rules.hasDst;
+    applyTimeZone (rules);
+}
+
+NTPTzRules_t NTPClient::legacyTimeZoneRules () {
+    NTPTzRules_t rules;
+    rules.stdOffset = _timeZone * SECS_PER_HOUR + _minutesOffset * SECS_PER_MIN;
+    rules.dstOffset = rules.stdOffset + SECS_PER_HOUR;
+    rules.hasDst = _daylight;
+    // Central European summer time changes at 01:00 UTC. Rule times are local
+    rules.dstStart = ntpTzRule (3, 5, 0, SECS_PER_HOUR + rules.stdOffset);
+    rules.dstEnd = ntpTzRule (10, 5, 0, SECS_PER_HOUR + rules.dstOffset);
+    return rules;
+}
+
+void NTPClient::applyTimeZone (const NTPTzRules_t &rules) {
+    bool timeWasSet = _timeLib && timeStatus () != timeNotSet;
+    time_t utc = 0;
+    bool clockSet = _lastSyncUs || _provisional;
+    if (clockSet)
+        utc = nowUs () / 1000000; // Local clock keeps UTC, so no new request is needed
+    else if (timeWasSet)
+        utc = _tz.toUtc (now ());
+    _tz.setRules (rules);
+    if (timeWasSet) {
+        setLibraryTime (_tz.toLocal (utc));
+        if (clockSet) {
+            _alignPending = true;
+            _alignSecond = 0;
+        }
+    }
+}
+
+static uint32_t readNtpUint32 (const char *buffer) {
+    const uint8_t *data = (const uint8_t *)buffer;
+    return (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 | (uint32_t)data[2] << 8 | (uint32_t)data[3];
+}
+
+static void writeNtpUint32 (uint8_t *buffer, uint32_t value) {
+    buffer[0] = value >> 24;
+    buffer[1] = value >> 16;
+    buffer[2] = value >> 8;
+    buffer[3] = value;
+}
+
+// NTP timestamps are 64 bit fixed point numbers: 32 bit seconds since 1900 and 32 bit fraction of second
+static uint64_t readNtpTimestamp (const char *buffer) {
+    return ((uint64_t)readNtpUint32 (buffer) << 32) | readNtpUint32 (buffer + 4);
+}
+
+static uint64_t ntpToUnixUs (uint64_t timestamp) {
+    uint32_t seconds = (uint32_t)(timestamp >> 32) - SEVENTY_YEARS; // Wraps properly on NTP era 1 (after 2036)
+    uint32_t fraction = (uint32_t)timestamp;
+    return (uint64_t)seconds * 1000000 + (((uint64_t)fraction * 1000000) >> 32);
+}
+
+static uint64_t unixUsToNtp (uint64_t us) {
+    uint32_t seconds = us / 1000000;
+    uint32_t fraction = ((us % 1000000) << 32) / 1000000;
+    return ((uint64_t)(uint32_t)(seconds + SEVENTY_YEARS) << 32) | fraction;
+}
+
+static bool sendNTPpacket (const IPAddress &address, uint16_t port, NTPTransport *transport, uint64_t transmitTimestamp) {
     uint8_t ntpPacketBuffer[NTP_PACKET_SIZE]; //Buffer to store request message
 
                                            // set all bytes in the buffer to 0
@@ -104,71 +241,1208 @@ boolean sendNTPpacket (const char* address, UDP *udp) {
     ntpPacketBuffer[13] = 0x4E;
     ntpPacketBuffer[14] = 49;
     ntpPacketBuffer[15] = 52;
+    // Transmit timestamp. Server copies it to originate timestamp in response
+    writeNtpUint32 (ntpPacketBuffer + 40, transmitTimestamp >> 32);
+    writeNtpUint32 (ntpPacketBuffer + 44, (uint32_t)transmitTimestamp);
     // all NTP fields have been given values, now
     // you can send a packet requesting a timestamp:
-    udp->beginPacket (address, DEFAULT_NTP_PORT); //NTP requests are to port 123
-    udp->write (ntpPacketBuffer, NTP_PACKET_SIZE);
-    udp->endPacket ();
+    return transport->send (address, port, ntpPacketBuffer, NTP_PACKET_SIZE);
+}
+
+bool NTPClient::sendRequest (bool nextRound) {
+    if (_syncStatus != syncResolving || nextRound) {
+        _syncStatus = syncResolving;
+        if (!nextRound) {
+            // Burst until first sync, so that first offset comes from the best of several samples
+            _burstLeft = !_lastSyncUs && _burstCount > 1 ? _burstCount - 1 : 0;
+            _burstPause = false;
+            _burstStepped = false;
+            _burstStep = 0;
+        }
+        _resolveRound = nextRound;
+        _resolveIndex = 0;
+        for (int i = 0; i < NTP_MAX_SERVERS; i++) {
+            _dnsCache[i].used = 0;
+        }
+    }
+    // Name lookups may be slow. Resolution goes on through several calls, with one lookup on each one
+    bool lookUp = true;
+    uint64_t uptime = _clock->uptimeMs ();
+    for (; _resolveIndex < NTP_MAX_SERVERS; _resolveIndex++) {
+        NTPServer_t &server = _servers[_resolveIndex];
+        if (!server.name)
+            continue;
+        if (server.parkedUntil > uptime) {
+            DEBUGLOG ("-- NTP server %s is parked\n", server.name);
+            if (!server.samples || !_resolveRound)
+                server.address = IPAddress ();
+        } else if (!_resolveRound || server.address == IPAddress ()) { // Same server on every round
+            int8_t result = resolveServer (server, lookUp);
+            if (result == NTP_RESOLVE_PENDING)
+                return false; // Go on from this server on next call
+            if (!result) {
+                DEBUGLOG ("-- Invalid NTP server address %s\n", server.name);
+                server.address = IPAddress ();
+                _stats.addResolveError (_resolveIndex);
+            }
+        }
+    }
+    bool resolved = false;
+    uint64_t released = 0; // First instant when a parked server may be queried again
+    for (int i = 0; i < NTP_MAX_SERVERS; i++) {
+        NTPServer_t &server = _servers[i];
+        server.sent = false;
+        server.replied = false;
+        server.hedged = false;
+        if (!_resolveRound)
+            server.samples = 0;
+        if (!server.name)
+            continue;
+        if (server.parkedUntil > uptime) {
+            if (!released || server.parkedUntil < released)
+                released = server.parkedUntil;
+        } else if (server.address != IPAddress ()) {
+            resolved = true;
+        }
+    }
+    if (!resolved && _resolveRound) {
+        // Nothing left to query on this burst. Finish it with samples collected so far
+        _burstLeft = 0;
+        _syncStatus = syncSent;
+        return true;
+    }
+    if (!resolved && released) {
+        // Every usable server asked us to wait. Nothing failed, so try again when first one is released
+        _syncStatus = syncIdle;
+        scheduleSync ((released - uptime + 999) / 1000);
+        return false;
+    }
+    if (!resolved) {
+        _syncStatus = syncIdle;
+        adjustPollInterval (false); // Retry connection more often
+        _stats.addInvalidAddress ();
+        queueEvent (invalidAddress);
+        return false;
+    }
+    if (!_socketOpen) {
+        DEBUGLOG ("Starting UDP\n");
+        _socketOpen = _transport->begin (_localPort);
+    }
+    receivePackets (); // Late responses are discarded, as no request matches them. Answer pending requests
+    // Query all servers at once so that they share the same timeout window
+    for (int i = 0; i < NTP_MAX_SERVERS; i++) {
+        NTPServer_t &server = _servers[i];
+        if (!server.name || server.address == IPAddress () || server.parkedUntil > uptime)
+            continue;
+        DEBUGLOG ("-- Transmit NTP Request to %s\n", server.name);
+        server.sendUs = nowUs ();
+        // Lowest fraction bits are not significant. Use them to make every request timestamp unique
+        server.requestTimestamp = (unixUsToNtp (server.sendUs) & ~(uint64_t)0xFF) | i;
+        server.sent = sendNTPpacket (server.address, _serverPort, _transport, server.requestTimestamp);
+        if (server.sent)
+            _stats.addRequest (i);
+    }
+    _requestSent = _clock->uptimeMs ();
+    _syncStatus = syncSent;
     return true;
 }
 
-time_t NTPClient::getTime () {
-    //DNSClient dns;
-    //WiFiUDP *udpClient = new WiFiUDP(*udp);
-    IPAddress timeServerIP; //NTP server IP address
-    char ntpPacketBuffer[NTP_PACKET_SIZE]; //Buffer to store response message
-
-
-    DEBUGLOG ("Starting UDP\n");
-    udp->begin (DEFAULT_NTP_PORT);
-    //DEBUGLOG ("UDP port: %d\n",udp->localPort());
-    while (udp->parsePacket () > 0); // discard any previously received packets
-                                    /*dns.begin(WiFi.dnsServerIP());
-                                    uint8_t dnsResult = dns.getHostByName(NTP.getNtpServerName().c_str(), timeServerIP);
-                                    DEBUGLOG(F("NTP Server hostname: "));
-                                    DEBUGLOGCR(NTP.getNtpServerName());
-                                    DEBUGLOG(F("NTP Server IP address: "));
-                                    DEBUGLOGCR(timeServerIP);
-                                    DEBUGLOG(F("Result code: "));
-                                    DEBUGLOG(dnsResult);
-                                    DEBUGLOG(" ");
-                                    DEBUGLOGCR(F("-- IP Connected. Waiting for sync"));
-                                    DEBUGLOGCR(F("-- Transmit NTP Request"));*/
-
-                                    //if (dnsResult == 1) { //If DNS lookup resulted ok
-    sendNTPpacket (getNtpServerName ().c_str (), udp);
-    uint32_t beginWait = millis ();
-    while (millis () - beginWait < NTP_TIMEOUT) {
-        int size = udp->parsePacket ();
-        if (size >= NTP_PACKET_SIZE) {
+void NTPClient::receivePackets () {
+    uint8_t packet[NTP_PACKET_SIZE];
+    IPAddress address;
+    uint16_t port;
+    for (int i = 0; i < NTP_SERVER_BURST; i++) {
+        int size = _transport->receive (packet, NTP_PACKET_SIZE, address, port);
+        if (size <= 0)
+            return;
+        if (size < NTP_PACKET_SIZE)
+            continue;
+        switch (packet[0] & 0x07) { // Mode
+        case 3: // Client request
+            if (_serving)
+                serveRequest (packet, nowNtp (), address, port);
+            break;
+        case 4: // Server response
+            _receiveUs = nowUs ();
+            _receiveAddress = address;
             DEBUGLOG ("-- Receive NTP Response\n");
-            udp->read (ntpPacketBuffer, NTP_PACKET_SIZE);  // read packet into the buffer
-            time_t timeValue = decodeNtpMessage (ntpPacketBuffer);
-            setSyncInterval (getLongInterval ());
-            if (!_firstSync) {
-                //    if (timeStatus () == timeSet)
-                _firstSync = timeValue;
+            if (decodeNtpMessage ((char *)packet) && _broadcaster.sent && _broadcaster.replied) {
+                _broadcaster.sent = false; // Delay to broadcaster is known from now on
+                syncFromBroadcaster (_broadcaster.offset, packet);
+            }
+            break;
+        case 5: // Broadcast
+            if (_broadcastClient)
+                receiveBroadcast (packet, nowUs (), address, port);
+            break;
+        }
+    }
+}
+
+// Microseconds to NTP short format: 16.16 fixed point seconds
+static uint32_t usToNtpShort (uint64_t us) {
+    uint64_t value = (us << 16) / 1000000;
+    return value > 0xFFFFFFFF ? 0xFFFFFFFF : value;
+}
+
+void NTPClient::serveRequest (uint8_t *packet, uint64_t receiveTimestamp, const IPAddress &address, uint16_t port) {
+    if (!_lastSyncUs || !_active)
+        return; // Never spread time that is not synced
+    uint8_t version = (packet[0] >> 3) & 0x07;
+    if (version < 1 || version > 4)
+        return;
+    // Client transmit timestamp is returned as originate timestamp. Poll field is kept as sent
+    memcpy (packet + 24, packet + 40, 8);
+    packet[0] = (version << 3) | 4; // No leap second warning, request version, server mode
+    packet[1] = _stratum < 15 ? _stratum + 1 : 15;
+    packet[3] = (uint8_t)NTP_SERVER_PRECISION;
+    // Error grows with time since last sync, at the maximum rate local oscillator may be wrong
+    uint64_t sinceSync = nowUs () - _lastSyncUs;
+    writeNtpUint32 (packet + 4, usToNtpShort (_rootDelay));
+    writeNtpUint32 (packet + 8, usToNtpShort (_rootDispersion + sinceSync * NTP_MAX_DISPERSION_RATE / 1000000));
+    for (int i = 0; i < 4; i++) {
+        packet[12 + i] = _refAddress[i];
+    }
+    uint64_t reference = unixUsToNtp (_lastSyncUs);
+    writeNtpUint32 (packet + 16, reference >> 32);
+    writeNtpUint32 (packet + 20, (uint32_t)reference);
+    writeNtpUint32 (packet + 32, receiveTimestamp >> 32);
+    writeNtpUint32 (packet + 36, (uint32_t)receiveTimestamp);
+    uint64_t transmit = nowNtp ();
+    writeNtpUint32 (packet + 40, transmit >> 32);
+    writeNtpUint32 (packet + 44, (uint32_t)transmit);
+    if (_transport->send (address, port, packet, NTP_PACKET_SIZE))
+        _stats.addServed ();
+}
+
+bool NTPClient::beginServer (uint16_t port) {
+    if (!_transport || (_broadcastClient && port != _localPort))
+        return false; // Broadcasts are received on the only socket
+    if (_socketOpen && port != _localPort) {
+        closeSocket (true);
+        if (_syncStatus == syncSent)
+            _syncStatus = syncResolving; // Response would arrive to closed socket. Send request again
+    }
+    _localPort = port;
+    if (!_socketOpen)
+        _socketOpen = _transport->begin (_localPort);
+    _serving = _socketOpen;
+    DEBUGLOG ("SNTP server %s on port %u\n", _serving ? "started" : "not started", port);
+    return _serving;
+}
+
+void NTPClient::stopServer () {
+    _serving = false;
+    if (_syncStatus != syncResolving && _syncStatus != syncSent)
+        closeSocket ();
+}
+
+bool NTPClient::beginBroadcast (uint16_t port, const IPAddress &group) {
+    if (!_transport)
+        return false;
+    closeSocket (true); // Reopen on broadcast port. Requests in progress are abandoned
+    for (int i = 0; i < NTP_MAX_SERVERS; i++) {
+        _servers[i].sent = false;
+    }
+    if (_syncStatus == syncResolving || _syncStatus == syncSent)
+        _syncStatus = syncIdle;
+    _burstLeft = 0;
+    _burstPause = false;
+    _localPort = port;
+    _socketOpen = group == IPAddress () ? _transport->begin (port) : _transport->beginMulticast (group, port);
+    _broadcaster.name = NULL;
+    _broadcaster.address = IPAddress ();
+    _broadcaster.sent = false;
+    _broadcaster.replied = false;
+    _broadcaster.samples = 0;
+    _broadcastTime = 0;
+    _broadcastClient = _socketOpen;
+    if (_broadcastClient)
+        scheduleSync (1); // Time library reads broadcasts through getTime () if loop () is not called
+    DEBUGLOG ("Broadcast client %s on port %u\n", _broadcastClient ? "started" : "not started", port);
+    return _broadcastClient;
+}
+
+void NTPClient::stopBroadcast () {
+    if (!_broadcastClient)
+        return;
+    _broadcastClient = false;
+    closeSocket (true); // Leave multicast group
+    if (_serving)
+        _socketOpen = _transport->begin (_localPort);
+    if (_active)
+        scheduleSync (1); // Poll servers again
+}
+
+void NTPClient::receiveBroadcast (const uint8_t *packet, uint64_t receiveUs, const IPAddress &address, uint16_t port) {
+    uint8_t stratum = packet[1];
+    if ((packet[0] >> 6) == 3 || !stratum || stratum >= 16)
+        return; // Broadcaster is not synced
+    if (_broadcaster.address == IPAddress ()) {
+        _broadcaster.address = address;
+        _broadcasterPort = port;
+        DEBUGLOG ("Following broadcasts from %s\n", address.toString ().c_str ());
+    } else if (address != _broadcaster.address) {
+        return;
+    }
+    if (!_broadcaster.replied) {
+        // One way delay is unknown. Measure round trip with a regular request, as broadcast clients do
+        // in RFC 5905. Ask again on a later broadcast if there is no response
+        if (_broadcaster.sent && _clock->uptimeMs () - _requestSent < NTP_TIMEOUT)
+            return;
+        _broadcaster.sendUs = nowUs ();
+        _broadcaster.requestTimestamp = (unixUsToNtp (_broadcaster.sendUs) & ~(uint64_t)0xFF) | NTP_MAX_SERVERS;
+        _broadcaster.sent = sendNTPpacket (address, port, _transport, _broadcaster.requestTimestamp);
+        _requestSent = _clock->uptimeMs ();
+        DEBUGLOG ("-- Transmit delay measurement request\n");
+        return;
+    }
+    // Broadcast left server at transmit timestamp and took half of measured round trip to get here
+    int64_t t3 = ntpToUnixUs (readNtpTimestamp ((const char *)packet + 40));
+    syncFromBroadcaster (t3 + _broadcaster.delay / 2 - (int64_t)receiveUs, packet);
+}
+
+void NTPClient::syncFromBroadcaster (int64_t offset, const uint8_t *packet) {
+    _offset = offset;
+    _delay = _broadcaster.delay;
+    _bestServer = -1;
+    _stratum = packet[1];
+    _refAddress = _broadcaster.address;
+    _rootDelay = (((uint64_t)readNtpUint32 ((const char *)packet + 4) * 1000000) >> 16) + _broadcaster.delay;
+    _rootDispersion = (((uint64_t)readNtpUint32 ((const char *)packet + 8) * 1000000) >> 16) + _jitter;
+    _broadcastTime = applySync ();
+}
+
+time_t NTPClient::checkResponse () {
+    receivePackets (); // Between burst rounds only served requests and broadcasts are handled
+    if (_burstPause) {
+        if (_clock->uptimeMs () >= _burstDue) {
+            _burstPause = false;
+            sendRequest (true);
+        }
+        return 0;
+    }
+    if (_hedging)
+        sendHedges ();
+
+    bool pending = false;
+    bool replied = false;
+    for (int i = 0; i < NTP_MAX_SERVERS; i++) {
+        if (_servers[i].sent && !_servers[i].replied)
+            pending = true;
+        if (_servers[i].replied)
+            replied = true;
+    }
+    if (pending && (_clock->uptimeMs () - _requestSent < NTP_TIMEOUT))
+        return 0;
+
+    for (int i = 0; i < NTP_MAX_SERVERS; i++) {
+        if (_servers[i].sent && !_servers[i].replied)
+            _stats.addTimeout (i);
+    }
+    if (_burstLeft) {
+        for (int i = 0; i < NTP_MAX_SERVERS; i++) {
+            // Round is over. A late response would pair a send time from before the step with a receive time after it
+            if (!_servers[i].replied) {
+                _servers[i].sent = false;
+                _servers[i].hedged = false;
+            }
+        }
+        if (replied && !_lastSyncUs && !_burstStepped)
+            stepFromBurst ();
+        _burstLeft--;
+        _burstPause = true;
+        _burstDue = _clock->uptimeMs () + _burstSpacing;
+        return 0;
+    }
+
+    closeSocket ();
+    replied = false;
+    for (int i = 0; i < NTP_MAX_SERVERS; i++) {
+        NTPServer_t &server = _servers[i];
+        if (server.samples) {
+            server.replied = true; // Best sample of burst takes part in selection
+            replied = true;
+        } else if (server.sent) {
+            discardServerAddress (server);
+        }
+    }
+    if (!replied) {
+        DEBUGLOG ("-- No NTP Response :-(\n");
+        _syncStatus = syncTimedOut;
+        adjustPollInterval (false); // Retry connection more often
+        _stats.addNoResponse ();
+        queueEvent (noResponse);
+        return 0;
+    }
+    if (!selectServers ()) {
+        DEBUGLOG ("-- NTP servers do not agree\n");
+        _syncStatus = syncIdle;
+        adjustPollInterval (false); // Retry connection more often
+        _stats.addServersDisagree ();
+        queueEvent (serversDisagree);
+        return 0;
+    }
+
+    // Data sent to our own clients if we are serving time
+    NTPServer_t &best = _servers[_bestServer];
+    _stratum = best.stratum;
+    _refAddress = best.address;
+    _rootDelay = best.rootDelay + best.delay;
+    _rootDispersion = best.rootDispersion + _jitter;
+    return applySync ();
+}
+
+time_t NTPClient::applySync () {
+    stirRandom (_delay ^ (uint32_t)_offset); // Network timing differs even between identical devices
+    uint64_t sinceSync = nowUs () - _lastSyncUs;
+    int32_t slewLeft = getSlewRemaining (); // Offset includes it. It is not frequency error
+    uint64_t magnitude = _offset < 0 ? -_offset : _offset;
+    if ((_lastSyncUs || _provisional) && magnitude < _slewThreshold) {
+        // Absorb offset gradually from current time on. Any previous slew is replaced, as offset includes its remainder
+        shiftLocalClock (0);
+        _anchor.slewUs = _offset;
+        _anchor.slewRate = (_offset < 0 ? -1 : 1) * (((int64_t)NTP_SLEW_RATE << 32) / 1000000);
+        _anchor.slewEndUs = magnitude * 1000000 / NTP_SLEW_RATE;
+        DEBUGLOG ("Slewing %ld us in %lu s\n", (long)_anchor.slewUs, (unsigned long)(_anchor.slewEndUs / 1000000));
+    } else {
+        shiftLocalClock (_offset); // Step local clock by measured offset
+    }
+    if (_lastSyncUs) {
+        updateDrift (_offset - slewLeft, sinceSync); // Local clock has just been set, so new drift does not make it jump
+    }
+    uint64_t uptimeMs = _clock->uptimeMs ();
+    _anchor.maxErrorUs = _rootDelay / 2 + _rootDispersion;
+    _anchor.lastSyncMs = uptimeMs ? uptimeMs : 1; // 0 means never
+    publishAnchor ();
+    _offset += _burstStep; // Clock correction of this sync, provisional step of first burst round included
+    _burstStep = 0;
+    adjustPollInterval (true);
+    _stats.addSync (_offset, uptimeMs);
+    updateAlignPeriod ();
+    if (!_lastSyncUs)
+        _saveDue = 0; // Save first sync right away. Later ones are saved periodically
+    _lastSyncUs = _anchor.us;
+    _provisional = false;
+    _alignPending = true;
+    _alignSecond = 0;
+    time_t timeValue = utcToLocal ((_anchor.us + 500000) / 1000000); // Round to nearest second
+    _syncStatus = syncReceived;
+    if (!_firstSync) {
+        //    if (timeStatus () == timeSet)
+        _firstSync = timeValue;
+    }
+    //getFirstSync (); // Set firstSync value if not set before
+    setLastNTPSync (timeValue);
+#ifdef DEBUG_NTPCLIENT
+    char timeStr[NTP_TIME_DATE_STR_SIZE];
+    getTimeDateString (timeStr, sizeof (timeStr), getLastNTPSync ());
+    DEBUGLOG ("Successful NTP sync at %s\n", timeStr);
+#endif
+
+    queueEvent (timeSyncd);
+    return timeValue;
+}
+
+void NTPClient::sendHedges () {
+    uint64_t nowTime = nowUs ();
+    for (int i = 0; i < NTP_MAX_SERVERS; i++) {
+        NTPServer_t &server = _servers[i];
+        if (!server.sent || server.replied || server.hedged)
+            continue;
+        // Wait for usual round trip of this server. Histogram gives an upper bound of it
+        uint32_t wait = NTP_HEDGE_DELAY * 1000UL;
+        if (_stats.get ().servers[i].replies >= NTP_HEDGE_MIN_SAMPLES)
+            wait = _stats.rttPercentile (i, NTP_HEDGE_PERCENTILE);
+        if (wait < NTP_HEDGE_MIN_DELAY * 1000UL)
+            wait = NTP_HEDGE_MIN_DELAY * 1000UL;
+        if (nowTime - server.sendUs < wait || wait >= NTP_TIMEOUT * 1000UL)
+            continue;
+        server.hedgeAddress = alternateAddress (server);
+        server.hedgeSendUs = nowUs ();
+        server.hedgeTimestamp = (unixUsToNtp (server.hedgeSendUs) & ~(uint64_t)0xFF) | (NTP_MAX_SERVERS + 1 + i);
+        server.hedged = true; // Only one backup request per sync, even if it cannot be sent
+        if (sendNTPpacket (server.hedgeAddress, _serverPort, _transport, server.hedgeTimestamp)) {
+            DEBUGLOG ("-- Transmit backup request to %s\n", server.name);
+            _stats.addHedge (i);
+        }
+    }
+}
+
+IPAddress NTPClient::alternateAddress (NTPServer_t &server) {
+    for (int i = 0; i < NTP_MAX_SERVERS; i++) {
+        NTPDnsCacheEntry_t &entry = _dnsCache[i];
+        if (!entry.name || strcmp (entry.name, server.name))
+            continue;
+        for (int j = 0; j < entry.count; j++) {
+            bool used = false;
+            for (int k = 0; k < NTP_MAX_SERVERS; k++) {
+                used = used || (_servers[k].sent && _servers[k].address == entry.addresses[j]);
+            }
+            if (!used)
+                return entry.addresses[j];
+        }
+        break;
+    }
+    return server.address; // Retransmit. Packet or response may have been lost
+}
+
+void NTPClient::stepFromBurst () {
+    int best = -1;
+    for (int i = 0; i < NTP_MAX_SERVERS; i++) {
+        if (_servers[i].replied && (best < 0 || _servers[i].distance < _servers[best].distance))
+            best = i;
+    }
+    int64_t offset = _servers[best].offset;
+    _burstStepped = true;
+    if (_provisional && (offset < 0 ? -offset : offset) < _slewThreshold)
+        return; // Restored clock is close enough to be slewed on final sync
+    _anchor.maxErrorUs = _servers[best].distance;
+    shiftLocalClock (offset); // Publishes new error too
+    for (int i = 0; i < NTP_MAX_SERVERS; i++) {
+        _servers[i].offset -= offset;
+    }
+    _burstStep = offset; // Added back to offset of final sync, so that event and statistics show the whole step
+    _provisional = true;
+    setLibraryTime (utcToLocal (_anchor.us / 1000000));
+    _alignPending = true;
+    _alignSecond = 0;
+    DEBUGLOG ("Time set provisionally from first burst round\n");
+}
+
+bool NTPClient::selectServers () {
+    // Intersection algorithm (Marzullo). Every response defines a correctness interval
+    // [offset - distance, offset + distance]. Look for the smallest number of falsetickers that lets the
+    // rest of intervals share a common intersection, as described in RFC 5905 A.5.5.1
+    struct {
+        int64_t value;
+        int8_t type; // -1: lower end, 0: midpoint, +1: upper end
+    } edges[3 * NTP_MAX_SERVERS], edge;
+    int n = 0;
+    int count = 0;
+    for (int i = 0; i < NTP_MAX_SERVERS; i++) {
+        NTPServer_t &server = _servers[i];
+        if (!server.replied)
+            continue;
+        edges[n].value = server.offset - server.distance; edges[n++].type = -1;
+        edges[n].value = server.offset; edges[n++].type = 0;
+        edges[n].value = server.offset + server.distance; edges[n++].type = +1;
+        count++;
+    }
+    for (int i = 1; i < n; i++) { // Insertion sort. Lower ends first on ties
+        edge = edges[i];
+        int j = i - 1;
+        for (; j >= 0 && (edges[j].value > edge.value || (edges[j].value == edge.value && edges[j].type > edge.type)); j--) {
+            edges[j + 1] = edges[j];
+        }
+        edges[j + 1] = edge;
+    }
+    int64_t low = 0;
+    int64_t high = 0;
+    bool agreed = false;
+    for (int allow = 0; 2 * allow < count && !agreed; allow++) {
+        int found = 0;
+        int chime = 0;
+        for (int i = 0; i < n; i++) {
+            chime -= edges[i].type;
+            low = edges[i].value;
+            if (chime >= count - allow)
+                break;
+            if (edges[i].type == 0)
+                found++;
+        }
+        chime = 0;
+        for (int i = n - 1; i >= 0; i--) {
+            chime += edges[i].type;
+            high = edges[i].value;
+            if (chime >= count - allow)
+                break;
+            if (edges[i].type == 0)
+                found++;
+        }
+        agreed = found <= allow && low <= high;
+    }
+    if (!agreed)
+        return false;
+
+    // Truechimers are servers whose correctness interval overlaps the intersection
+    bool survivor[NTP_MAX_SERVERS];
+    int survivors = 0;
+    for (int i = 0; i < NTP_MAX_SERVERS; i++) {
+        NTPServer_t &server = _servers[i];
+        survivor[i] = server.replied && server.offset - (int64_t)server.distance <= high && server.offset + (int64_t)server.distance >= low;
+        if (survivor[i])
+            survivors++;
+    }
+
+    // Clustering. Discard the survivor with the largest selection jitter (RMS offset difference to the
+    // other survivors) while it is larger than the smallest root distance, which is the best accuracy any
+    // single server can give us
+    while (survivors > NTP_MIN_CLUSTER) {
+        int worst = -1;
+        float worstJitter = 0; // Squared selection jitter
+        uint32_t minDistance = 0xFFFFFFFF;
+        for (int i = 0; i < NTP_MAX_SERVERS; i++) {
+            if (!survivor[i])
+                continue;
+            float jitter = 0;
+            for (int j = 0; j < NTP_MAX_SERVERS; j++) {
+                if (survivor[j]) {
+                    float diff = _servers[i].offset - _servers[j].offset;
+                    jitter += diff * diff;
+                }
+            }
+            jitter /= survivors - 1;
+            if (jitter > worstJitter) {
+                worstJitter = jitter;
+                worst = i;
+            }
+            if (_servers[i].distance < minDistance)
+                minDistance = _servers[i].distance;
+        }
+        if (worst < 0 || worstJitter <= (float)minDistance * minDistance)
+            break;
+        DEBUGLOG ("Discarding %s\n", _servers[worst].name);
+        survivor[worst] = false;
+        survivors--;
+    }
+
+    for (int i = 0; i < NTP_MAX_SERVERS; i++) {
+        if (_servers[i].replied && !survivor[i])
+            _stats.addRejected (i);
+    }
+
+    // Combine survivors. Offsets are weighted by the inverse of root distance, relative to the first
+    // survivor to keep values small enough for float arithmetic
+    int64_t reference = 0;
+    float sum = 0;
+    float weights = 0;
+    uint32_t bestDistance = 0xFFFFFFFF;
+    bool first = true;
+    for (int i = 0; i < NTP_MAX_SERVERS; i++) {
+        if (!survivor[i])
+            continue;
+        NTPServer_t &server = _servers[i];
+        if (first) {
+            reference = server.offset;
+            first = false;
+        }
+        float weight = 1.0f / (server.distance ? server.distance : 1);
+        sum += (server.offset - reference) * weight;
+        weights += weight;
+        if (server.distance < bestDistance) {
+            bestDistance = server.distance;
+            _delay = server.delay;
+            _bestServer = i;
+        }
+    }
+    _offset = reference + (int64_t)(sum / weights);
+    DEBUGLOG ("%d servers selected. Offset: %ld ms\n", survivors, (long)(_offset / 1000));
+    return true;
+}
+
+NTPDnsCacheEntry_t* NTPClient::getDnsCacheEntry (const char* name) {
+    NTPDnsCacheEntry_t *freeEntry = NULL;
+    for (int i = 0; i < NTP_MAX_SERVERS; i++) {
+        if (!_dnsCache[i].name) {
+            if (!freeEntry)
+                freeEntry = &_dnsCache[i];
+        } else if (!strcmp (_dnsCache[i].name, name)) {
+            return &_dnsCache[i];
+        }
+    }
+    NTPDnsCacheEntry_t *entry = freeEntry; // There is always a free one as there are as many entries as server slots
+    entry->name = name;
+    entry->count = 0;
+    entry->next = 0;
+    entry->used = 0;
+    entry->complete = false;
+    return entry;
+}
+
+int8_t NTPClient::resolveServer (NTPServer_t &server, bool &lookUp) {
+    NTPDnsCacheEntry_t *entry = getDnsCacheEntry (server.name);
+    bool expired = !entry->count || (_clock->uptimeMs () - entry->resolved >= NTP_DNS_TTL * 1000UL);
+    // Several slots use this name and all known addresses have been used. Pool servers answer
+    // with different addresses on every query, so a new one may be learnt
+    bool learn = !expired && entry->used >= entry->count && entry->count < NTP_DNS_ADDRESSES && !entry->complete;
+    if (expired || learn) {
+        if (!lookUp)
+            return NTP_RESOLVE_PENDING;
+        IPAddress addresses[NTP_DNS_ADDRESSES];
+        int count = _transport->resolveAsync (server.name, addresses, NTP_DNS_ADDRESSES);
+        if (count == NTP_RESOLVE_PENDING)
+            return NTP_RESOLVE_PENDING;
+        lookUp = false;
+        if (expired && count) {
+            // Replace all cached addresses. Keep old ones if name cannot be resolved now
+            DEBUGLOG ("%s resolved to %d addresses\n", server.name, count);
+            memcpy (entry->addresses, addresses, sizeof (addresses));
+            entry->count = count;
+            entry->next = 0;
+            entry->resolved = _clock->uptimeMs ();
+            entry->complete = false;
+        } else if (learn) {
+            entry->complete = true;
+            for (int i = 0; i < count && entry->count < NTP_DNS_ADDRESSES; i++) {
+                bool known = false;
+                for (int j = 0; j < entry->count; j++) {
+                    known = known || entry->addresses[j] == addresses[i];
+                }
+                if (!known) {
+                    entry->complete = false;
+                    entry->next = entry->count;
+                    entry->addresses[entry->count++] = addresses[i];
+                }
+            }
+        }
+    }
+    if (!entry->count)
+        return 0;
+    if (entry->next >= entry->count)
+        entry->next = 0;
+    server.address = entry->addresses[entry->next];
+    entry->next = (entry->next + 1) % entry->count;
+    entry->used++;
+    return 1;
+}
+
+void NTPClient::discardServerAddress (NTPServer_t &server) {
+    for (int i = 0; i < NTP_MAX_SERVERS; i++) {
+        NTPDnsCacheEntry_t &entry = _dnsCache[i];
+        if (!entry.name || strcmp (entry.name, server.name))
+            continue;
+        for (int j = 0; j < entry.count; j++) {
+            if (entry.addresses[j] == server.address) {
+                DEBUGLOG ("Discarding address of %s\n", server.name);
+                entry.count--;
+                for (int k = j; k < entry.count; k++) {
+                    entry.addresses[k] = entry.addresses[k + 1];
+                }
+                if (entry.next > j)
+                    entry.next--;
+                break;
+            }
+        }
+        return;
+    }
+}
+
+void NTPClient::processKissCode (NTPServer_t &server, const char *code) {
+    DEBUGLOG ("Kiss-o'-Death %.4s\n", code);
+    server.sent = false; // Server has answered. Do not wait for it nor count a timeout
+    if (&server == &_broadcaster)
+        return; // Another request is sent on a later broadcast
+    _stats.addKod (&server - _servers);
+    uint32_t backoff;
+    if (!memcmp (code, "RATE", 4)) {
+        backoff = server.kods < 16 ? (uint32_t)NTP_KOD_BACKOFF << server.kods : NTP_KOD_MAX_BACKOFF;
+        if (backoff > NTP_KOD_MAX_BACKOFF)
+            backoff = NTP_KOD_MAX_BACKOFF;
+        if (server.kods < 255)
+            server.kods++;
+    } else if (!memcmp (code, "DENY", 4) || !memcmp (code, "RSTR", 4)) {
+        backoff = NTP_KOD_MAX_BACKOFF;
+    } else {
+        return; // Other kiss codes only tell why there is no time (RFC 5905 7.4)
+    }
+    server.parkedUntil = _clock->uptimeMs () + (uint64_t)backoff * 1000;
+    discardServerAddress (server);
+}
+
+void NTPClient::releaseDnsCacheEntry (const char* name) {
+    if (!name)
+        return;
+    for (int i = 0; i < NTP_MAX_SERVERS; i++) {
+        NTPDnsCacheEntry_t &entry = _dnsCache[i];
+        if (entry.name != name)
+            continue;
+        entry.name = NULL;
+        for (int j = 0; j < NTP_MAX_SERVERS; j++) {
+            if (_servers[j].name && _servers[j].name != name && !strcmp (_servers[j].name, name)) {
+                entry.name = _servers[j].name; // Another slot uses same name. Keep addresses
+                break;
+            }
+        }
+    }
+}
+
+void NTPClient::flushDnsCache () {
+    for (int i = 0; i < NTP_MAX_SERVERS; i++) {
+        _dnsCache[i].name = NULL;
+    }
+}
+
+void NTPClient::closeSocket (bool force) {
+    if (_socketOpen && (force || (!_persistentSocket && !_serving && !_broadcastClient))) {
+        _transport->stop ();
+        _socketOpen = false;
+    }
+}
+
+void NTPClient::setPersistentSocket (bool persistent) {
+    _persistentSocket = persistent;
+    if (!persistent && _syncStatus != syncResolving && _syncStatus != syncSent)
+        closeSocket ();
+}
+
+bool NTPClient::getPersistentSocket () {
+    return _persistentSocket;
+}
+
+time_t NTPClient::getTime () {
+    if (!_transport)
+        return 0;
+#ifdef NTPCLIENT_WORKER
+    if (otherThanWorker ())
+        return 0; // Worker owns network I/O
+    rebaseAnchor (); // Time library may be the only caller, if loop () is not used
+#endif
+    if (_broadcastClient) {
+        // Nothing is sent. Time is returned once a broadcast has been received
+        receivePackets ();
+        time_t timeValue = _broadcastTime;
+        _broadcastTime = 0;
+        scheduleSync (1);
+        return timeValue;
+    }
+    switch (_syncStatus) {
+    case syncSent:
+        return checkResponse ();
+    case syncResolving:
+        sendRequest ();
+        return 0;
+    default: // No request in progress, start a new one. Events are not delivered here, as this may run inside now ()
+        scheduleSync (1); // Poll response on next now () call in case loop () is not called
+        sendRequest ();
+        return 0;
+    }
+}
+
+void NTPClient::loop () {
+#ifdef NTPCLIENT_WORKER
+    if (otherThanWorker ())
+        return;
+    rebaseAnchor ();
+#endif
+    if (_broadcastClient || (_serving && _syncStatus != syncSent))
+        receivePackets (); // While a request is in progress getTime () reads packets
+    if (_broadcastTime) {
+        setLibraryTime (_broadcastTime); // Synced from broadcast
+        _broadcastTime = 0;
+    }
+    if (_active && _syncStatus != syncResolving && _syncStatus != syncSent && !_broadcastClient && _clock->uptimeMs () >= _syncDue) {
+        getTime (); // Sync is due. Do not wait for Time library, now () may not be called often
+    }
+    if (_syncStatus == syncResolving || _syncStatus == syncSent) {
+        time_t timeValue = getTime ();
+        if (timeValue)
+            setLibraryTime (timeValue);
+    }
+    if (!_timeLib)
+        _alignPending = false; // Only Time library has to be aligned to local clock
+    if (!_alignPending && _alignPeriod && (_clock->uptimeMs () - _alignedMillis >= _alignPeriod)) {
+        _alignPending = true; // Time library runs on uncorrected millis (). Catch up with drift correction
+        _alignSecond = 0;
+    }
+    if (_alignPending) {
+        // Time library counts seconds from the instant setTime () is called. Set it again just when
+        // local clock crosses a second boundary so that now () changes second at the right moment
+        uint32_t second = nowMs () / 1000;
+        if (_alignSecond && second != _alignSecond) {
+            int64_t remaining = _syncDue - _clock->uptimeMs ();
+            setLibraryTime (utcToLocal (second));
+            // setTime () postpones next sync. Keep previous schedule
+            scheduleSync (remaining > 1000 ? remaining / 1000 : 1);
+            _alignedMillis = _clock->uptimeMs ();
+            _alignPending = false;
+            DEBUGLOG ("Time library aligned to second boundary\n");
+        } else {
+            _alignSecond = second;
+        }
+    }
+    if (_storage && _saveInterval && (_lastSyncUs || _provisional) && _clock->uptimeMs () >= _saveDue)
+        saveState (false);
+    if (!_alignPending && _syncStatus != syncResolving && _syncStatus != syncSent)
+        handleEvents (); // Only while handlers cannot delay a response or Time library alignment
+}
+
+void NTPClient::adjustPollInterval (bool success) {
+    if (!success) {
+        // Poll faster after failures, so that sync is recovered soon
+        _failures++;
+        _pollCounter = 0;
+        _pollInterval = _lastSyncUs ? _pollInterval / 2 : _shortInterval;
+    } else {
+        _failures = 0;
+        uint32_t magnitude = _offset < 0 ? -_offset : _offset;
+        if (!_lastSyncUs || _offset > NTP_STEP_THRESHOLD || _offset < -NTP_STEP_THRESHOLD) {
+            // Clock has been stepped. Start again from minimum interval
+            _pollCounter = 0;
+            _jitter = 0;
+            _pollInterval = _shortInterval;
+        } else {
+            // Stable clock gives offsets in the order of jitter. Larger ones mean clock is wandering
+            if (magnitude <= NTP_MIN_JITTER || magnitude <= (uint64_t)NTP_POLL_GATE * _jitter) {
+                _pollCounter++;
+            } else {
+                _pollCounter -= 2;
+            }
+            _jitter += ((int32_t)magnitude - (int32_t)_jitter) / 4;
+            if (_pollCounter >= NTP_POLL_LIMIT) {
+                _pollCounter = 0;
+                _pollInterval *= 2;
+            } else if (_pollCounter <= -NTP_POLL_LIMIT) {
+                _pollCounter = 0;
+                _pollInterval /= 2;
             }
-            //getFirstSync (); // Set firstSync value if not set before
-            DEBUGLOG ("Sync frequency set low\n");
-            udp->stop ();
-            setLastNTPSync (timeValue);
-            DEBUGLOG ("Successful NTP sync at %s", getTimeDateString (getLastNTPSync ()).c_str ());
-
-            if (onSyncEvent)
-                onSyncEvent (timeSyncd);
-            return timeValue;
         }
-#ifdef ARDUINO_ARCH_ESP8266
-        ESP.wdtFeed ();
+    }
+    if (_pollInterval > _longInterval)
+        _pollInterval = _longInterval;
+    if (_pollInterval < _shortInterval)
+        _pollInterval = _shortInterval;
+    DEBUGLOG ("Sync interval: %d s. Jitter: %lu us\n", _pollInterval, (unsigned long)_jitter);
+    scheduleSync (_pollInterval, true);
+}
+
+int NTPClient::getPollInterval () {
+    return _pollInterval;
+}
+
+uint32_t NTPClient::getJitter () {
+    return _jitter;
+}
+
+void NTPClient::scheduleSync (int interval, bool spread) {
+    uint32_t ms = (uint32_t)interval * 1000;
+    if (spread && _pollSpread) {
+        uint32_t range = (uint64_t)ms * _pollSpread / 100;
+        ms = ms - range + nextRandom () % (2 * range + 1);
+        interval = (ms + 500) / 1000;
+    }
+    _syncDue = _clock->uptimeMs () + ms;
+    if (_timeLib)
+        setSyncInterval (interval);
+}
+
+void NTPClient::updateDrift (int64_t offset, uint64_t interval) {
+    if (offset > NTP_STEP_THRESHOLD || offset < -NTP_STEP_THRESHOLD || interval < 1000000) {
+        return; // Clock step or too short interval, offset does not tell anything about frequency
+    }
+    // Frequency error that would have produced this offset, in 2^-32 units. Average it with previous
+    // estimation: first samples get higher weight, and short intervals get lower weight because
+    // offset measurement noise is larger compared to accumulated frequency error
+    int64_t measured = (offset << 32) / (int64_t)interval;
+    if (_driftSamples < 4)
+        _driftSamples++;
+    int64_t correction = measured / _driftSamples;
+    if (interval < (uint64_t)NTP_FLL_TIME * 1000000) {
+        correction = correction * (int64_t)(interval / 1000000) / NTP_FLL_TIME;
+    }
+    const int64_t maxDrift = ((int64_t)NTP_MAX_DRIFT << 32) / 1000000;
+    int64_t drift = _anchor.drift + correction;
+    if (drift > maxDrift)
+        drift = maxDrift;
+    if (drift < -maxDrift)
+        drift = -maxDrift;
+    _anchor.drift = drift;
+    DEBUGLOG ("Drift: %ld ppb\n", (long)(((int64_t)_anchor.drift * 1000000000) >> 32));
+}
+
+void NTPClient::updateAlignPeriod () {
+    // Time library diverges from local clock by drift, and by slew rate while slewing. Realign it before error grows too much
+    uint64_t driftMagnitude = _anchor.drift < 0 ? -(int64_t)_anchor.drift : _anchor.drift;
+    if (_anchor.slewUs)
+        driftMagnitude += _anchor.slewRate < 0 ? -(int64_t)_anchor.slewRate : _anchor.slewRate;
+    uint64_t alignPeriod = driftMagnitude ? (((uint64_t)NTP_MAX_TIMELIB_ERROR << 32) / driftMagnitude) : 0;
+    _alignPeriod = alignPeriod > 0x7FFFFFFF ? 0x7FFFFFFF : alignPeriod;
+}
+
+float NTPClient::getDrift () {
+    return _anchor.drift * (1000000.0f / 4294967296.0f);
+}
+
+NTPSyncStatus_t NTPClient::getSyncStatus () {
+    return _syncStatus;
+}
+
+int64_t NTPClient::getLastOffset () {
+    return _offset;
+}
+
+uint32_t NTPClient::getLastDelay () {
+    return _delay;
+}
+
+uint32_t NTPClient::getMaxError () {
+    NTPClockAnchor_t copy;
+    uint64_t elapsedMillis;
+    uint32_t elapsedMicros;
+    const NTPClockAnchor_t &anchor = readAnchor (copy, elapsedMillis, elapsedMicros);
+    if (anchor.maxErrorUs >= NTP_UNBOUNDED_ERROR)
+        return 0xFFFFFFFF; // Time not set, or restored without known off time
+    uint64_t elapsed = elapsedUs (anchor, elapsedMillis, elapsedMicros);
+    int32_t slew = anchor.slewUs ? anchor.slewUs - slewApplied (anchor, elapsed) : 0;
+    uint64_t error = anchor.maxErrorUs + (slew < 0 ? -slew : slew) + elapsed * NTP_MAX_DISPERSION_RATE / 1000000;
+    return error / 1000 > 0xFFFFFFFF ? 0xFFFFFFFF : error / 1000;
+}
+
+// FNV-1a hash, to check that a saved address belongs to the same server name
+static uint32_t hashName (const char *name) {
+    uint32_t hash = 2166136261UL;
+    while (name && *name) {
+        hash = (hash ^ (uint8_t)*name++) * 16777619UL;
+    }
+    return hash;
+}
+
+static uint32_t hashState (const uint8_t *data, size_t size) {
+    uint32_t hash = 2166136261UL;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * 16777619UL;
+    }
+    return hash;
+}
+
+bool NTPClient::saveState (bool final) {
+    if (!_storage || (!_lastSyncUs && !_provisional))
+        return false;
+    // Saved state: version, number of servers, 2 reserved bytes, UTC time in microseconds (64 bit), error of
+    // that time in ms, time that may run after this save in ms, drift, drift samples and 3 reserved bytes,
+    // name hash and address of every server, and checksum. All values big endian
+    uint8_t state[NTP_STATE_SIZE];
+    memset (state, 0, sizeof (state));
+    state[0] = NTP_STATE_VERSION;
+    state[1] = NTP_MAX_SERVERS;
+    uint64_t utc = nowUs ();
+    writeNtpUint32 (state + 4, utc >> 32);
+    writeNtpUint32 (state + 8, (uint32_t)utc);
+    writeNtpUint32 (state + 12, getMaxError ());
+    writeNtpUint32 (state + 16, final ? 0 : _saveInterval * 1000);
+    writeNtpUint32 (state + 20, _anchor.drift);
+    state[24] = _driftSamples;
+    uint8_t *p = state + 28;
+    for (int i = 0; i < NTP_MAX_SERVERS; i++, p += 8) {
+        if (!_servers[i].name || _servers[i].address == IPAddress ())
+            continue;
+        writeNtpUint32 (p, hashName (_servers[i].name));
+        for (int j = 0; j < 4; j++) {
+            p[4 + j] = _servers[i].address[j];
+        }
+    }
+    writeNtpUint32 (p, hashState (state, p - state));
+    _saveDue = _clock->uptimeMs () + (uint64_t)_saveInterval * 1000;
+    DEBUGLOG ("Saving sync state\n");
+    return _storage->save (state, sizeof (state));
+}
+
+bool NTPClient::restoreState (uint32_t offTime) {
+    if (!_storage || _lastSyncUs)
+        return false; // Synced time is always better
+    uint8_t state[NTP_STATE_SIZE];
+    if (!_storage->load (state, sizeof (state)))
+        return false;
+    const char *data = (const char *)state;
+    if (state[0] != NTP_STATE_VERSION || state[1] != NTP_MAX_SERVERS
+        || readNtpUint32 (data + NTP_STATE_SIZE - 4) != hashState (state, NTP_STATE_SIZE - 4)) {
+        DEBUGLOG ("No valid sync state saved\n");
+        return false;
+    }
+    uint64_t utc = ((uint64_t)readNtpUint32 (data + 4) << 32) | readNtpUint32 (data + 8);
+    uint32_t error = readNtpUint32 (data + 12);
+    uint32_t unknown = readNtpUint32 (data + 16);
+    uint64_t sinceSave;
+    if (offTime == NTP_OFF_TIME_UNKNOWN)
+        offTime = _storage->getOffTime ();
+    if (_storage->getTimeSinceSave (sinceSave)) {
+        // Storage clock kept running while device was stopped, so elapsed time is known
+        uint64_t elapsed = sinceSave * 1000;
+        setLocalClock (utc + elapsed);
+        _anchor.maxErrorUs = (uint64_t)error * 1000 + elapsed * NTP_MAX_DISPERSION_RATE / 1000000;
+    } else {
+        // Device ran for 0 to unknown ms after saving. Take the middle, so error is half of it. Then it was
+        // stopped for offTime and has been running since boot, which local clock has counted
+        uint64_t uptime = _clock->uptimeUs ();
+        uint64_t elapsed = ((uint64_t)(offTime == NTP_OFF_TIME_UNKNOWN ? 0 : offTime) + unknown / 2) * 1000 + uptime;
+        setLocalClock (utc + elapsed);
+        _anchor.maxErrorUs = ((uint64_t)error + unknown / 2) * 1000 + elapsed * NTP_MAX_DISPERSION_RATE / 1000000;
+        if (offTime == NTP_OFF_TIME_UNKNOWN)
+            _anchor.maxErrorUs = NTP_UNBOUNDED_ERROR; // Time may be behind by as long as device was stopped
+    }
+    _anchor.drift = readNtpUint32 (data + 20);
+    publishAnchor (); // With restored error
+    _driftSamples = state[24];
+    updateAlignPeriod ();
+
+    // Seed DNS cache, so that first sync works even if DNS server cannot be reached
+    for (int i = 0; i < NTP_MAX_SERVERS; i++) {
+        const char *p = data + 28 + 8 * i;
+        IPAddress address ((uint8_t)p[4], (uint8_t)p[5], (uint8_t)p[6], (uint8_t)p[7]);
+        if (!_servers[i].name || address == IPAddress () || (uint32_t)readNtpUint32 (p) != hashName (_servers[i].name))
+            continue;
+        NTPDnsCacheEntry_t *entry = getDnsCacheEntry (_servers[i].name);
+        bool known = false;
+        for (int j = 0; j < entry->count; j++) {
+            known = known || entry->addresses[j] == address;
+        }
+        if (!known && entry->count < NTP_DNS_ADDRESSES) {
+            entry->addresses[entry->count++] = address;
+            entry->resolved = _clock->uptimeMs ();
+        }
+    }
+
+    _provisional = true;
+    setLibraryTime (utcToLocal (_anchor.us / 1000000));
+    _alignPending = true;
+    _alignSecond = 0;
+    DEBUGLOG ("Sync state restored. Maximum error %lu ms\n", (unsigned long)(_anchor.maxErrorUs / 1000));
+    return true;
+}
+
+void NTPClient::shiftLocalClock (int64_t offset) {
+    // Current time is taken from the same millis () and micros () readings that anchor the clock again,
+    // so that no time is lost in between
+    uint64_t uptimeMs = _clock->uptimeMs ();
+    uint32_t micros = _clock->micros ();
+    uint64_t us = _anchor.us + elapsedUs (_anchor, uptimeMs - _anchor.uptimeMs, micros - _anchor.micros);
+    setLocalClock (us + offset, uptimeMs, micros);
+}
+
+void NTPClient::setLocalClock (uint64_t us, uint64_t uptimeMs, uint32_t micros) {
+    _anchor.slewUs = 0; // Elapsed time starts again. Callers set a new slew if needed
+    _anchor.uptimeMs = uptimeMs;
+    _anchor.micros = micros;
+    _anchor.us = us;
+    _anchor.ms = us / 1000;
+    _anchor.remUs = us % 1000;
+    _anchor.ntp = unixUsToNtp (us);
+    publishAnchor ();
+}
+
+void NTPClient::publishAnchor () {
+#ifdef NTPCLIENT_WORKER
+    // Seqlock writer. Sequence is odd while words are being written. There is a single writer: the
+    // thread that runs loop (), which is the worker one while it runs
+    uint32_t seq = _anchorSeq.load (std::memory_order_relaxed);
+    _anchorSeq.store (seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence (std::memory_order_release);
+    for (size_t i = 0; i < NTP_ANCHOR_WORDS; i++) {
+        uint32_t word;
+        memcpy (&word, (const uint8_t *)&_anchor + i * sizeof (word), sizeof (word));
+        _published[i].store (word, std::memory_order_relaxed);
+    }
+    _anchorSeq.store (seq + 2, std::memory_order_release);
 #endif
+}
+
+const NTPClockAnchor_t& NTPClient::readAnchor (NTPClockAnchor_t &copy, uint64_t &elapsedMillis, uint32_t &elapsedMicros) {
+#ifdef NTPCLIENT_WORKER
+    // Seqlock reader. Copy again if writer was active before or during the copy. Clock is read inside the
+    // loop too, so that a reader delayed after the copy never uses state older than its clock reading
+    uint32_t seq;
+    uint32_t ms;
+    uint32_t us;
+    do {
+        seq = _anchorSeq.load (std::memory_order_acquire);
+        for (size_t i = 0; i < NTP_ANCHOR_WORDS; i++) {
+            uint32_t word = _published[i].load (std::memory_order_relaxed);
+            memcpy ((uint8_t *)&copy + i * sizeof (word), &word, sizeof (word));
+        }
+        ms = _clock->millis ();
+        us = _clock->micros ();
+        std::atomic_thread_fence (std::memory_order_acquire);
+    } while ((seq & 1) || seq != _anchorSeq.load (std::memory_order_relaxed));
+    // uptimeMs () keeps rollover count, which is not thread safe. loop () moves anchor before 32 bits wrap
+    elapsedMillis = (uint32_t)(ms - (uint32_t)copy.uptimeMs);
+    elapsedMicros = us - copy.micros;
+    return copy;
+#else
+    (void)copy;
+    elapsedMillis = _clock->uptimeMs () - _anchor.uptimeMs;
+    elapsedMicros = _clock->micros () - _anchor.micros;
+    return _anchor;
+#endif
+}
+
+uint64_t NTPClient::elapsedUs (const NTPClockAnchor_t &anchor, uint64_t elapsedMillis, uint32_t elapsedMicros) {
+    uint64_t elapsed = elapsedMillis * 1000;
+    // micros() has wrapped elapsed / 2^32 times. Its low 32 bits are more precise than millis()
+    elapsed += (int32_t)(elapsedMicros - (uint32_t)elapsed);
+    if (anchor.drift) {
+        // elapsed * drift / 2^32, split in 32 bit halves to avoid overflow
+        uint32_t high = elapsed >> 32;
+        uint32_t low = (uint32_t)elapsed;
+        elapsed += (((int64_t)low * anchor.drift) >> 32) + (int64_t)high * anchor.drift;
+    }
+    if (anchor.slewUs)
+        elapsed += slewApplied (anchor, elapsed);
+    return elapsed;
+}
+
+int32_t NTPClient::getSlewRemaining () {
+    NTPClockAnchor_t copy;
+    uint64_t elapsedMillis;
+    uint32_t elapsedMicros;
+    const NTPClockAnchor_t &anchor = readAnchor (copy, elapsedMillis, elapsedMicros);
+    return anchor.slewUs ? anchor.slewUs - slewApplied (anchor, elapsedUs (anchor, elapsedMillis, elapsedMicros)) : 0;
+}
+
+void NTPClient::setSlewMode (bool enable, uint32_t threshold) {
+    if (threshold > NTP_SLEW_MAX_THRESHOLD)
+        threshold = NTP_SLEW_MAX_THRESHOLD;
+    _slewThreshold = enable ? threshold * 1000 : 0;
+}
+
+uint64_t NTPClient::nowUs () {
+    NTPClockAnchor_t copy;
+    uint64_t elapsedMillis;
+    uint32_t elapsedMicros;
+    const NTPClockAnchor_t &anchor = readAnchor (copy, elapsedMillis, elapsedMicros);
+    return anchor.us + elapsedUs (anchor, elapsedMillis, elapsedMicros);
+}
+
+uint64_t NTPClient::nowMs () {
+    NTPClockAnchor_t copy;
+    uint64_t elapsedMillis;
+    uint32_t elapsedMicros;
+    const NTPClockAnchor_t &anchor = readAnchor (copy, elapsedMillis, elapsedMicros);
+    // Same as (anchor.us + elapsedUs ()) / 1000 without 64 bit divisions. Correction is usually below 1000 us
+    int32_t remainder = (int32_t)(elapsedMicros - (uint32_t)elapsedMillis * 1000) + anchor.remUs;
+    uint64_t ms = anchor.ms + elapsedMillis;
+    if (anchor.drift) {
+        // Drift correction in milliseconds, as 32.32 fixed point. Whole milliseconds beyond 2^32 are added apart
+        int64_t correction = (int64_t)(uint32_t)elapsedMillis * anchor.drift;
+        ms += (correction >> 32) + (int64_t)(uint32_t)(elapsedMillis >> 32) * anchor.drift;
+        remainder += ((correction & 0xFFFFFFFF) * 1000) >> 32;
     }
-    DEBUGLOG ("-- No NTP Response :-(\n");
-    udp->stop ();
-    setSyncInterval (getShortInterval ()); // Retry connection more often
-    if (onSyncEvent)
-        onSyncEvent (noResponse);
-    return 0; // return 0 if unable to get the time
+    if (anchor.slewUs) {
+        int32_t slew = slewApplied (anchor, elapsedMillis * 1000 + (int32_t)(elapsedMicros - (uint32_t)elapsedMillis * 1000));
+        ms += slew / 1000;
+        remainder += slew % 1000;
+    }
+    while (remainder < 0) {
+        remainder += 1000;
+        ms--;
+    }
+    while (remainder >= 1000) {
+        remainder -= 1000;
+        ms++;
+    }
+    return ms;
+}
+
+uint64_t NTPClient::nowNtp () {
+    NTPClockAnchor_t copy;
+    uint64_t elapsedMillis;
+    uint32_t elapsedMicros;
+    const NTPClockAnchor_t &anchor = readAnchor (copy, elapsedMillis, elapsedMicros);
+    uint64_t elapsed = elapsedUs (anchor, elapsedMillis, elapsedMicros);
+    // Microseconds to NTP fraction units: x * 2^32 / 10^6 = x * 4294 + x * 0.967296.
+    // Decimal part is x * 4154504685 / 2^32, split in 32 bit halves to avoid overflow
+    uint32_t high = elapsed >> 32;
+    uint32_t low = (uint32_t)elapsed;
+    return anchor.ntp + elapsed * 4294 + (((uint64_t)low * 4154504685UL) >> 32) + (uint64_t)high * 4154504685UL;
 }
 
 int8_t NTPClient::getTimeZone () {
@@ -184,15 +1458,33 @@ int8_t NTPClient::getTimeZoneMinutes () {
 }*/
 
 time_t NTPClient::s_getTime () {
-    return NTP.getTime ();
+    return s_timeLibClient ? s_timeLibClient->getTime () : 0;
+}
+
+void NTPClient::attachTimeLib (bool attach) {
+    if (attach && _timeLib) {
+        s_timeLibClient = this;
+        setSyncProvider (s_getTime);
+    } else if (s_timeLibClient == this) {
+        s_timeLibClient = NULL;
+        setSyncProvider (NULL);
+    }
+}
+
+void NTPClient::setTimeLibSync (bool sync) {
+    if (!sync)
+        attachTimeLib (false);
+    _timeLib = sync;
 }
 
 #if NETWORK_TYPE == NETWORK_W5100
-bool NTPClient::begin (String ntpServerName, int8_t timeZone, bool daylight, int8_t minutes, EthernetUDP* udp_conn) {
+bool NTPClient::begin (NTPServerNameParam_t ntpServerName, int8_t timeZone, bool daylight, int8_t minutes, EthernetUDP* udp_conn) {
 #elif NETWORK_TYPE == NETWORK_ESP8266 || NETWORK_TYPE == NETWORK_WIFI101 || NETWORK_TYPE == NETWORK_ESP32
-bool NTPClient::begin (String ntpServerName, int8_t timeZone, bool daylight, int8_t minutes, WiFiUDP* udp_conn) {
+bool NTPClient::begin (NTPServerNameParam_t ntpServerName, int8_t timeZone, bool daylight, int8_t minutes, WiFiUDP* udp_conn) {
+#elif NETWORK_TYPE == NETWORK_POSIX
+bool NTPClient::begin (NTPServerNameParam_t ntpServerName, int8_t timeZone, bool daylight, int8_t minutes, NTPTransport* transport) {
 #endif
-    if (!setNtpServerName (ntpServerName)) {
+    if (!setNtpServerName (ntpServerName, 0)) {
         DEBUGLOG ("Time sync not started\r\n");
         return false;
     }
@@ -200,13 +1492,26 @@ bool NTPClient::begin (String ntpServerName, int8_t timeZone, bool daylight, int
         DEBUGLOG ("Time sync not started\r\n");
         return false;
     }
-    if (udp_conn)
-        udp = udp_conn;
-    else
-#if NETWORK_TYPE == NETWORK_W5100
-        udp = new EthernetUDP ();
+#if NETWORK_TYPE == NETWORK_POSIX
+    if (transport)
+        _transport = transport;
+    else if (!_transport)
+        _transport = &_posixTransport;
+#else
+    if (udp_conn) {
+        _udpTransport.setUdp (udp_conn);
+        _transport = &_udpTransport;
+    } else if (!_transport) {
+        if (!_udpTransport.getUdp ())
+#ifdef NTPCLIENT_NO_HEAP
+            _udpTransport.setUdp (&_udp);
+#elif NETWORK_TYPE == NETWORK_W5100
+            _udpTransport.setUdp (new EthernetUDP ());
 #else
-        udp = new WiFiUDP ();
+            _udpTransport.setUdp (new WiFiUDP ());
+#endif
+        _transport = &_udpTransport;
+    }
 #endif
 
     //_timeZone = timeZone;
@@ -219,26 +1524,151 @@ bool NTPClient::begin (String ntpServerName, int8_t timeZone, bool daylight, int
     }
     DEBUGLOG ("Time sync started\r\n");
 
-    setSyncInterval (getShortInterval ());
-    setSyncProvider (s_getTime);
+    _pollInterval = getShortInterval ();
+    _pollCounter = 0;
+    _failures = 0;
+    _active = true;
+    stirRandom (_clock->micros ()); // Boot time to first begin () differs a little from device to device
+    restoreState ();
+    scheduleSync (_pollInterval);
+    if (!_timeLib)
+        _syncDue = _clock->uptimeMs (); // No sync provider call starts first sync, so it is due right away
+#ifdef NTPCLIENT_WORKER
+    if (!_workerRunning)
+#endif
+        attachTimeLib (true);
 
     return true;
 }
 
+void NTPClient::setTransport (NTPTransport *transport) {
+    if (_transport && transport != _transport)
+        closeSocket (true);
+    _transport = transport;
+}
+
+void NTPClient::setClock (NTPClock *clock) {
+    _clock = clock ? clock : &_defaultClock;
+}
+
+void NTPClient::setBurst (uint8_t count, uint16_t spacing) {
+    _burstCount = count < 1 ? 1 : count > NTP_BURST_MAX ? NTP_BURST_MAX : count;
+    _burstSpacing = spacing;
+}
+
+void NTPClient::setNtpServerPort (uint16_t port) {
+    _serverPort = port;
+}
+
+uint16_t NTPClient::getNtpServerPort () {
+    return _serverPort;
+}
+
 bool NTPClient::stop () {
-    setSyncProvider (NULL);
+#ifdef NTPCLIENT_WORKER
+    stopWorker ();
+#endif
+    attachTimeLib (false);
+    _active = false;
+    _serving = false;
+    _broadcastClient = false;
+    closeSocket (true);
+    _syncStatus = syncIdle;
+    _burstLeft = 0;
+    _burstPause = false;
     DEBUGLOG ("Time sync disabled\n");
 
     return true;
 }
 
+#ifdef NTPCLIENT_WORKER
+static thread_local NTPClient *s_workerClient = NULL; // Client whose background worker runs on this thread
+
+#if NETWORK_TYPE != NETWORK_POSIX
+void NTPClient::workerTask (void *client) {
+    ((NTPClient *)client)->workerLoop ();
+}
+#endif
+
+bool NTPClient::beginWorker (uint32_t period) {
+    if (_workerRunning)
+        return true;
+    _workerPeriod = period;
+    attachTimeLib (false); // Time library must not start requests on caller threads
+    _workerRunning = true;
+#if NETWORK_TYPE == NETWORK_POSIX
+    _worker = std::thread (&NTPClient::workerLoop, this);
+#else
+    if (xTaskCreate (workerTask, "ntpclient", NTP_WORKER_STACK, this, NTP_WORKER_PRIORITY, (TaskHandle_t *)&_workerTask) != pdPASS) {
+        _workerRunning = false;
+        _workerTask = NULL;
+        if (_active)
+            attachTimeLib (true);
+        return false;
+    }
+#endif
+    DEBUGLOG ("Background worker started\n");
+    return true;
+}
+
+void NTPClient::stopWorker () {
+    if (!_workerRunning)
+        return;
+    _workerRunning = false;
+#if NETWORK_TYPE == NETWORK_POSIX
+    _worker.join ();
+#else
+    while (_workerTask) {
+        delay (1);
+    }
+#endif
+    if (_active)
+        attachTimeLib (true);
+    DEBUGLOG ("Background worker stopped\n");
+}
+
+void NTPClient::rebaseAnchor () {
+    if (_clock->uptimeMs () - _anchor.uptimeMs >= NTP_ANCHOR_REBASE) {
+        // Readers on other threads count elapsed time with 32 bit millis (). Any slew is over by now
+        if (_anchor.maxErrorUs < NTP_UNBOUNDED_ERROR)
+            _anchor.maxErrorUs += (nowUs () - _anchor.us) * NTP_MAX_DISPERSION_RATE / 1000000;
+        shiftLocalClock (0); // Publishes new state
+        DEBUGLOG ("Local clock anchor moved before millis () wraps\n");
+    }
+}
+
+bool NTPClient::otherThanWorker () {
+    return _workerRunning && s_workerClient != this;
+}
+
+void NTPClient::workerLoop () {
+    s_workerClient = this;
+    while (_workerRunning) {
+        rebaseAnchor (); // Even if loop () changes, readers must never see 32 bit millis () wrap
+        loop ();
+        // Wake up as soon as a packet arrives when one is expected, so that it is timestamped on time
+        if (_transport && (_syncStatus == syncSent || _serving || _broadcastClient))
+            _transport->wait (_workerPeriod);
+        else
+            delay (_workerPeriod);
+    }
+#if NETWORK_TYPE != NETWORK_POSIX
+    _workerTask = NULL;
+    vTaskDelete (NULL);
+#endif
+}
+#endif
+
 bool NTPClient::setInterval (int interval) {
     if (interval >= 10) {
         if (_longInterval != interval) {
             _longInterval = interval;
             DEBUGLOG ("Sync interval set to %d\n", interval);
-            if (timeStatus () == timeSet)
-                setSyncInterval (interval);
+            if (_pollInterval > interval) {
+                _pollInterval = interval;
+                if (_syncStatus != syncResolving && _syncStatus != syncSent)
+                    scheduleSync (interval);
+            }
         }
         return true;
     } else
@@ -246,14 +1676,15 @@ bool NTPClient::setInterval (int interval) {
 }
 
 bool NTPClient::setInterval (int shortInterval, int longInterval) {
-    if (shortInterval >= 10 && longInterval >= 10) {
+    if (shortInterval >= 10 && longInterval >= shortInterval) {
         _shortInterval = shortInterval;
         _longInterval = longInterval;
-        if (timeStatus () != timeSet) {
-            setSyncInterval (shortInterval);
-        } else {
-            setSyncInterval (longInterval);
-        }
+        if (_pollInterval > longInterval)
+            _pollInterval = longInterval;
+        if (_pollInterval < shortInterval)
+            _pollInterval = shortInterval;
+        if (_syncStatus != syncResolving && _syncStatus != syncSent)
+            scheduleSync (_pollInterval);
         DEBUGLOG ("Short sync interval set to %d\n", shortInterval);
         DEBUGLOG ("Long sync interval set to %d\n", longInterval);
         return true;
@@ -272,29 +1703,161 @@ int NTPClient::getShortInterval () {
 void NTPClient::setDayLight (bool daylight) {
     _daylight = daylight;
     DEBUGLOG ("--Set daylight saving %s\n", daylight ? "ON" : "OFF");
-    setTime (getTime ());
+    applyTimeZone (legacyTimeZoneRules ());
 }
 
 bool NTPClient::getDayLight () {
     return _daylight;
 }
 
+// Writes value as a fixed number of decimal digits with leading zeros. Returns pointer past last digit
+static char* writeDigits (char *buffer, uint16_t value, uint8_t digits) {
+    for (int i = digits - 1; i >= 0; i--) {
+        buffer[i] = '0' + value % 10;
+        value /= 10;
+    }
+    return buffer + digits;
+}
+
+// hh:mm:ss
+static char* writeTime (char *buffer, const NTPDateTime_t &tm) {
+    buffer = writeDigits (buffer, tm.hour, 2);
+    *buffer++ = ':';
+    buffer = writeDigits (buffer, tm.minute, 2);
+    *buffer++ = ':';
+    return writeDigits (buffer, tm.second, 2);
+}
+
+// dd/mm/yyyy
+static char* writeDate (char *buffer, const NTPDateTime_t &tm) {
+    buffer = writeDigits (buffer, tm.day, 2);
+    *buffer++ = '/';
+    buffer = writeDigits (buffer, tm.month, 2);
+    *buffer++ = '/';
+    return writeDigits (buffer, tm.year, 4);
+}
+
+// yyyy-mm-ddThh:mm:ss.sss
+static char* writeIsoDateTime (char *buffer, const NTPDateTime_t &tm, uint16_t milliseconds) {
+    buffer = writeDigits (buffer, tm.year, 4);
+    *buffer++ = '-';
+    buffer = writeDigits (buffer, tm.month, 2);
+    *buffer++ = '-';
+    buffer = writeDigits (buffer, tm.day, 2);
+    *buffer++ = 'T';
+    buffer = writeTime (buffer, tm);
+    *buffer++ = '.';
+    return writeDigits (buffer, milliseconds, 3);
+}
+
+// Terminates string and returns its length. Empties buffer if it was too small
+static size_t endString (char *buffer, size_t size, char *end, size_t needed) {
+    if (size < needed) {
+        if (size)
+            buffer[0] = '\0';
+        return 0;
+    }
+    *end = '\0';
+    return end - buffer;
+}
+
+size_t NTPClient::getTimeStr (char *buffer, size_t size, time_t moment) {
+    if (size < NTP_TIME_STR_SIZE)
+        return endString (buffer, size, buffer, NTP_TIME_STR_SIZE);
+    const NTPDateTime_t &tm = _calendar.breakTime (moment);
+    return endString (buffer, size, writeTime (buffer, tm), NTP_TIME_STR_SIZE);
+}
+
+#ifndef NTPCLIENT_NO_HEAP
 String NTPClient::getTimeStr (time_t moment) {
-    char timeStr[10];
-    sprintf (timeStr, "%02d:%02d:%02d", hour (moment), minute (moment), second (moment));
+    char timeStr[NTP_TIME_STR_SIZE];
+    getTimeStr (timeStr, sizeof (timeStr), moment);
 
     return timeStr;
 }
+#endif
+
+size_t NTPClient::getDateStr (char *buffer, size_t size, time_t moment) {
+    if (size < NTP_DATE_STR_SIZE)
+        return endString (buffer, size, buffer, NTP_DATE_STR_SIZE);
+    const NTPDateTime_t &tm = _calendar.breakTime (moment);
+    return endString (buffer, size, writeDate (buffer, tm), NTP_DATE_STR_SIZE);
+}
 
+#ifndef NTPCLIENT_NO_HEAP
 String NTPClient::getDateStr (time_t moment) {
-    char dateStr[12];
-    sprintf (dateStr, "%02d/%02d/%4d", day (moment), month (moment), year (moment));
+    char dateStr[NTP_DATE_STR_SIZE];
+    getDateStr (dateStr, sizeof (dateStr), moment);
 
     return dateStr;
 }
+#endif
+
+size_t NTPClient::getTimeDateString (char *buffer, size_t size, time_t moment) {
+    if (size < NTP_TIME_DATE_STR_SIZE)
+        return endString (buffer, size, buffer, NTP_TIME_DATE_STR_SIZE);
+    const NTPDateTime_t &tm = _calendar.breakTime (moment);
+    char *end = writeTime (buffer, tm);
+    *end++ = ' ';
+    return endString (buffer, size, writeDate (end, tm), NTP_TIME_DATE_STR_SIZE);
+}
 
+#ifndef NTPCLIENT_NO_HEAP
 String NTPClient::getTimeDateString (time_t moment) {
-    return getTimeStr (moment) + " " + getDateStr (moment);
+    char timeDateStr[NTP_TIME_DATE_STR_SIZE];
+    getTimeDateString (timeDateStr, sizeof (timeDateStr), moment);
+
+    return timeDateStr;
+}
+#endif
+
+size_t NTPClient::getISO8601Str (char *buffer, size_t size, uint64_t utcMs) {
+    if (size < NTP_ISO8601_STR_SIZE)
+        return endString (buffer, size, buffer, NTP_ISO8601_STR_SIZE);
+    time_t seconds = utcMs / 1000;
+    const NTPDateTime_t &tm = _calendar.breakTime (seconds);
+    char *end = writeIsoDateTime (buffer, tm, utcMs - (uint64_t)seconds * 1000);
+    *end++ = 'Z';
+    return endString (buffer, size, end, NTP_ISO8601_STR_SIZE);
+}
+
+size_t NTPClient::getRFC3339Str (char *buffer, size_t size, uint64_t utcMs) {
+    if (size < NTP_RFC3339_STR_SIZE)
+        return endString (buffer, size, buffer, NTP_RFC3339_STR_SIZE);
+    time_t seconds = utcMs / 1000;
+    time_t local = utcToLocal (seconds);
+    const NTPDateTime_t &tm = _calendar.breakTime (local);
+    char *end = writeIsoDateTime (buffer, tm, utcMs - (uint64_t)seconds * 1000);
+    int32_t offsetMinutes = ((int32_t)local - (int32_t)seconds) / 60;
+    *end++ = offsetMinutes < 0 ? '-' : '+';
+    if (offsetMinutes < 0)
+        offsetMinutes = -offsetMinutes;
+    end = writeDigits (end, offsetMinutes / 60, 2);
+    *end++ = ':';
+    end = writeDigits (end, offsetMinutes % 60, 2);
+    return endString (buffer, size, end, NTP_RFC3339_STR_SIZE);
+}
+
+int64_t NTPClient::getTimeSinceLastSync () {
+    NTPClockAnchor_t copy;
+    uint64_t elapsedMillis;
+    uint32_t elapsedMicros;
+    const NTPClockAnchor_t &anchor = readAnchor (copy, elapsedMillis, elapsedMicros);
+    if (!anchor.lastSyncMs)
+        return -1;
+    return anchor.uptimeMs + elapsedMillis - anchor.lastSyncMs;
+}
+
+size_t NTPClient::getStatsStr (char *buffer, size_t size) {
+    const char *names[NTP_MAX_SERVERS];
+    for (int i = 0; i < NTP_MAX_SERVERS; i++) {
+        names[i] = _servers[i].name;
+    }
+    return _stats.toString (buffer, size, names, _clock->uptimeMs ());
+}
+
+size_t NTPClient::getStatsBinary (uint8_t *buffer, size_t size) {
+    return _stats.toBinary (buffer, size, _clock->uptimeMs ());
 }
 
 time_t NTPClient::getLastNTPSync () {
@@ -305,34 +1868,106 @@ void NTPClient::onNTPSyncEvent (onSyncEvent_t handler) {
     onSyncEvent = handler;
 }
 
+void NTPClient::onNTPSyncEvent (onSyncEventInfo_t handler) {
+    onSyncEventInfo = handler;
+}
+
+static_assert ((NTP_EVENT_QUEUE_SIZE & (NTP_EVENT_QUEUE_SIZE - 1)) == 0 && NTP_EVENT_QUEUE_SIZE <= 128,
+               "NTP_EVENT_QUEUE_SIZE must be a power of two up to 128");
+
+// Single producer, single consumer ring. Indexes count forever and wrap at 256, so head - tail is the
+// number of queued events. Each side only writes its own index, so no lock is needed
+void NTPClient::queueEvent (NTPSyncEvent_t event) {
+    if (!onSyncEvent && !onSyncEventInfo)
+        return;
+    uint8_t head = _eventHead;
+    if ((uint8_t)(head - __atomic_load_n (&_eventTail, __ATOMIC_ACQUIRE)) >= NTP_EVENT_QUEUE_SIZE) {
+        _droppedEvents++;
+        return;
+    }
+    NTPSyncEventInfo_t &info = _events[head & (NTP_EVENT_QUEUE_SIZE - 1)];
+    info.event = event;
+    info.server = event == timeSyncd ? _bestServer : -1;
+    info.stratum = event == timeSyncd ? _stratum : 0;
+    info.offset = event == timeSyncd ? _offset : 0;
+    info.delay = event == timeSyncd ? _delay : 0;
+    info.time = _lastSyncUs || _provisional ? utcToLocal (nowMs () / 1000) : 0; // Not now (), as this may run inside Time library sync
+    __atomic_store_n (&_eventHead, (uint8_t)(head + 1), __ATOMIC_RELEASE);
+}
+
+void NTPClient::handleEvents () {
+    uint8_t tail = _eventTail;
+    while (tail != __atomic_load_n (&_eventHead, __ATOMIC_ACQUIRE)) {
+        NTPSyncEventInfo_t info = _events[tail & (NTP_EVENT_QUEUE_SIZE - 1)]; // Copy, so slot can be reused while handler runs
+        __atomic_store_n (&_eventTail, ++tail, __ATOMIC_RELEASE);
+        if (onSyncEvent)
+            onSyncEvent (info.event);
+        if (onSyncEventInfo)
+            onSyncEventInfo (info);
+    }
+}
+
 time_t NTPClient::getUptime () {
-    _uptime = _uptime + (millis () - _uptime);
-    return _uptime / 1000;
+    return _clock->uptimeMs () / 1000;
 }
 
-String NTPClient::getUptimeString () {
-    uint16_t days;
-    uint8_t hours;
-    uint8_t minutes;
-    uint8_t seconds;
+uint64_t NTPClient::getUptimeMs () {
+    // Not _clock->uptimeMs (), which keeps rollover count and may only be called from thread that runs loop ()
+    NTPClockAnchor_t copy;
+    uint64_t elapsedMillis;
+    uint32_t elapsedMicros;
+    const NTPClockAnchor_t &anchor = readAnchor (copy, elapsedMillis, elapsedMicros);
+    return anchor.uptimeMs + elapsedMillis;
+}
+
+uint64_t NTPClient::getUptimeUs () {
+    NTPClockAnchor_t copy;
+    uint64_t elapsedMillis;
+    uint32_t elapsedMicros;
+    const NTPClockAnchor_t &anchor = readAnchor (copy, elapsedMillis, elapsedMicros);
+    uint64_t us = (anchor.uptimeMs + elapsedMillis) * 1000;
+    // Low 32 bits of micros () are more precise than millis (), as in NTPClock::uptimeUs ()
+    return us + (int32_t)(anchor.micros + elapsedMicros - (uint32_t)us);
+}
+
+size_t NTPClient::getUptimeString (char *buffer, size_t size) {
+    if (size < NTP_UPTIME_STR_SIZE)
+        return endString (buffer, size, buffer, NTP_UPTIME_STR_SIZE);
 
     time_t uptime = getUptime ();
+    uint8_t seconds = uptime % SECS_PER_MIN;
+    uint8_t minutes = (uptime / SECS_PER_MIN) % 60;
+    uint8_t hours = (uptime / SECS_PER_HOUR) % 24;
+    uint16_t days = uptime / SECS_PER_DAY;
 
-    seconds = uptime % SECS_PER_MIN;
-    uptime -= seconds;
-    minutes = (uptime % SECS_PER_HOUR) / SECS_PER_MIN;
-    uptime -= minutes * SECS_PER_MIN;
-    hours = (uptime % SECS_PER_DAY) / SECS_PER_HOUR;
-    uptime -= hours * SECS_PER_HOUR;
-    days = uptime / SECS_PER_DAY;
+    // Days are right aligned on 4 characters, as %4u does
+    uint8_t digits = days > 9999 ? 5 : 4;
+    char *end = writeDigits (buffer, days, digits);
+    for (int i = 0; i < digits - 1 && buffer[i] == '0'; i++) {
+        buffer[i] = ' ';
+    }
+    memcpy (end, " days ", 6);
+    end += 6;
+    end = writeDigits (end, hours, 2);
+    *end++ = ':';
+    end = writeDigits (end, minutes, 2);
+    *end++ = ':';
+    end = writeDigits (end, seconds, 2);
+    return endString (buffer, size, end, NTP_UPTIME_STR_SIZE);
+}
 
-    char uptimeStr[20];
-    sprintf (uptimeStr, "%4u days %02d:%02d:%02d", days, hours, minutes, seconds);
+#ifndef NTPCLIENT_NO_HEAP
+String NTPClient::getUptimeString () {
+    char uptimeStr[NTP_UPTIME_STR_SIZE];
+    getUptimeString (uptimeStr, sizeof (uptimeStr));
 
     return uptimeStr;
 }
+#endif
 
 time_t NTPClient::getLastBootTime () {
+    if (!_timeLib)
+        return _lastSyncUs || _provisional ? utcToLocal (nowUs () / 1000000) - getUptime () : 0;
     if (timeStatus () == timeSet) {
         return (now () - getUptime ());
     }
@@ -348,47 +1983,107 @@ time_t NTPClient::getFirstSync () {
     return _firstSync;
 }
 
-bool NTPClient::summertime (int year, byte month, byte day, byte hour, byte tzHours)
-// input parameters: "normal time" for year, month, day, hour and tzHours (0=UTC, 1=MEZ)
-{
-    if ((month < 3) || (month > 10)) return false; // keine Sommerzeit in Jan, Feb, Nov, Dez
-    if ((month > 3) && (month < 10)) return true; // Sommerzeit in Apr, Mai, Jun, Jul, Aug, Sep
-    if ((month == 3 && (hour + 24 * day) >= (1 + tzHours + 24 * (31 - (5 * year / 4 + 4) % 7))) || (month == 10 && (hour + 24 * day) < (1 + tzHours + 24 * (31 - (5 * year / 4 + 1) % 7))))
-        return true;
-    else
-        return false;
-}
-
 boolean NTPClient::isSummerTimePeriod (time_t moment) {
-    return summertime (year (), month (), day (), hour (), getTimeZone ());
+    return _tz.isDst (_tz.toUtc (moment));
 }
 
 void NTPClient::setLastNTPSync (time_t moment) {
     _lastSyncd = moment;
 }
 
+time_t NTPClient::utcToLocal (time_t utc) {
+    return _tz.toLocal (utc);
+}
+
 time_t NTPClient::decodeNtpMessage (char *messageBuffer) {
-    unsigned long secsSince1900;
-    // convert four bytes starting at location 40 to a long integer
-    secsSince1900 = (unsigned long)messageBuffer[40] << 24;
-    secsSince1900 |= (unsigned long)messageBuffer[41] << 16;
-    secsSince1900 |= (unsigned long)messageBuffer[42] << 8;
-    secsSince1900 |= (unsigned long)messageBuffer[43];
-
-#define SEVENTY_YEARS 2208988800UL
-    time_t timeTemp = secsSince1900 - SEVENTY_YEARS + _timeZone * SECS_PER_HOUR + _minutesOffset * SECS_PER_MIN;
-
-    if (_daylight) {
-        if (summertime (year (timeTemp), month (timeTemp), day (timeTemp), hour (timeTemp), _timeZone)) {
-            timeTemp += SECS_PER_HOUR;
-            DEBUGLOG ("Summer Time\n");
-        } else {
-            DEBUGLOG ("Winter Time\n");
+    uint64_t originate = readNtpTimestamp (messageBuffer + 24);
+    NTPServer_t *server = NULL;
+    bool hedge = false;
+    for (int i = 0; i < NTP_MAX_SERVERS; i++) {
+        if (!_servers[i].sent || _servers[i].replied)
+            continue;
+        hedge = _servers[i].hedged && _servers[i].hedgeTimestamp == originate;
+        if (_servers[i].requestTimestamp == originate || hedge) {
+            server = &_servers[i];
+            break;
         }
-    } else {
-        DEBUGLOG ("No daylight\n");
     }
-    return timeTemp;
+    if (!server && _broadcaster.sent && !_broadcaster.replied && _broadcaster.requestTimestamp == originate)
+        server = &_broadcaster; // Delay measurement response
+    if (!server) {
+        DEBUGLOG ("Response does not match any request\n");
+        return 0;
+    }
+    int idx = server - _servers; // Out of range for broadcaster
+    bool counted = idx >= 0 && idx < NTP_MAX_SERVERS;
+    if (_receiveAddress != (hedge ? server->hedgeAddress : server->address)) {
+        DEBUGLOG ("Response does not come from server address\n");
+        if (counted)
+            _stats.addInvalid (idx);
+        return 0; // Keep waiting for the real one
+    }
+    if (hedge) {
+        // Backup request was answered first. Its address is the one that works
+        server->address = server->hedgeAddress;
+        server->sendUs = server->hedgeSendUs;
+    }
+    uint8_t stratum = (uint8_t)messageBuffer[1];
+    if (!stratum) {
+        processKissCode (*server, messageBuffer + 12);
+        return 0;
+    }
+    uint8_t leap = (uint8_t)messageBuffer[0] >> 6;
+    uint8_t version = ((uint8_t)messageBuffer[0] >> 3) & 0x07;
+    if (leap == 3 || version < 1 || version > 4 || stratum >= 16
+        || !readNtpTimestamp (messageBuffer + 32) || !readNtpTimestamp (messageBuffer + 40)) {
+        DEBUGLOG ("Invalid response. Server may be unsynchronized\n");
+        server->sent = false; // Server has answered. Do not wait for it nor count a timeout
+        if (counted)
+            _stats.addInvalid (idx);
+        return 0;
+    }
+
+    // T1 and T4 are request send and response receive instants, read from local clock.
+    // T2 and T3 are server receive and transmit timestamps
+    int64_t t1 = server->sendUs;
+    int64_t t4 = _receiveUs;
+    int64_t t2 = ntpToUnixUs (readNtpTimestamp (messageBuffer + 32));
+    int64_t t3 = ntpToUnixUs (readNtpTimestamp (messageBuffer + 40));
+
+    int64_t offset = ((t2 - t1) + (t3 - t4)) / 2;
+    int64_t delay = (t4 - t1) - (t3 - t2);
+    if (delay < 0)
+        delay = 0;
+    // Root distance: half of total round trip delay to primary reference plus root dispersion.
+    // Root delay and root dispersion are 16.16 fixed point seconds
+    uint32_t rootDelay = ((uint64_t)readNtpUint32 (messageBuffer + 4) * 1000000) >> 16;
+    uint32_t rootDispersion = ((uint64_t)readNtpUint32 (messageBuffer + 8) * 1000000) >> 16;
+    uint32_t distance = (delay + rootDelay) / 2 + rootDispersion;
+    if (distance > NTP_MAX_DISTANCE) {
+        DEBUGLOG ("Invalid response. Root distance too large\n");
+        server->sent = false;
+        if (counted)
+            _stats.addInvalid (idx);
+        return 0;
+    }
+    server->replied = true;
+    server->kods = 0;
+    if (counted)
+        _stats.addReply (idx, delay);
+    DEBUGLOG ("%s: Offset: %ld ms. Delay: %lu us\n", server->name ? server->name : "Broadcaster", (long)(offset / 1000), (unsigned long)delay);
+    // On a burst keep the sample with lowest delay, as its offset has the smallest error (RFC 5905 clock filter)
+    if (!server->samples || delay < server->delay) {
+        server->offset = offset;
+        server->delay = delay;
+        server->distance = distance;
+        server->rootDelay = rootDelay;
+        server->rootDispersion = rootDispersion;
+        server->stratum = stratum;
+    }
+    if (server->samples < 255)
+        server->samples++;
+
+    return utcToLocal ((t4 + offset + 500000) / 1000000); // Round to nearest second
 }
 
 NTPClient NTP;
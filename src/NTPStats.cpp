@@ -0,0 +1,235 @@
+/*
+Copyright 2016 German Martin (gmag11@gmail.com). All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met :
+
+1. Redistributions of source code must retain the above copyright notice, this list of
+conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list
+of conditions and the following disclaimer in the documentation and / or other materials
+provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ''AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL <COPYRIGHT HOLDER> OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT(INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those of the
+authors and should not be interpreted as representing official policies, either expressed
+or implied, of German Martin
+*/
+//
+//
+//
+
+#include "NtpClientLib.h"
+#include <stdarg.h>
+#include <stdio.h>
+
+void NTPStats::reset () {
+    memset (&_stats, 0, sizeof (_stats));
+    for (int i = 0; i < NTP_MAX_SERVERS; i++) {
+        _stats.servers[i].minRtt = 0xFFFFFFFF;
+    }
+}
+
+void NTPStats::resetServer (int idx) {
+    memset (&_stats.servers[idx], 0, sizeof (NTPServerStats_t));
+    _stats.servers[idx].minRtt = 0xFFFFFFFF;
+}
+
+uint8_t NTPStats::bucket (uint64_t value) {
+    value >>= NTP_STATS_BUCKET_SHIFT;
+    uint8_t bucket = 0;
+    while (value && bucket < NTP_STATS_BUCKETS - 1) { // Number of significant bits
+        value >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+void NTPStats::addToHistogram (uint16_t *histogram, uint64_t value) {
+    uint8_t b = bucket (value);
+    if (histogram[b] == 0xFFFF) {
+        for (int i = 0; i < NTP_STATS_BUCKETS; i++) {
+            histogram[i] >>= 1;
+        }
+    }
+    histogram[b]++;
+}
+
+void NTPStats::addReply (int idx, uint32_t rtt) {
+    NTPServerStats_t &server = _stats.servers[idx];
+    server.replies++;
+    server.lastRtt = rtt;
+    if (rtt < server.minRtt)
+        server.minRtt = rtt;
+    if (rtt > server.maxRtt)
+        server.maxRtt = rtt;
+    server.rttSum += rtt;
+    addToHistogram (server.rttHistogram, rtt);
+}
+
+uint32_t NTPStats::rttPercentile (int idx, uint8_t percent) {
+    const uint16_t *histogram = _stats.servers[idx].rttHistogram;
+    uint32_t total = 0;
+    for (int i = 0; i < NTP_STATS_BUCKETS; i++) {
+        total += histogram[i];
+    }
+    if (!total)
+        return 0;
+    uint32_t target = (total * percent + 99) / 100;
+    uint32_t count = 0;
+    for (int i = 0; i < NTP_STATS_BUCKETS - 1; i++) {
+        count += histogram[i];
+        if (count >= target)
+            return bucketStart (i + 1);
+    }
+    return 0xFFFFFFFF;
+}
+
+void NTPStats::addSync (int64_t offset, uint64_t uptimeMs) {
+    _stats.syncs++;
+    _stats.lastSyncMs = uptimeMs ? uptimeMs : 1; // 0 means never
+    addToHistogram (_stats.offsetHistogram, offset < 0 ? -offset : offset);
+}
+
+// Milliseconds since last sync, saturated to 32 bits. 0xFFFFFFFF if never synced
+static uint32_t sinceLastSync (const NTPStats_t &stats, uint64_t uptimeMs) {
+    if (!stats.lastSyncMs)
+        return 0xFFFFFFFF;
+    uint64_t since = uptimeMs - stats.lastSyncMs;
+    return since < 0xFFFFFFFF ? since : 0xFFFFFFFF;
+}
+
+static uint32_t meanRtt (const NTPServerStats_t &server) {
+    return server.replies ? server.rttSum / server.replies : 0;
+}
+
+// Appends formatted text. Remembers if buffer got full
+class TextWriter {
+public:
+    TextWriter (char *buffer, size_t size) : _buffer (buffer), _size (size) {}
+
+    void print (const char *format, ...) {
+        if (_full)
+            return;
+        va_list args;
+        va_start (args, format);
+        int written = vsnprintf (_buffer + _length, _size - _length, format, args);
+        va_end (args);
+        if (written < 0 || (size_t)written >= _size - _length)
+            _full = true;
+        else
+            _length += written;
+    }
+
+    void printHistogram (const uint16_t *histogram) {
+        for (int i = 0; i < NTP_STATS_BUCKETS; i++) {
+            if (histogram[i])
+                print (" %d:%u", i, histogram[i]);
+        }
+    }
+
+    size_t end () {
+        if (_full) {
+            if (_size)
+                _buffer[0] = '\0';
+            return 0;
+        }
+        return _length;
+    }
+
+protected:
+    char *_buffer;
+    size_t _size;
+    size_t _length = 0;
+    bool _full = false;
+};
+
+size_t NTPStats::toString (char *buffer, size_t size, const char * const names[], uint64_t uptimeMs) {
+    TextWriter out (buffer, size);
+    if (!size)
+        return 0;
+    buffer[0] = '\0';
+    uint32_t since = sinceLastSync (_stats, uptimeMs);
+    out.print ("syncs %lu noresp %lu noaddr %lu disagree %lu served %lu last ", (unsigned long)_stats.syncs, (unsigned long)_stats.noResponse,
+               (unsigned long)_stats.invalidAddress, (unsigned long)_stats.serversDisagree, (unsigned long)_stats.served);
+    if (since == 0xFFFFFFFF)
+        out.print ("never");
+    else
+        out.print ("%lus", (unsigned long)(since / 1000));
+    out.print (" offset");
+    out.printHistogram (_stats.offsetHistogram);
+    out.print ("\n");
+    for (int i = 0; i < NTP_MAX_SERVERS; i++) {
+        const NTPServerStats_t &server = _stats.servers[i];
+        if (!names[i] && !server.requests)
+            continue;
+        out.print ("s%d %s req %lu hedge %lu ok %lu to %lu rej %lu dns %lu kod %lu bad %lu rtt %lu %lu/%lu/%lu hist", i, names[i] ? names[i] : "-",
+                   (unsigned long)server.requests, (unsigned long)server.hedges, (unsigned long)server.replies, (unsigned long)server.timeouts,
+                   (unsigned long)server.rejected, (unsigned long)server.resolveErrors, (unsigned long)server.kods,
+                   (unsigned long)server.invalid, (unsigned long)server.lastRtt,
+                   (unsigned long)(server.replies ? server.minRtt : 0), (unsigned long)meanRtt (server), (unsigned long)server.maxRtt);
+        out.printHistogram (server.rttHistogram);
+        out.print ("\n");
+    }
+    return out.end ();
+}
+
+static uint8_t* writeUint32 (uint8_t *buffer, uint32_t value) {
+    buffer[0] = value >> 24;
+    buffer[1] = value >> 16;
+    buffer[2] = value >> 8;
+    buffer[3] = value;
+    return buffer + 4;
+}
+
+static uint8_t* writeHistogram (uint8_t *buffer, const uint16_t *histogram) {
+    for (int i = 0; i < NTP_STATS_BUCKETS; i++) {
+        *buffer++ = histogram[i] >> 8;
+        *buffer++ = histogram[i];
+    }
+    return buffer;
+}
+
+size_t NTPStats::toBinary (uint8_t *buffer, size_t size, uint64_t uptimeMs) {
+    if (size < NTP_STATS_BIN_SIZE)
+        return 0;
+    uint8_t *p = buffer;
+    *p++ = NTP_STATS_VERSION;
+    *p++ = NTP_MAX_SERVERS;
+    *p++ = NTP_STATS_BUCKETS;
+    *p++ = 0;
+    p = writeUint32 (p, _stats.syncs);
+    p = writeUint32 (p, _stats.noResponse);
+    p = writeUint32 (p, _stats.invalidAddress);
+    p = writeUint32 (p, _stats.serversDisagree);
+    p = writeUint32 (p, _stats.served);
+    p = writeUint32 (p, sinceLastSync (_stats, uptimeMs));
+    p = writeHistogram (p, _stats.offsetHistogram);
+    for (int i = 0; i < NTP_MAX_SERVERS; i++) {
+        const NTPServerStats_t &server = _stats.servers[i];
+        p = writeUint32 (p, server.requests);
+        p = writeUint32 (p, server.hedges);
+        p = writeUint32 (p, server.replies);
+        p = writeUint32 (p, server.timeouts);
+        p = writeUint32 (p, server.rejected);
+        p = writeUint32 (p, server.resolveErrors);
+        p = writeUint32 (p, server.kods);
+        p = writeUint32 (p, server.invalid);
+        p = writeUint32 (p, server.lastRtt);
+        p = writeUint32 (p, server.replies ? server.minRtt : 0);
+        p = writeUint32 (p, server.maxRtt);
+        p = writeUint32 (p, meanRtt (server));
+        p = writeHistogram (p, server.rttHistogram);
+    }
+    return p - buffer;
+}
@@ -0,0 +1,185 @@
+/*
+Copyright 2016 German Martin (gmag11@gmail.com). All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met :
+
+1. Redistributions of source code must retain the above copyright notice, this list of
+conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list
+of conditions and the following disclaimer in the documentation and / or other materials
+provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ''AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL <COPYRIGHT HOLDER> OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT(INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those of the
+authors and should not be interpreted as representing official policies, either expressed
+or implied, of German Martin
+*/
+/*
+ Name:		NTPStats.h
+ Author:	Germán Martín (gmag11@gmail.com)
+ Maintainer:Germán Martín (gmag11@gmail.com)
+
+ Sync statistics in fixed size storage. Included from NtpClientLib.h, after NTP_MAX_SERVERS is defined.
+*/
+
+#ifndef _NTPStats_h
+#define _NTPStats_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef NTP_STATS_BUCKETS
+#define NTP_STATS_BUCKETS 16 // Number of histogram buckets. Last one holds every value above previous ones
+#endif
+#define NTP_STATS_BUCKET_SHIFT 7 // Bucket 0 holds values below 2^7 = 128 us. Every next bucket doubles range
+#define NTP_STATS_VERSION 4 // Binary dump format version
+// Buffer size that always fits text dump, given server names are shorter than NTP_SERVER_NAME_SIZE
+#define NTP_STATS_STR_SIZE (288 + NTP_MAX_SERVERS * (352 + NTP_SERVER_NAME_SIZE))
+// Binary dump size: header, global counters and histogram, and counters and histogram for every server
+#define NTP_STATS_BIN_SIZE (28 + 2 * NTP_STATS_BUCKETS + NTP_MAX_SERVERS * (48 + 2 * NTP_STATS_BUCKETS))
+
+typedef struct {
+    uint32_t requests;          ///< Requests sent
+    uint32_t hedges;            ///< Backup requests sent because response was late
+    uint32_t replies;           ///< Valid responses received
+    uint32_t timeouts;          ///< Requests not answered before NTP_TIMEOUT
+    uint32_t rejected;          ///< Responses discarded by server selection as falsetickers or outliers
+    uint32_t resolveErrors;     ///< Syncs where server name could not be resolved
+    uint32_t kods;              ///< Kiss-o'-Death responses, asking to reduce rate or to stop querying
+    uint32_t invalid;           ///< Responses discarded by validation: unsynchronized server, bad fields or wrong source
+    uint32_t lastRtt;           ///< Round trip delay of last response, in microseconds
+    uint32_t minRtt;            ///< Minimum round trip delay, in microseconds
+    uint32_t maxRtt;            ///< Maximum round trip delay, in microseconds
+    uint64_t rttSum;            ///< Sum of all round trip delays, to calculate mean
+    uint16_t rttHistogram[NTP_STATS_BUCKETS]; ///< Round trip delays, log2 bucketed
+} NTPServerStats_t;
+
+typedef struct {
+    uint32_t syncs;             ///< Successful syncs
+    uint32_t noResponse;        ///< Syncs where no server answered
+    uint32_t invalidAddress;    ///< Syncs where no server name could be resolved
+    uint32_t serversDisagree;   ///< Syncs where servers answered but did not agree
+    uint32_t served;            ///< Requests answered as SNTP server
+    uint64_t lastSyncMs;        ///< Uptime of last successful sync, in milliseconds. 0 equals never
+    uint16_t offsetHistogram[NTP_STATS_BUCKETS]; ///< Absolute value of offsets applied on every sync, log2 bucketed
+    NTPServerStats_t servers[NTP_MAX_SERVERS]; ///< Statistics of every server slot
+} NTPStats_t;
+
+/**
+* Collects sync statistics. Histograms count up to 65535 per bucket. When a bucket fills up, all
+* buckets of that histogram are halved, so it keeps its shape and recent samples weigh more.
+*/
+class NTPStats {
+public:
+    NTPStats () { reset (); }
+
+    /**
+    * Clears all statistics.
+    */
+    void reset ();
+
+    /**
+    * Clears statistics of a server slot, when server changes.
+    * @param[in] Server index.
+    */
+    void resetServer (int idx);
+
+    /**
+    * Gets collected data.
+    */
+    const NTPStats_t& get () { return _stats; }
+
+    void addRequest (int idx) { _stats.servers[idx].requests++; }
+    void addHedge (int idx) { _stats.servers[idx].hedges++; }
+    void addTimeout (int idx) { _stats.servers[idx].timeouts++; }
+    void addRejected (int idx) { _stats.servers[idx].rejected++; }
+    void addResolveError (int idx) { _stats.servers[idx].resolveErrors++; }
+    void addKod (int idx) { _stats.servers[idx].kods++; }
+    void addInvalid (int idx) { _stats.servers[idx].invalid++; }
+    void addNoResponse () { _stats.noResponse++; }
+    void addInvalidAddress () { _stats.invalidAddress++; }
+    void addServersDisagree () { _stats.serversDisagree++; }
+    void addServed () { _stats.served++; }
+
+    /**
+    * Records a valid response.
+    * @param[in] Server index.
+    * @param[in] Round trip delay in microseconds.
+    */
+    void addReply (int idx, uint32_t rtt);
+
+    /**
+    * Records a successful sync.
+    * @param[in] Offset applied, in microseconds.
+    * @param[in] Uptime in milliseconds.
+    */
+    void addSync (int64_t offset, uint64_t uptimeMs);
+
+    /**
+    * Gets a percentile of round trip delays of a server, from its histogram.
+    * @param[in] Server index.
+    * @param[in] Percentile, 1 to 100.
+    * @param[out] Upper end of bucket that holds percentile, in microseconds. 0 if there are no samples, 0xFFFFFFFF if it is in last bucket.
+    */
+    uint32_t rttPercentile (int idx, uint8_t percent);
+
+    /**
+    * Gets histogram bucket that a value belongs to.
+    * @param[in] Value in microseconds.
+    */
+    static uint8_t bucket (uint64_t value);
+
+    /**
+    * Gets lowest value that a histogram bucket holds.
+    * @param[in] Bucket index.
+    * @param[out] Value in microseconds.
+    */
+    static uint32_t bucketStart (uint8_t bucket) { return bucket ? 1UL << (bucket + NTP_STATS_BUCKET_SHIFT - 1) : 0; }
+
+    /**
+    * Writes statistics as compact text, one line for global counters and one for every server.
+    * Histograms are listed as bucket:count pairs, skipping empty buckets.
+    * @param[out] Buffer. NTP_STATS_STR_SIZE bytes always fit.
+    * @param[in] Buffer size.
+    * @param[in] Server names, NULL for unused slots.
+    * @param[in] Current uptime in milliseconds.
+    * @param[out] Number of characters written, not counting null terminator. 0 if buffer is too small.
+    */
+    size_t toString (char *buffer, size_t size, const char * const names[], uint64_t uptimeMs);
+
+    /**
+    * Writes statistics in binary form: version, number of servers and buckets and a reserved byte,
+    * then big endian global counters (syncs, noResponse, invalidAddress, serversDisagree, served and
+    * milliseconds since last sync, 0xFFFFFFFF if never or too long), offset histogram, and for every
+    * server requests, hedges, replies, timeouts, rejected, resolveErrors, kods, invalid, lastRtt, minRtt, maxRtt, mean RTT
+    * and RTT histogram. Counters are 32 bit, histogram buckets 16 bit.
+    * @param[out] Buffer. Needs NTP_STATS_BIN_SIZE bytes.
+    * @param[in] Buffer size.
+    * @param[in] Current uptime in milliseconds.
+    * @param[out] Number of bytes written. 0 if buffer is too small.
+    */
+    size_t toBinary (uint8_t *buffer, size_t size, uint64_t uptimeMs);
+
+protected:
+    NTPStats_t _stats;          ///< Collected data
+
+    /**
+    * Adds a value to a histogram.
+    * @param[in] Histogram.
+    * @param[in] Value in microseconds.
+    */
+    static void addToHistogram (uint16_t *histogram, uint64_t value);
+};
+
+#endif // _NTPStats_h
@@ -0,0 +1,131 @@
+/*
+Copyright 2016 German Martin (gmag11@gmail.com). All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met :
+
+1. Redistributions of source code must retain the above copyright notice, this list of
+conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list
+of conditions and the following disclaimer in the documentation and / or other materials
+provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ''AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL <COPYRIGHT HOLDER> OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT(INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those of the
+authors and should not be interpreted as representing official policies, either expressed
+or implied, of German Martin
+*/
+//
+//
+//
+
+#include "NtpClientLib.h"
+
+#if NETWORK_TYPE == NETWORK_POSIX
+#include <stdio.h>
+#include <time.h>
+#include <sys/stat.h>
+
+bool NTPFileStorage::load (uint8_t *data, size_t size) {
+    FILE *file = fopen (_path, "rb");
+    if (!file)
+        return false;
+    bool ok = fread (data, 1, size, file) == size;
+    fclose (file);
+    return ok;
+}
+
+bool NTPFileStorage::save (const uint8_t *data, size_t size) {
+    char temporary[256];
+    if (snprintf (temporary, sizeof (temporary), "%s.tmp", _path) >= (int)sizeof (temporary))
+        return false;
+    FILE *file = fopen (temporary, "wb");
+    if (!file)
+        return false;
+    bool ok = fwrite (data, 1, size, file) == size;
+    ok = fclose (file) == 0 && ok;
+    return ok && rename (temporary, _path) == 0;
+}
+
+bool NTPFileStorage::getTimeSinceSave (uint64_t &ms) {
+    struct stat info;
+    struct timespec now;
+    if (stat (_path, &info) != 0 || clock_gettime (CLOCK_REALTIME, &now) != 0)
+        return false;
+#ifdef __APPLE__
+    const struct timespec &saved = info.st_mtimespec;
+#else
+    const struct timespec &saved = info.st_mtim;
+#endif
+    int64_t since = ((int64_t)now.tv_sec - saved.tv_sec) * 1000 + (now.tv_nsec - saved.tv_nsec) / 1000000;
+    if (since < 0)
+        return false; // System clock went back, it cannot be trusted
+    ms = since;
+    return true;
+}
+
+#elif defined ARDUINO_ARCH_ESP8266
+
+bool NTPRtcStorage::load (uint8_t *data, size_t size) {
+    uint32_t blocks[NTP_STATE_SIZE / 4]; // RTC memory is accessed in aligned 4 byte blocks
+    if (size > sizeof (blocks) || !ESP.rtcUserMemoryRead (_offset, blocks, sizeof (blocks)))
+        return false;
+    memcpy (data, blocks, size);
+    return true;
+}
+
+bool NTPRtcStorage::save (const uint8_t *data, size_t size) {
+    uint32_t blocks[NTP_STATE_SIZE / 4];
+    if (size > sizeof (blocks))
+        return false;
+    memset (blocks, 0, sizeof (blocks));
+    memcpy (blocks, data, size);
+    return ESP.rtcUserMemoryWrite (_offset, blocks, sizeof (blocks));
+}
+
+uint32_t NTPRtcStorage::getOffTime () {
+    return ESP.getResetInfoPtr ()->reason == REASON_DEEP_SLEEP_AWAKE ? NTP_OFF_TIME_UNKNOWN : 0;
+}
+
+size_t NTPRtcStorage::getStaticRamUsage () {
+    return 0; // Blocks are copied through stack
+}
+
+#elif defined ARDUINO_ARCH_ESP32
+#include <esp_sleep.h>
+
+RTC_NOINIT_ATTR static uint8_t s_rtcState[NTP_STATE_SIZE]; // Not cleared on reset or wake up
+
+bool NTPRtcStorage::load (uint8_t *data, size_t size) {
+    if (size > sizeof (s_rtcState))
+        return false;
+    memcpy (data, s_rtcState, size);
+    return true;
+}
+
+bool NTPRtcStorage::save (const uint8_t *data, size_t size) {
+    if (size > sizeof (s_rtcState))
+        return false;
+    memcpy (s_rtcState, data, size);
+    return true;
+}
+
+uint32_t NTPRtcStorage::getOffTime () {
+    return esp_sleep_get_wakeup_cause () == ESP_SLEEP_WAKEUP_UNDEFINED ? 0 : NTP_OFF_TIME_UNKNOWN;
+}
+
+size_t NTPRtcStorage::getStaticRamUsage () {
+    return sizeof (s_rtcState);
+}
+
+#endif // NETWORK_TYPE
@@ -0,0 +1,137 @@
+/*
+Copyright 2016 German Martin (gmag11@gmail.com). All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met :
+
+1. Redistributions of source code must retain the above copyright notice, this list of
+conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list
+of conditions and the following disclaimer in the documentation and / or other materials
+provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ''AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL <COPYRIGHT HOLDER> OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT(INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those of the
+authors and should not be interpreted as representing official policies, either expressed
+or implied, of German Martin
+*/
+/*
+ Name:		NTPStorage.h
+ Author:	Germán Martín (gmag11@gmail.com)
+ Maintainer:Germán Martín (gmag11@gmail.com)
+
+ Persistent storage for sync state, so that time is available right after reboot. Included from
+ NtpClientLib.h once NETWORK_TYPE has been selected.
+*/
+
+#ifndef _NTPStorage_h
+#define _NTPStorage_h
+
+#define NTP_STATE_VERSION 1 // Saved state format version
+// Saved state size: header, time, error, drift, server addresses and checksum. Multiple of 4 bytes
+#define NTP_STATE_SIZE (32 + 8 * NTP_MAX_SERVERS)
+#ifndef NTP_STATE_SAVE_INTERVAL
+#define NTP_STATE_SAVE_INTERVAL 600 // Default time between state saves from loop (), in seconds
+#endif
+#define NTP_OFF_TIME_UNKNOWN 0xFFFFFFFF // Time device was stopped cannot be told, so restored time has no error bound
+
+/**
+* Storage that keeps NTPClient state across reboots: RTC memory, EEPROM, flash or a file. State is an opaque
+* block of NTP_STATE_SIZE bytes, with its own version and checksum, so storage only has to keep it.
+*/
+class NTPStorage {
+public:
+    virtual ~NTPStorage () {}
+
+    /**
+    * Reads saved state.
+    * @param[out] Buffer to copy state into.
+    * @param[in] State size.
+    * @param[out] true if state could be read. It is validated afterwards.
+    */
+    virtual bool load (uint8_t *data, size_t size) = 0;
+
+    /**
+    * Writes state.
+    * @param[in] State.
+    * @param[in] State size.
+    * @param[out] true if state was written.
+    */
+    virtual bool save (const uint8_t *data, size_t size) = 0;
+
+    /**
+    * Gets time passed since state was last saved, measured by a clock that keeps running while device
+    * is off, like a battery backed RTC or file modification time.
+    * @param[out] Time in milliseconds.
+    * @param[out] true if it is known. Default implementation cannot tell.
+    */
+    virtual bool getTimeSinceSave (uint64_t &/* ms */) { return false; }
+
+    /**
+    * Gets time device was stopped between boot and the run that saved state, when storage can tell it,
+    * like RTC memory after a plain reset.
+    * @param[out] Time in milliseconds. NTP_OFF_TIME_UNKNOWN if it cannot be told.
+    */
+    virtual uint32_t getOffTime () { return NTP_OFF_TIME_UNKNOWN; }
+};
+
+#if NETWORK_TYPE == NETWORK_POSIX
+/**
+* State kept in a file. It is written to a temporary file first and then renamed, so a crash while
+* saving never leaves a truncated state.
+*/
+class NTPFileStorage : public NTPStorage {
+public:
+    /**
+    * Construct file storage.
+    * @param[in] File path. It has to be kept alive while storage is used.
+    */
+    NTPFileStorage (const char *path) : _path (path) {}
+
+    bool load (uint8_t *data, size_t size);
+    bool save (const uint8_t *data, size_t size);
+    bool getTimeSinceSave (uint64_t &ms); // From file modification time and system clock
+
+protected:
+    const char *_path;          ///< File path
+};
+#elif defined ARDUINO_ARCH_ESP8266 || defined ARDUINO_ARCH_ESP32
+/**
+* State kept in RTC memory, that survives resets and deep sleep but not power loss. Writing it does not
+* wear flash, so state can be saved often.
+*/
+class NTPRtcStorage : public NTPStorage {
+public:
+    /**
+    * Construct RTC memory storage.
+    * @param[in] Offset in RTC user memory, in 4 byte blocks. Only used on ESP8266, where sketch may use RTC memory too.
+    */
+    NTPRtcStorage (uint32_t offset = 0) : _offset (offset) {}
+
+    bool load (uint8_t *data, size_t size);
+    bool save (const uint8_t *data, size_t size);
+    uint32_t getOffTime (); // 0 after a reset. Unknown after deep sleep, whose duration sketch knows
+
+    /**
+    * Gets memory reserved for state, shared by all instances. On ESP32 it is a buffer in RTC memory.
+    * ESP8266 uses RTC user memory, which is not reserved by library.
+    * @param[out] Size in bytes.
+    */
+    static size_t getStaticRamUsage ();
+
+protected:
+    uint32_t _offset;           ///< First RTC user memory block used
+};
+#endif // NETWORK_TYPE
+
+#endif // _NTPStorage_h
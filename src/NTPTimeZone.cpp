@@ -0,0 +1,240 @@
+/*
+Copyright 2016 German Martin (gmag11@gmail.com). All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met :
+
+1. Redistributions of source code must retain the above copyright notice, this list of
+conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list
+of conditions and the following disclaimer in the documentation and / or other materials
+provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ''AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL <COPYRIGHT HOLDER> OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT(INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those of the
+authors and should not be interpreted as representing official policies, either expressed
+or implied, of German Martin
+*/
+//
+//
+//
+
+#include "NTPTimeZone.h"
+#include "NTPCalendar.h"
+
+#define TZ_DEFAULT_RULE_TIME 7200 // Changes happen at 02:00 local time if no time is given
+#define TZ_MAX_OFFSET_HOURS 24 // POSIX limit of UTC offsets
+#define TZ_MAX_RULE_HOURS 167 // Rule times may go up to a week later, as in RFC 8536
+
+// Day of a rule in a given year, as days since 1970-01-01
+static int32_t ruleDay (const NTPTzRule_t &rule, int16_t year) {
+    int32_t firstDay = ntpDaysFromCivil (year, 1, 1);
+    switch (rule.type) {
+    case tzJulianDay:
+        return firstDay + rule.day - 1 + (ntpIsLeapYear (year) && rule.day >= 60);
+    case tzDayOfYear:
+        return firstDay + rule.day;
+    default: {
+        firstDay = ntpDaysFromCivil (year, rule.month, 1);
+        uint8_t firstWeekday = (uint8_t)((firstDay % 7 + 11) % 7); // 1970-01-01 was Thursday
+        uint8_t day = (rule.weekday + 7 - firstWeekday) % 7 + (rule.week - 1) * 7;
+        uint8_t length = ntpDaysInMonth (year, rule.month);
+        if (day >= length) {
+            day -= 7; // Week 5 means last one
+        }
+        return firstDay + day;
+    }
+    }
+}
+
+NTPTimeZone::NTPTimeZone () {
+    setRules (NTP_TZ_UTC);
+}
+
+void NTPTimeZone::setRules (const NTPTzRules_t &rules) {
+    _rules = rules;
+    _fixed = !rules.hasDst;
+    _dst = false;
+    _offset = rules.stdOffset;
+    // Force update on next conversion
+    _validFrom = 1;
+    _validUntil = 0;
+}
+
+bool NTPTimeZone::setRules (const char *tz) {
+    NTPTzRules_t rules;
+    if (!parse (tz, rules))
+        return false;
+    setRules (rules);
+    return true;
+}
+
+void NTPTimeZone::update (time_t utc) {
+    // Changes of previous, current and next year surely enclose given instant
+    int16_t year = ntpYearFromDays (ntpDaysFromTime (utc));
+    int64_t previous = 0;
+    int64_t next = 0;
+    bool found = false;
+    bool foundNext = false;
+    bool dst = false;
+    for (int16_t y = year - 1; y <= year + 1; y++) {
+        int64_t changes[2] = {
+            (int64_t)ruleDay (_rules.dstStart, y) * NTP_SECS_PER_DAY + _rules.dstStart.time - _rules.stdOffset,
+            (int64_t)ruleDay (_rules.dstEnd, y) * NTP_SECS_PER_DAY + _rules.dstEnd.time - _rules.dstOffset
+        };
+        for (int i = 0; i < 2; i++) {
+            if (changes[i] <= (int64_t)utc) {
+                if (!found || changes[i] >= previous) { // On ties, later rule wins: DST all year if end meets next start
+                    previous = changes[i];
+                    dst = i == 0;
+                    found = true;
+                }
+            } else if (!foundNext || changes[i] < next) {
+                next = changes[i];
+                foundNext = true;
+            }
+        }
+    }
+    _dst = dst;
+    _offset = dst ? _rules.dstOffset : _rules.stdOffset;
+    _validFrom = previous;
+    _validUntil = next;
+}
+
+time_t NTPTimeZone::toUtc (time_t local) {
+    if (_fixed)
+        return local - _rules.stdOffset;
+    time_t utc = local - _rules.dstOffset;
+    if (isDst (utc))
+        return utc;
+    return local - _rules.stdOffset;
+}
+
+// Name: alphabetic, at least 3 characters, or any characters between < and >
+static const char* parseName (const char *p) {
+    if (*p == '<') {
+        while (*p && *p != '>') {
+            p++;
+        }
+        return *p ? p + 1 : NULL;
+    }
+    const char *start = p;
+    while ((*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z')) {
+        p++;
+    }
+    return p - start >= 3 ? p : NULL;
+}
+
+// Number with at most maxDigits digits
+static const char* parseNumber (const char *p, int32_t &value, uint8_t maxDigits) {
+    uint8_t digits = 0;
+    value = 0;
+    while (*p >= '0' && *p <= '9' && digits < maxDigits) {
+        value = value * 10 + (*p++ - '0');
+        digits++;
+    }
+    return digits ? p : NULL;
+}
+
+// [+|-]hh[:mm[:ss]], as seconds
+static const char* parseTime (const char *p, int32_t &seconds, int32_t maxHours) {
+    int32_t sign = 1;
+    if (*p == '+' || *p == '-') {
+        sign = *p == '-' ? -1 : 1;
+        p++;
+    }
+    int32_t value;
+    p = parseNumber (p, value, 3);
+    if (!p || value > maxHours)
+        return NULL;
+    seconds = value * 3600;
+    for (int32_t unit = 60; unit >= 1 && *p == ':'; unit /= 60) {
+        p = parseNumber (p + 1, value, 2);
+        if (!p || value > 59)
+            return NULL;
+        seconds += value * unit;
+    }
+    seconds *= sign;
+    return p;
+}
+
+// Mm.w.d, Jn or n, followed by optional /time
+static const char* parseRule (const char *p, NTPTzRule_t &rule) {
+    int32_t value;
+    rule.month = 1;
+    rule.week = 1;
+    rule.weekday = 0;
+    rule.day = 0;
+    rule.time = TZ_DEFAULT_RULE_TIME;
+    if (*p == 'M') {
+        rule.type = tzMonthWeekDay;
+        if (!(p = parseNumber (p + 1, value, 2)) || value < 1 || value > 12 || *p != '.')
+            return NULL;
+        rule.month = value;
+        if (!(p = parseNumber (p + 1, value, 1)) || value < 1 || value > 5 || *p != '.')
+            return NULL;
+        rule.week = value;
+        if (!(p = parseNumber (p + 1, value, 1)) || value > 6)
+            return NULL;
+        rule.weekday = value;
+    } else if (*p == 'J') {
+        rule.type = tzJulianDay;
+        if (!(p = parseNumber (p + 1, value, 3)) || value < 1 || value > 365)
+            return NULL;
+        rule.day = value;
+    } else {
+        rule.type = tzDayOfYear;
+        if (!(p = parseNumber (p, value, 3)) || value > 365)
+            return NULL;
+        rule.day = value;
+    }
+    if (*p == '/')
+        p = parseTime (p + 1, rule.time, TZ_MAX_RULE_HOURS);
+    return p;
+}
+
+bool NTPTimeZone::parse (const char *tz, NTPTzRules_t &rules) {
+    if (!tz)
+        return false;
+    const char *p = parseName (tz);
+    int32_t offset;
+    if (!p || !(p = parseTime (p, offset, TZ_MAX_OFFSET_HOURS)))
+        return false;
+    rules.stdOffset = -offset; // POSIX offsets are positive west of Greenwich
+    rules.dstOffset = rules.stdOffset;
+    rules.hasDst = false;
+    rules.dstStart = ntpTzRule (1, 1, 0, 0);
+    rules.dstEnd = ntpTzRule (1, 1, 0, 0);
+    if (!*p)
+        return true;
+
+    if (!(p = parseName (p)))
+        return false;
+    rules.hasDst = true;
+    rules.dstOffset = rules.stdOffset + 3600;
+    if (*p && *p != ',') {
+        if (!(p = parseTime (p, offset, TZ_MAX_OFFSET_HOURS)))
+            return false;
+        rules.dstOffset = -offset;
+    }
+    if (!*p) {
+        rules.dstStart = NTP_TZ_US_EASTERN.dstStart;
+        rules.dstEnd = NTP_TZ_US_EASTERN.dstEnd;
+        return true;
+    }
+    if (*p != ',' || !(p = parseRule (p + 1, rules.dstStart)))
+        return false;
+    if (*p != ',' || !(p = parseRule (p + 1, rules.dstEnd)))
+        return false;
+    return !*p;
+}
@@ -0,0 +1,187 @@
+/*
+Copyright 2016 German Martin (gmag11@gmail.com). All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met :
+
+1. Redistributions of source code must retain the above copyright notice, this list of
+conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list
+of conditions and the following disclaimer in the documentation and / or other materials
+provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ''AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL <COPYRIGHT HOLDER> OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT(INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those of the
+authors and should not be interpreted as representing official policies, either expressed
+or implied, of German Martin
+*/
+/*
+ Name:		NTPTimeZone.h
+ Author:	Germán Martín (gmag11@gmail.com)
+ Maintainer:Germán Martín (gmag11@gmail.com)
+
+ Time zone and daylight saving rules, as described by POSIX TZ variable.
+*/
+
+#ifndef _NTPTimeZone_h
+#define _NTPTimeZone_h
+
+#include <stdint.h>
+#include <time.h>
+
+typedef enum {
+    tzMonthWeekDay, // Mm.w.d: day d (0 = Sunday) of week w (5 = last) of month m
+    tzJulianDay, // Jn: day n of year (1 to 365). February 29th is never counted
+    tzDayOfYear // n: zero based day of year (0 to 365). February 29th is counted in leap years
+} NTPTzRuleType_t;
+
+typedef struct {
+    uint8_t type;               ///< Date format, one of NTPTzRuleType_t
+    uint8_t month;              ///< Month (1 to 12), for tzMonthWeekDay
+    uint8_t week;               ///< Week of month (1 to 5, 5 = last), for tzMonthWeekDay
+    uint8_t weekday;            ///< Day of week (0 = Sunday), for tzMonthWeekDay
+    uint16_t day;               ///< Day of year, for tzJulianDay and tzDayOfYear
+    int32_t time;               ///< Local time of change, in seconds after midnight. Current offset applies
+} NTPTzRule_t;
+
+typedef struct {
+    int32_t stdOffset;          ///< Standard time offset from UTC in seconds, positive east of Greenwich
+    int32_t dstOffset;          ///< Daylight saving time offset from UTC in seconds
+    bool hasDst;                ///< This zone has daylight saving time
+    NTPTzRule_t dstStart;       ///< Change from standard to daylight saving time, in standard local time
+    NTPTzRule_t dstEnd;         ///< Change from daylight saving to standard time, in daylight saving local time
+} NTPTzRules_t;
+
+/**
+* Builds a Mm.w.d rule at compile time.
+* @param[in] Month (1 to 12).
+* @param[in] Week of month (1 to 5, 5 = last).
+* @param[in] Day of week (0 = Sunday).
+* @param[in] Local time of change, in seconds after midnight.
+*/
+constexpr NTPTzRule_t ntpTzRule (uint8_t month, uint8_t week, uint8_t weekday, int32_t time) {
+    return { tzMonthWeekDay, month, week, weekday, 0, time };
+}
+
+// Rule tables for common zones. Being constexpr they need no parsing nor RAM until they are set
+constexpr NTPTzRules_t NTP_TZ_UTC = { 0, 0, false, ntpTzRule (1, 1, 0, 0), ntpTzRule (1, 1, 0, 0) };
+constexpr NTPTzRules_t NTP_TZ_WET = { 0, 3600, true, ntpTzRule (3, 5, 0, 3600), ntpTzRule (10, 5, 0, 7200) }; // GMT0BST,M3.5.0/1,M10.5.0
+constexpr NTPTzRules_t NTP_TZ_CET = { 3600, 7200, true, ntpTzRule (3, 5, 0, 7200), ntpTzRule (10, 5, 0, 10800) }; // CET-1CEST,M3.5.0,M10.5.0/3
+constexpr NTPTzRules_t NTP_TZ_EET = { 7200, 10800, true, ntpTzRule (3, 5, 0, 10800), ntpTzRule (10, 5, 0, 14400) }; // EET-2EEST,M3.5.0/3,M10.5.0/4
+constexpr NTPTzRules_t NTP_TZ_US_EASTERN = { -18000, -14400, true, ntpTzRule (3, 2, 0, 7200), ntpTzRule (11, 1, 0, 7200) }; // EST5EDT,M3.2.0,M11.1.0
+constexpr NTPTzRules_t NTP_TZ_US_CENTRAL = { -21600, -18000, true, ntpTzRule (3, 2, 0, 7200), ntpTzRule (11, 1, 0, 7200) }; // CST6CDT,M3.2.0,M11.1.0
+constexpr NTPTzRules_t NTP_TZ_US_MOUNTAIN = { -25200, -21600, true, ntpTzRule (3, 2, 0, 7200), ntpTzRule (11, 1, 0, 7200) }; // MST7MDT,M3.2.0,M11.1.0
+constexpr NTPTzRules_t NTP_TZ_US_PACIFIC = { -28800, -25200, true, ntpTzRule (3, 2, 0, 7200), ntpTzRule (11, 1, 0, 7200) }; // PST8PDT,M3.2.0,M11.1.0
+constexpr NTPTzRules_t NTP_TZ_AU_EASTERN = { 36000, 39600, true, ntpTzRule (10, 1, 0, 7200), ntpTzRule (4, 1, 0, 10800) }; // AEST-10AEDT,M10.1.0,M4.1.0/3
+constexpr NTPTzRules_t NTP_TZ_AU_CENTRAL = { 34200, 37800, true, ntpTzRule (10, 1, 0, 7200), ntpTzRule (4, 1, 0, 10800) }; // ACST-9:30ACDT,M10.1.0,M4.1.0/3
+
+/**
+* Converts UTC time to local time following a set of time zone rules. Instants when offset
+* changes are calculated once and cached, so conversion is usually just a comparison and an addition.
+*/
+class NTPTimeZone {
+public:
+    /**
+    * Construct time zone. UTC until rules are set.
+    */
+    NTPTimeZone ();
+
+    /**
+    * Sets time zone rules.
+    * @param[in] Rules, for instance one of NTP_TZ_* tables.
+    */
+    void setRules (const NTPTzRules_t &rules);
+
+    /**
+    * Sets time zone rules from a POSIX TZ string, like "EST5EDT,M3.2.0,M11.1.0" or "<+0330>-3:30".
+    * If a daylight saving zone name is given without rules, current US rules are used.
+    * @param[in] TZ string.
+    * @param[out] true if string was valid. Rules are not changed otherwise.
+    */
+    bool setRules (const char *tz);
+
+    /**
+    * Gets current rules.
+    */
+    const NTPTzRules_t& getRules () { return _rules; }
+
+    /**
+    * Parses a POSIX TZ string.
+    * @param[in] TZ string.
+    * @param[out] Parsed rules.
+    * @param[out] true if string was valid.
+    */
+    static bool parse (const char *tz, NTPTzRules_t &rules);
+
+    /**
+    * Converts UTC to local time.
+    * @param[in] UTC time in UNIX format.
+    * @param[out] Local time in UNIX format.
+    */
+    time_t toLocal (time_t utc) {
+        if (!_fixed && (utc < _validFrom || utc >= _validUntil))
+            update (utc);
+        return utc + _offset;
+    }
+
+    /**
+    * Converts local time to UTC. During the hour that is repeated when daylight saving time ends,
+    * daylight saving time is assumed.
+    * @param[in] Local time in UNIX format.
+    * @param[out] UTC time in UNIX format.
+    */
+    time_t toUtc (time_t local);
+
+    /**
+    * Gets offset from UTC that applies at a given instant.
+    * @param[in] UTC time in UNIX format.
+    * @param[out] Offset in seconds, daylight saving included.
+    */
+    int32_t getOffset (time_t utc) { return toLocal (utc) - utc; }
+
+    /**
+    * Checks if daylight saving time applies at a given instant.
+    * @param[in] UTC time in UNIX format.
+    * @param[out] true if daylight saving time applies.
+    */
+    bool isDst (time_t utc) {
+        toLocal (utc);
+        return _dst;
+    }
+
+    /**
+    * Gets next instant when offset changes.
+    * @param[in] UTC time in UNIX format.
+    * @param[out] UTC time of next change. 0 if zone has no daylight saving time.
+    */
+    time_t getNextTransition (time_t utc) {
+        toLocal (utc);
+        return _fixed ? 0 : _validUntil;
+    }
+
+protected:
+    NTPTzRules_t _rules;        ///< Current rules
+    bool _fixed = true;         ///< Offset never changes
+    bool _dst = false;          ///< Daylight saving time applies in cached period
+    int32_t _offset = 0;        ///< Offset that applies in cached period, in seconds
+    time_t _validFrom = 0;      ///< First UTC second of cached period
+    time_t _validUntil = 0;     ///< First UTC second after cached period
+
+    /**
+    * Calculates period around given instant where offset does not change.
+    * @param[in] UTC time in UNIX format.
+    */
+    void update (time_t utc);
+};
+
+#endif // _NTPTimeZone_h
@@ -0,0 +1,282 @@
+/*
+Copyright 2016 German Martin (gmag11@gmail.com). All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met :
+
+1. Redistributions of source code must retain the above copyright notice, this list of
+conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list
+of conditions and the following disclaimer in the documentation and / or other materials
+provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ''AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL <COPYRIGHT HOLDER> OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT(INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those of the
+authors and should not be interpreted as representing official policies, either expressed
+or implied, of German Martin
+*/
+//
+//
+//
+
+#include "NtpClientLib.h"
+
+#if NETWORK_TYPE == NETWORK_POSIX
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+
+bool NTPPosixTransport::open (uint16_t port, bool shared) {
+    stop ();
+    _socket = socket (AF_INET, SOCK_DGRAM, 0);
+    if (_socket < 0)
+        return false;
+    fcntl (_socket, F_SETFL, fcntl (_socket, F_GETFL, 0) | O_NONBLOCK);
+    int enable = 1;
+    if (shared)
+        setsockopt (_socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof (enable));
+
+    struct sockaddr_in local;
+    memset (&local, 0, sizeof (local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl (INADDR_ANY);
+    local.sin_port = htons (port);
+    if (bind (_socket, (struct sockaddr *)&local, sizeof (local)) < 0) {
+        if (shared) {
+            stop (); // Group traffic only arrives to its port
+            return false;
+        }
+        // Privileged port or already in use. Any port is valid for a client
+        local.sin_port = 0;
+        if (bind (_socket, (struct sockaddr *)&local, sizeof (local)) < 0) {
+            stop ();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool NTPPosixTransport::begin (uint16_t port) {
+    return open (port, false);
+}
+
+bool NTPPosixTransport::beginMulticast (const IPAddress &group, uint16_t port) {
+    if (!open (port, true))
+        return false;
+    struct ip_mreq request;
+    memset (&request, 0, sizeof (request));
+    request.imr_multiaddr.s_addr = (uint32_t)group;
+    request.imr_interface.s_addr = htonl (INADDR_ANY);
+    if (setsockopt (_socket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &request, sizeof (request)) < 0) {
+        stop ();
+        return false;
+    }
+    return true;
+}
+
+void NTPPosixTransport::stop () {
+    if (_socket >= 0) {
+        close (_socket);
+        _socket = -1;
+    }
+}
+
+uint8_t NTPPosixTransport::resolve (const char* name, IPAddress *addresses, uint8_t max) {
+    struct addrinfo hints;
+    struct addrinfo *result;
+    memset (&hints, 0, sizeof (hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo (name, NULL, &hints, &result) != 0)
+        return 0;
+
+    // Resolver gets every address record, so a pool name fills all slots on a single lookup
+    uint8_t count = 0;
+    for (struct addrinfo *info = result; info && count < max; info = info->ai_next) {
+        IPAddress address (((struct sockaddr_in *)info->ai_addr)->sin_addr.s_addr);
+        bool known = false;
+        for (int i = 0; i < count; i++) {
+            known = known || addresses[i] == address;
+        }
+        if (!known)
+            addresses[count++] = address;
+    }
+    freeaddrinfo (result);
+    return count;
+}
+
+bool NTPPosixTransport::send (const IPAddress &address, uint16_t port, const uint8_t *buffer, size_t length) {
+    if (_socket < 0)
+        return false;
+    struct sockaddr_in remote;
+    memset (&remote, 0, sizeof (remote));
+    remote.sin_family = AF_INET;
+    remote.sin_addr.s_addr = (uint32_t)address;
+    remote.sin_port = htons (port);
+    return sendto (_socket, buffer, length, 0, (struct sockaddr *)&remote, sizeof (remote)) == (ssize_t)length;
+}
+
+int NTPPosixTransport::receive (uint8_t *buffer, size_t length, IPAddress &address, uint16_t &port) {
+    if (_socket < 0)
+        return 0;
+    struct sockaddr_in remote;
+    socklen_t remoteLength = sizeof (remote);
+    // MSG_TRUNC makes recvfrom return real datagram length even if it does not fit into buffer
+    ssize_t size = recvfrom (_socket, buffer, length, MSG_TRUNC, (struct sockaddr *)&remote, &remoteLength);
+    if (size <= 0)
+        return 0; // Nothing received. Socket is non blocking
+    address = IPAddress (remote.sin_addr.s_addr);
+    port = ntohs (remote.sin_port);
+    return size;
+}
+
+void NTPPosixTransport::wait (uint32_t ms) {
+    if (_socket < 0) {
+        delay (ms);
+        return;
+    }
+    struct pollfd descriptor = { _socket, POLLIN, 0 };
+    poll (&descriptor, 1, ms);
+}
+
+#else
+
+#if NETWORK_TYPE == NETWORK_ESP8266 || NETWORK_TYPE == NETWORK_ESP32
+#include <lwip/init.h>
+#include <lwip/dns.h>
+#if NETWORK_TYPE == NETWORK_ESP32
+#include <lwip/tcpip.h>
+#endif
+#if LWIP_VERSION_MAJOR == 1
+#define ip_2_ip4(ipaddr) (ipaddr)
+#endif
+
+// lwIP calls back from its own context, maybe after transport has been destroyed or lookup abandoned.
+// Result is kept here, tagged with lookup number, so that late answers are discarded
+static char s_dnsName[NTP_SERVER_NAME_SIZE]; // Name being looked up
+static bool s_dnsPending = false;           // Lookup has been started and its result not taken yet
+static volatile uint32_t s_dnsLookup = 0;   // Number of current lookup
+static volatile bool s_dnsDone = false;     // Callback has been called for current lookup
+static volatile uint32_t s_dnsAddress = 0;  // Address found. 0 if name could not be resolved
+
+#if LWIP_VERSION_MAJOR == 1
+static void dnsFound (const char * /* name */, ip_addr_t *ipaddr, void *arg) {
+#else
+static void dnsFound (const char * /* name */, const ip_addr_t *ipaddr, void *arg) {
+#endif
+    if ((uint32_t)(uintptr_t)arg != s_dnsLookup)
+        return;
+    s_dnsAddress = ipaddr ? ip4_addr_get_u32 (ip_2_ip4 (ipaddr)) : 0;
+    s_dnsDone = true;
+}
+
+int NTPUdpTransport::resolveAsync (const char* name, IPAddress *addresses, uint8_t max) {
+    if (!max)
+        return 0;
+    if (strlen (name) >= sizeof (s_dnsName))
+        return resolve (name, addresses, max);
+    if (s_dnsPending && !strcmp (name, s_dnsName)) {
+        if (!s_dnsDone)
+            return NTP_RESOLVE_PENDING;
+        s_dnsPending = false;
+        addresses[0] = IPAddress (s_dnsAddress);
+        return s_dnsAddress ? 1 : 0;
+    }
+    strcpy (s_dnsName, name);
+    s_dnsDone = false;
+    s_dnsLookup = s_dnsLookup + 1;
+    ip_addr_t address;
+#if NETWORK_TYPE == NETWORK_ESP32
+    LOCK_TCPIP_CORE (); // Resolver belongs to lwIP task
+#endif
+    // Literal addresses and cached names are answered right away
+    err_t err = dns_gethostbyname (name, &address, dnsFound, (void *)(uintptr_t)s_dnsLookup);
+#if NETWORK_TYPE == NETWORK_ESP32
+    UNLOCK_TCPIP_CORE ();
+#endif
+    s_dnsPending = err == ERR_INPROGRESS;
+    if (s_dnsPending)
+        return NTP_RESOLVE_PENDING;
+    if (err != ERR_OK)
+        return 0;
+    addresses[0] = IPAddress (ip4_addr_get_u32 (ip_2_ip4 (&address)));
+    return 1;
+}
+
+size_t NTPUdpTransport::getStaticRamUsage () {
+    return sizeof (s_dnsName) + sizeof (s_dnsPending) + sizeof (s_dnsLookup) + sizeof (s_dnsDone) + sizeof (s_dnsAddress);
+}
+#endif // NETWORK_TYPE
+
+bool NTPUdpTransport::begin (uint16_t port) {
+    if (!_udp)
+        return false;
+    return _udp->begin (port) == 1;
+}
+
+bool NTPUdpTransport::beginMulticast (const IPAddress &group, uint16_t port) {
+    if (!_udp)
+        return false;
+    // Multicast is not part of UDP interface. Every board class has its own signature
+#if NETWORK_TYPE == NETWORK_ESP8266
+    return ((WiFiUDP *)_udp)->beginMulticast (WiFi.localIP (), group, port) == 1;
+#elif NETWORK_TYPE == NETWORK_W5100
+    return ((EthernetUDP *)_udp)->beginMulticast (group, port) == 1;
+#else
+    return ((WiFiUDP *)_udp)->beginMulticast (group, port) == 1;
+#endif
+}
+
+void NTPUdpTransport::stop () {
+    if (_udp)
+        _udp->stop ();
+}
+
+uint8_t NTPUdpTransport::resolve (const char* name, IPAddress *addresses, uint8_t max) {
+    if (!max)
+        return 0;
+    // Arduino resolvers return only first address record
+#if NETWORK_TYPE == NETWORK_W5100
+    DNSClient dns;
+    dns.begin (Ethernet.dnsServerIP ());
+    return dns.getHostByName (name, addresses[0]) == 1 ? 1 : 0;
+#else
+    return WiFi.hostByName (name, addresses[0]) == 1 ? 1 : 0;
+#endif
+}
+
+bool NTPUdpTransport::send (const IPAddress &address, uint16_t port, const uint8_t *buffer, size_t length) {
+    if (!_udp)
+        return false;
+    if (!_udp->beginPacket (address, port))
+        return false;
+    _udp->write (buffer, length);
+    return _udp->endPacket () == 1;
+}
+
+int NTPUdpTransport::receive (uint8_t *buffer, size_t length, IPAddress &address, uint16_t &port) {
+    if (!_udp)
+        return 0;
+    int size = _udp->parsePacket ();
+    if (size <= 0)
+        return 0;
+    _udp->read (buffer, (size_t)size < length ? size : length); // Rest of packet is discarded by next parsePacket ()
+    address = _udp->remoteIP ();
+    port = _udp->remotePort ();
+    return size;
+}
+
+#endif // NETWORK_TYPE
@@ -0,0 +1,235 @@
+/*
+Copyright 2016 German Martin (gmag11@gmail.com). All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met :
+
+1. Redistributions of source code must retain the above copyright notice, this list of
+conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list
+of conditions and the following disclaimer in the documentation and / or other materials
+provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ''AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL <COPYRIGHT HOLDER> OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT(INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those of the
+authors and should not be interpreted as representing official policies, either expressed
+or implied, of German Martin
+*/
+/*
+ Name:		NTPTransport.h
+ Author:	Germán Martín (gmag11@gmail.com)
+ Maintainer:Germán Martín (gmag11@gmail.com)
+
+ Network and clock interfaces used by NTPClient. Included from NtpClientLib.h once
+ NETWORK_TYPE has been selected.
+*/
+
+#ifndef _NTPTransport_h
+#define _NTPTransport_h
+
+#define NTP_RESOLVE_PENDING -1 // Returned by NTPTransport::resolveAsync () while lookup is in progress
+
+/**
+* Datagram transport used to talk to NTP servers. NTPClient only uses this interface, so it can run
+* over any network stack that is able to send and receive UDP packets.
+*/
+class NTPTransport {
+public:
+    virtual ~NTPTransport () {}
+
+    /**
+    * Opens socket.
+    * @param[in] Local port. Implementations may fall back to any free port if it cannot be used.
+    * @param[out] true if socket is ready.
+    */
+    virtual bool begin (uint16_t port) = 0;
+
+    /**
+    * Opens socket and joins a multicast group, to receive packets sent to that group as well.
+    * @param[in] Multicast group address.
+    * @param[in] Local port.
+    * @param[out] true if socket is ready and group has been joined. Default implementation does not support multicast.
+    */
+    virtual bool beginMulticast (const IPAddress &/* group */, uint16_t /* port */) { return false; }
+
+    /**
+    * Closes socket.
+    */
+    virtual void stop () = 0;
+
+    /**
+    * Resolves a host name or IP address string.
+    * @param[in] Host name.
+    * @param[out] Array to store addresses into.
+    * @param[in] Array size.
+    * @param[out] Number of addresses found. 0 if name could not be resolved.
+    */
+    virtual uint8_t resolve (const char* name, IPAddress *addresses, uint8_t max) = 0;
+
+    /**
+    * Starts resolving a host name, or checks lookup started by a previous call for the same name. Only one
+    * lookup is tracked, a call with another name abandons it. Default implementation calls resolve (), so it
+    * blocks until lookup ends.
+    * @param[in] Host name.
+    * @param[out] Array to store addresses into.
+    * @param[in] Array size.
+    * @param[out] Number of addresses found. 0 if name could not be resolved, NTP_RESOLVE_PENDING while lookup is in progress.
+    */
+    virtual int resolveAsync (const char* name, IPAddress *addresses, uint8_t max) { return resolve (name, addresses, max); }
+
+    /**
+    * Sends a datagram.
+    * @param[in] Destination address.
+    * @param[in] Destination port.
+    * @param[in] Data to send.
+    * @param[in] Data length.
+    * @param[out] true if packet was sent.
+    */
+    virtual bool send (const IPAddress &address, uint16_t port, const uint8_t *buffer, size_t length) = 0;
+
+    /**
+    * Gets next received datagram, if any. Never blocks.
+    * @param[out] Buffer to copy datagram into. Longer datagrams are truncated.
+    * @param[in] Buffer size.
+    * @param[out] Source address.
+    * @param[out] Source port.
+    * @param[out] Datagram length. 0 if nothing has been received.
+    */
+    virtual int receive (uint8_t *buffer, size_t length, IPAddress &address, uint16_t &port) = 0;
+
+    /**
+    * Waits until a datagram is received or some time passes, whatever happens first. Used by background
+    * worker, so that responses are timestamped as soon as they arrive. Default implementation just waits.
+    * @param[in] Maximum time to wait, in milliseconds.
+    */
+    virtual void wait (uint32_t ms) { delay (ms); }
+};
+
+/**
+* Time source used to measure local time. Default implementation reads millis () and micros ().
+* A different clock may be set with NTPClient::setClock () for simulation or testing. Time library
+* keeps using millis () anyway.
+*/
+class NTPClock {
+public:
+    virtual ~NTPClock () {}
+
+    /**
+    * Gets milliseconds since boot. May wrap.
+    */
+    virtual uint32_t millis () { return ::millis (); }
+
+    /**
+    * Gets microseconds since boot. May wrap.
+    */
+    virtual uint32_t micros () { return ::micros (); }
+
+    /**
+    * Gets milliseconds since boot, extended to 64 bits so that it never wraps. It must be read at
+    * least once every 49 days to notice millis () rollover. Library does it on every loop () and sync.
+    * It updates rollover count without locks, so only the thread that runs loop () may call it. Use
+    * NTPClient::getUptimeMs () on other threads.
+    */
+    uint64_t uptimeMs () {
+        uint32_t ms = millis ();
+        if (ms < _lastMillis)
+            _millisHigh++;
+        _lastMillis = ms;
+        return ((uint64_t)_millisHigh << 32) | ms;
+    }
+
+    /**
+    * Gets microseconds since boot, extended to 64 bits so that it never wraps. Same thread rules as uptimeMs ().
+    */
+    uint64_t uptimeUs () {
+        uint64_t us = uptimeMs () * 1000;
+        // Low 32 bits of micros () are more precise than millis (). Difference is always small
+        return us + (int32_t)(micros () - (uint32_t)us);
+    }
+
+protected:
+    uint32_t _lastMillis = 0;   ///< millis () value on last uptimeMs () call
+    uint32_t _millisHigh = 0;   ///< Number of millis () rollovers
+};
+
+#if NETWORK_TYPE == NETWORK_POSIX
+/**
+* Transport based on POSIX non blocking UDP sockets.
+*/
+class NTPPosixTransport : public NTPTransport {
+public:
+    bool begin (uint16_t port);
+    bool beginMulticast (const IPAddress &group, uint16_t port);
+    void stop ();
+    uint8_t resolve (const char* name, IPAddress *addresses, uint8_t max);
+    bool send (const IPAddress &address, uint16_t port, const uint8_t *buffer, size_t length);
+    int receive (uint8_t *buffer, size_t length, IPAddress &address, uint16_t &port);
+    void wait (uint32_t ms);
+
+protected:
+    /**
+    * Opens a non blocking socket bound to given port.
+    * @param[in] Local port.
+    * @param[in] true to share port with other sockets, as several multicast listeners may run on one host.
+    * @param[out] true if socket is ready.
+    */
+    bool open (uint16_t port, bool shared);
+
+    int _socket = -1;           ///< Socket descriptor. -1 if closed
+};
+#else
+/**
+* Transport based on Arduino UDP class (WiFiUDP or EthernetUDP) and board DNS resolver.
+*/
+class NTPUdpTransport : public NTPTransport {
+public:
+    /**
+    * Sets UDP instance to use.
+    * @param[in] UDP instance.
+    */
+    void setUdp (UDP *udp) { _udp = udp; }
+
+    /**
+    * Gets UDP instance in use.
+    */
+    UDP* getUdp () { return _udp; }
+
+    bool begin (uint16_t port);
+    /**
+    * Multicast needs the board UDP class (WiFiUDP or EthernetUDP), as given to NTPClient::begin ().
+    */
+    bool beginMulticast (const IPAddress &group, uint16_t port);
+    void stop ();
+    uint8_t resolve (const char* name, IPAddress *addresses, uint8_t max);
+#if NETWORK_TYPE == NETWORK_ESP8266 || NETWORK_TYPE == NETWORK_ESP32
+    /**
+    * Uses lwIP resolver, which answers from a callback. Names longer than NTP_SERVER_NAME_SIZE are resolved
+    * with blocking resolve ().
+    */
+    int resolveAsync (const char* name, IPAddress *addresses, uint8_t max);
+
+    /**
+    * Gets RAM used by lwIP lookup state, shared by all instances.
+    * @param[out] Size in bytes.
+    */
+    static size_t getStaticRamUsage ();
+#endif
+    bool send (const IPAddress &address, uint16_t port, const uint8_t *buffer, size_t length);
+    int receive (uint8_t *buffer, size_t length, IPAddress &address, uint16_t &port);
+
+protected:
+    UDP *_udp = NULL;           ///< Arduino UDP instance
+};
+#endif // NETWORK_TYPE
+
+#endif // _NTPTransport_h
@@ -39,6 +39,7 @@ or implied, of German Martin
 #define _NtpClientLib_h
 
 //#define DEBUG_NTPCLIENT //Uncomment this to enable debug messages over serial port
+//#define NTPCLIENT_NO_HEAP //Uncomment this to run on static storage only: no malloc, new or String
 
 #ifdef ESP8266
 //extern "C" {
@@ -52,7 +53,7 @@ using namespace placeholders;
 
 #include <TimeLib.h>
 
-#if defined(ARDUINO) && ARDUINO >= 100
+#if !defined(ARDUINO) || ARDUINO >= 100
 #include "Arduino.h"
 #else
 #include "WProgram.h"
@@ -63,15 +64,79 @@ using namespace placeholders;
 #define NETWORK_WIFI101			(3) // WiFi Shield 101 or MKR1000
 #define NETWORK_ESP8266			(100) // ESP8266 boards, not for Arduino using AT firmware
 #define NETWORK_ESP32           (101) // ESP32 boards
+#define NETWORK_POSIX           (200) // Linux and other POSIX hosts, using BSD sockets
 
 #define DEFAULT_NTP_SERVER "pool.ntp.org" // Default international NTP server. I recommend you to select a closer server to get better accuracy
 #define DEFAULT_NTP_PORT 123 // Default local udp port. Select a different one if neccesary (usually not needed)
+#define DEFAULT_NTP_SERVER_PORT 123 // Default udp port that servers listen on
 #define NTP_TIMEOUT 1500 // Response timeout for NTP requests
-#define DEFAULT_NTP_INTERVAL 1800 // Default sync interval 30 minutes 
-#define DEFAULT_NTP_SHORTINTERVAL 15 // Sync interval when sync has not been achieved. 15 seconds
+#define DEFAULT_NTP_INTERVAL 1800 // Default maximum sync interval 30 minutes
+#define DEFAULT_NTP_SHORTINTERVAL 15 // Default minimum sync interval, used when sync has not been achieved. 15 seconds
 #define DEFAULT_NTP_TIMEZONE 0 // Select your local time offset. 0 if UTC time has to be used
+#ifndef NTP_MAX_SERVERS
+#define NTP_MAX_SERVERS 3 // Maximum number of NTP servers queried on every sync
+#endif
+#define NTP_MIN_CLUSTER 3 // Clustering stops discarding servers when this number of survivors is reached
+#ifndef NTP_DNS_ADDRESSES
+#define NTP_DNS_ADDRESSES 4 // Number of addresses cached for every server name
+#endif
+#ifndef NTP_SERVER_NAME_SIZE
+#define NTP_SERVER_NAME_SIZE 48 // Maximum server name length, including null terminator. Only used with NTPCLIENT_NO_HEAP
+#endif
+#define NTP_DNS_TTL 3600 // Time that resolved addresses are kept before resolving server name again, in seconds
+#define NTP_STEP_THRESHOLD 128000 // Offsets above this value (in microseconds) are clock steps, not used to estimate drift
+#define NTP_MAX_DRIFT 500 // Maximum oscillator frequency error that can be corrected, in ppm
+#define NTP_SLEW_RATE 500 // Frequency correction used to slew clock offsets, in ppm. 128 ms take 256 s to be absorbed
+#define NTP_SLEW_MAX_THRESHOLD 1000 // Largest offset that may be slewed, in milliseconds
+#define NTP_FLL_TIME 256 // Sync intervals shorter than this (in seconds) get lower weight on drift estimation
+#define NTP_MAX_TIMELIB_ERROR 10 // Time library is set again when it may have drifted this number of milliseconds from local clock
+#define NTP_POLL_GATE 4 // Offsets below this number of times jitter mean clock is stable
+#define NTP_MIN_JITTER 1000 // Offsets below this value (in microseconds) are always considered stable
+#define NTP_POLL_LIMIT 2 // Number of stable syncs needed to double sync interval
+#ifndef NTP_POLL_SPREAD
+#define NTP_POLL_SPREAD 10 // Random spread of every poll interval, in percent, so that devices booted together do not query together
+#endif
+#define NTP_POLL_MAX_SPREAD 50 // Largest poll interval spread, in percent
+#ifndef NTP_SERVER_BURST
+#define NTP_SERVER_BURST 8 // Maximum number of packets processed on every loop () call
+#endif
+#define NTP_SERVER_PRECISION -20 // Local clock precision sent to clients, as log2 seconds. micros () resolution
+#define NTP_MAX_DISPERSION_RATE 15 // Maximum local clock frequency error assumed since last sync, in ppm (RFC 5905 PHI)
+#define NTP_UNBOUNDED_ERROR (0xFFFFFFFFULL * 1000) // Error of restored time when off time is unknown, in microseconds
+#define NTP_MAX_DISTANCE 1500000 // Responses with larger root distance are discarded, in microseconds (RFC 5905 MAXDIST)
+#define NTP_KOD_BACKOFF 64 // Time a server is not queried after asking to reduce rate (RATE kiss code), in seconds. Doubles on every repeated one
+#ifndef NTP_BURST_COUNT
+#define NTP_BURST_COUNT 4 // Request rounds sent on first sync. Best sample of every server is used
+#endif
+#define NTP_BURST_MAX 8 // Maximum number of request rounds on first sync
+#define NTP_BURST_SPACING 2000 // Default time between burst rounds, in milliseconds. Public servers rate limit faster requests
+#ifndef NTP_HEDGE_PERCENTILE
+#define NTP_HEDGE_PERCENTILE 95 // A backup request is sent when response is later than this percentile of server round trip delays
+#endif
+#define NTP_HEDGE_MIN_SAMPLES 8 // Responses needed before percentile is trusted
+#define NTP_HEDGE_DELAY 500 // Backup request delay until server has enough samples, in milliseconds
+#define NTP_HEDGE_MIN_DELAY 10 // Minimum backup request delay, in milliseconds
+#define NTP_KOD_MAX_BACKOFF 86400 // Maximum backoff, also used for servers that deny access (DENY and RSTR kiss codes), in seconds
+#define NTP_WORKER_PERIOD 10 // Default time between background worker loop () runs, in milliseconds
+#ifndef NTP_WORKER_STACK
+#define NTP_WORKER_STACK 4096 // Background worker task stack size on ESP32, in bytes. Event handlers run on it
+#endif
+#ifndef NTP_WORKER_PRIORITY
+#define NTP_WORKER_PRIORITY 1 // Background worker task priority on ESP32
+#endif
+#define NTP_ANCHOR_REBASE 0x80000000UL // Local clock is set again from itself after this milliseconds, before 32 bit millis () wraps
+#ifndef NTP_EVENT_QUEUE_SIZE
+#define NTP_EVENT_QUEUE_SIZE 4 // Sync events kept until handleEvents () delivers them. Power of two, up to 128
+#endif
 
 const int NTP_PACKET_SIZE = 48; // NTP time is in the first 48 bytes of message
+#define NTP_TIME_STR_SIZE 9 // Buffer size needed for time string: hh:mm:ss
+#define NTP_DATE_STR_SIZE 11 // Buffer size needed for date string: dd/mm/yyyy
+#define NTP_TIME_DATE_STR_SIZE 20 // Buffer size needed for time and date string: hh:mm:ss dd/mm/yyyy
+#define NTP_UPTIME_STR_SIZE 20 // Buffer size needed for uptime string: dddd days hh:mm:ss
+#define NTP_ISO8601_STR_SIZE 25 // Buffer size needed for ISO 8601 UTC string: yyyy-mm-ddThh:mm:ss.sssZ
+#define NTP_RFC3339_STR_SIZE 30 // Buffer size needed for RFC 3339 local time string: yyyy-mm-ddThh:mm:ss.sss+hh:mm
+#define SEVENTY_YEARS 2208988800UL // Seconds between NTP epoch (1900) and UNIX epoch (1970)
 
 #ifdef ARDUINO_ARCH_ESP8266
 #define NETWORK_TYPE NETWORK_ESP8266
@@ -81,13 +146,15 @@ const int NTP_PACKET_SIZE = 48; // NTP time is in the first 48 bytes of message
 #define NETWORK_TYPE NETWORK_W5100
 #elif defined ARDUINO_ARCH_ESP32 || defined ESP32
 #define NETWORK_TYPE NETWORK_ESP32
+#elif !defined ARDUINO && (defined __unix__ || defined __APPLE__)
+#define NETWORK_TYPE NETWORK_POSIX
 #endif
 
 #if NETWORK_TYPE == NETWORK_W5100
 //#include <SPI.h>
 #include <EthernetUdp.h>
 #include <Ethernet.h>
-//#include <Dns.h>
+#include <Dns.h>
 //#include <Dhcp.h>
 #elif NETWORK_TYPE == NETWORK_WIFI101
 #include <WiFiClient.h>
@@ -101,21 +168,112 @@ const int NTP_PACKET_SIZE = 48; // NTP time is in the first 48 bytes of message
 #include <WiFi.h>
 #include <WiFiUdp.h>
 #include <Udp.h>
+#elif NETWORK_TYPE == NETWORK_POSIX
+// Socket headers are only needed by NTPTransport.cpp
 #else
-#error "Incorrect platform. Only ARDUINO and ESP8266 MCUs are valid."
+#error "Incorrect platform. Only ARDUINO, ESP8266, ESP32 and POSIX hosts are valid."
 #endif // NETWORK_TYPE
 
+#if (NETWORK_TYPE == NETWORK_ESP32 || NETWORK_TYPE == NETWORK_POSIX) && !defined NTPCLIENT_NO_HEAP
+#define NTPCLIENT_WORKER // Background sync worker is available, and local clock may be read from any thread
+#include <atomic>
+#if NETWORK_TYPE == NETWORK_POSIX
+#include <thread>
+#endif
+#endif
+
+#include "NTPTransport.h"
+#include "NTPTimeZone.h"
+#include "NTPCalendar.h"
+#include "NTPStats.h"
+#include "NTPStorage.h"
+
 typedef enum {
     timeSyncd, // Time successfully got from NTP server
     noResponse, // No response from server
-    invalidAddress // Address not reachable
+    invalidAddress, // Address not reachable
+    serversDisagree // Responses received but servers do not agree on current time
 } NTPSyncEvent_t;
 
-#if defined ARDUINO_ARCH_ESP8266 || defined ARDUINO_ARCH_ESP32
+typedef enum {
+    syncIdle, // No request in progress
+    syncResolving, // Resolving NTP server address before sending request
+    syncSent, // Request sent, waiting for response
+    syncReceived, // Response received and decoded
+    syncTimedOut // No response received before NTP_TIMEOUT
+} NTPSyncStatus_t;
+
+typedef struct {
+    char* name;                 ///< Server name or address. NULL if slot is not used
+    IPAddress address;          ///< Resolved server address
+    uint64_t requestTimestamp;  ///< Transmit timestamp of last request. Server copies it to response
+    uint64_t sendUs;            ///< Local clock when last request was sent, in microseconds (T1)
+    int64_t offset;             ///< Clock offset measured from last response, in microseconds
+    uint32_t delay;             ///< Round trip delay measured from last response, in microseconds
+    uint32_t distance;          ///< Maximum error of offset (root distance), in microseconds
+    uint8_t stratum;            ///< Server stratum from last response
+    uint32_t rootDelay;         ///< Server round trip delay to primary reference from last response, in microseconds
+    uint32_t rootDispersion;    ///< Server maximum error relative to primary reference from last response, in microseconds
+    uint64_t parkedUntil;       ///< Uptime in milliseconds until which server is not queried, after a Kiss-o'-Death
+    IPAddress hedgeAddress;     ///< Address backup request was sent to
+    uint64_t hedgeTimestamp;    ///< Transmit timestamp of backup request
+    uint64_t hedgeSendUs;       ///< Local clock when backup request was sent, in microseconds
+    uint8_t kods;               ///< Consecutive RATE Kiss-o'-Death responses
+    bool sent : 1;              ///< Request sent on current sync
+    bool replied : 1;           ///< Response received on current sync
+    bool hedged : 1;            ///< Backup request sent on current sync
+    uint8_t samples;            ///< Valid responses on current sync. Offset and delay are those of the one with lowest delay
+} NTPServer_t;
+
+typedef struct {
+    const char* name;           ///< Server name this entry belongs to. Points to a server slot name, NULL if entry is free
+    IPAddress addresses[NTP_DNS_ADDRESSES]; ///< Resolved addresses, used in round robin
+    uint8_t count;              ///< Number of valid addresses
+    uint8_t next;               ///< Index of next address to use
+    uint8_t used;               ///< Addresses handed out on current sync
+    bool complete;              ///< Last lookup did not return any new address. Do not look up again until entry expires
+    uint64_t resolved;          ///< Uptime in milliseconds when name was last resolved
+} NTPDnsCacheEntry_t;
+
+typedef struct {
+    NTPSyncEvent_t event;       ///< Sync result
+    int8_t server;              ///< Index of server with lowest root distance on successful sync. -1 otherwise, or if synced from broadcast
+    uint8_t stratum;            ///< Stratum of that server
+    int64_t offset;             ///< Offset applied to local clock, in microseconds
+    uint32_t delay;             ///< Round trip delay to that server, in microseconds
+    time_t time;                ///< Local time when event happened. 0 if time has never been synced
+} NTPSyncEventInfo_t;
+
+typedef struct {
+    uint64_t us;                ///< UTC time in microseconds when local clock was last set. Local clock runs from here
+    uint64_t ms;                ///< us in milliseconds
+    uint64_t ntp;               ///< us in NTP timestamp format
+    uint64_t uptimeMs;          ///< Uptime in milliseconds when local clock was last set
+    uint64_t slewEndUs;         ///< Elapsed time since local clock was set when slew is complete, in microseconds
+    uint64_t maxErrorUs;        ///< Maximum error of us, in microseconds. NTP_UNBOUNDED_ERROR if not known or time not set
+    uint64_t lastSyncMs;        ///< Uptime of last successful sync, in milliseconds. Not cleared by resetStats (). 0 equals never
+    uint32_t micros;            ///< micros() value when local clock was last set
+    int32_t drift;              ///< Local oscillator frequency correction, in 2^-32 units
+    int32_t slewUs;             ///< Correction being slewed since local clock was last set, in microseconds
+    int32_t slewRate;           ///< Frequency correction used to slew slewUs, in 2^-32 units
+    uint16_t remUs;             ///< Microseconds remainder of ms
+} NTPClockAnchor_t;
+
+#define NTP_ANCHOR_WORDS (sizeof (NTPClockAnchor_t) / sizeof (uint32_t)) // Size of published local clock state
+
+#if (defined ARDUINO_ARCH_ESP8266 || defined ARDUINO_ARCH_ESP32 || NETWORK_TYPE == NETWORK_POSIX) && !defined NTPCLIENT_NO_HEAP
 #include <functional>
 typedef std::function<void (NTPSyncEvent_t)> onSyncEvent_t;
+typedef std::function<void (const NTPSyncEventInfo_t&)> onSyncEventInfo_t;
 #else
 typedef void (*onSyncEvent_t)(NTPSyncEvent_t);
+typedef void (*onSyncEventInfo_t)(const NTPSyncEventInfo_t&);
+#endif
+
+#ifdef NTPCLIENT_NO_HEAP
+typedef const char* NTPServerNameParam_t; ///< Server names are copied to fixed size buffers
+#else
+typedef String NTPServerNameParam_t;
 #endif
 
 class NTPClient {
@@ -125,6 +283,11 @@ public:
     */
     NTPClient ();
 
+    /**
+    * Stops time synchronization and background worker, and frees server names.
+    */
+    ~NTPClient ();
+
     /**
     * Starts time synchronization.
     * @param[in] NTP server name as String.
@@ -135,66 +298,393 @@ public:
     * @param[out] true if everything went ok.
     */
 #if NETWORK_TYPE == NETWORK_W5100
-    bool begin (String ntpServerName = DEFAULT_NTP_SERVER, int8_t timeOffset = DEFAULT_NTP_TIMEZONE, bool daylight = false, int8_t minutes = 0, EthernetUDP* udp_conn = NULL);
+    bool begin (NTPServerNameParam_t ntpServerName = DEFAULT_NTP_SERVER, int8_t timeOffset = DEFAULT_NTP_TIMEZONE, bool daylight = false, int8_t minutes = 0, EthernetUDP* udp_conn = NULL);
 #elif NETWORK_TYPE == NETWORK_ESP8266 || NETWORK_TYPE == NETWORK_WIFI101 || NETWORK_TYPE == NETWORK_ESP32
-    bool begin (String ntpServerName = DEFAULT_NTP_SERVER, int8_t timeOffset = DEFAULT_NTP_TIMEZONE, bool daylight = false, int8_t minutes = 0, WiFiUDP* udp_conn = NULL);
+    bool begin (NTPServerNameParam_t ntpServerName = DEFAULT_NTP_SERVER, int8_t timeOffset = DEFAULT_NTP_TIMEZONE, bool daylight = false, int8_t minutes = 0, WiFiUDP* udp_conn = NULL);
+#elif NETWORK_TYPE == NETWORK_POSIX
+    bool begin (NTPServerNameParam_t ntpServerName = DEFAULT_NTP_SERVER, int8_t timeOffset = DEFAULT_NTP_TIMEZONE, bool daylight = false, int8_t minutes = 0, NTPTransport* transport = NULL);
 #endif
 
     /**
-    * Sets NTP server name.
+    * Sets network transport used to query servers, instead of default board UDP class.
+    * Transport given to begin () takes precedence.
+    * @param[in] Transport instance. It has to be kept alive while client is running.
+    */
+    void setTransport (NTPTransport *transport);
+
+    /**
+    * Sets clock used to measure local time, instead of millis () and micros ().
+    * @param[in] Clock instance. NULL to use default clock.
+    */
+    void setClock (NTPClock *clock);
+
+    /**
+    * Sets whether this client keeps Time library in sync. Time library holds a single clock, so only
+    * one client per program should do it. Others, like extra clients in a simulation, are read with
+    * nowUs (), nowMs () and functions that take a time argument. Call it before begin ().
+    * @param[in] true to set Time library time and sync provider. Default is true.
+    */
+    void setTimeLibSync (bool sync);
+
+    /**
+    * Gets whether this client keeps Time library in sync.
+    * @param[out] true if Time library time is set by this client.
+    */
+    bool getTimeLibSync () { return _timeLib; }
+
+    /**
+    * Sets udp port that NTP servers listen on.
+    * @param[in] Server port. 123 by default.
+    */
+    void setNtpServerPort (uint16_t port);
+
+    /**
+    * Gets udp port that NTP servers listen on.
+    * @param[out] Server port.
+    */
+    uint16_t getNtpServerPort ();
+
+    /**
+    * Sets main NTP server name.
     * @param[in] New NTP server name.
     * @param[out] True if everything went ok.
     */
-    bool setNtpServerName (String ntpServerName);
-    bool setNtpServerName (char* ntpServerName);
+#ifndef NTPCLIENT_NO_HEAP
+    bool setNtpServerName (String ntpServerName) { return setNtpServerName (ntpServerName, 0); }
+#endif
+    bool setNtpServerName (const char* ntpServerName) { return setNtpServerName (ntpServerName, 0); }
 
     /**
-    * Sets NTP server name. DEPRECATED, only for compatibility with older versions
+    * Sets NTP server name on given slot. All configured servers are queried on every sync and their
+    * responses are combined. An empty name disables that slot, except for main server (index 0).
     * @param[in] New NTP server name.
-    * @param[in] Server index (0-2).
-    * @param[out] True if everything went ok.
+    * @param[in] Server index (0 to NTP_MAX_SERVERS - 1).
+    * @param[out] True if everything went ok. False if name does not fit into NTP_SERVER_NAME_SIZE with NTPCLIENT_NO_HEAP.
     */
-    bool setNtpServerName (String ntpServerName, int idx) {
-        if (idx < 0 || idx > 2)
-            return false;
-        return setNtpServerName (ntpServerName);
-    }
+#ifndef NTPCLIENT_NO_HEAP
+    bool setNtpServerName (String ntpServerName, int idx) { return setNtpServerName (ntpServerName.c_str (), idx); }
+#endif
+    bool setNtpServerName (const char* ntpServerName, int idx);
 
     /**
-    * Gets NTP server name
+    * Gets main NTP server name
     * @param[out] NTP server name.
     */
-    String getNtpServerName ();
-    char* getNtpServerNamePtr ();
+#ifndef NTPCLIENT_NO_HEAP
+    String getNtpServerName () { return getNtpServerName (0); }
+#endif
+    char* getNtpServerNamePtr () { return _servers[0].name; }
 
+#ifndef NTPCLIENT_NO_HEAP
     /**
-    * Gets NTP server name. DEPRECATED, only for compatibility with older versions
-    * @param[in] Server index (0-2).
-    * @param[out] NTP server name.
+    * Gets NTP server name on given slot.
+    * @param[in] Server index (0 to NTP_MAX_SERVERS - 1).
+    * @param[out] NTP server name. Empty if slot is not used.
     */
-    String getNtpServerName (int idx) {
-        if (idx < 0 || idx > 2)
-            return "";
-        return getNtpServerName ();
-    }
+    String getNtpServerName (int idx);
+#endif
+
+    /**
+    * Gets NTP server name on given slot, without copying it.
+    * @param[in] Server index (0 to NTP_MAX_SERVERS - 1).
+    * @param[out] NTP server name. NULL if slot is not used.
+    */
+    const char* getNtpServerNamePtr (int idx);
 
     /**
-    * Starts a NTP time request to server. Returns a time in UNIX time format. Normally only called from library.
+    * Gets static RAM used by library: NTP object and library internal variables, that is lwIP lookup
+    * state on ESP boards and RTC memory state buffer on ESP32. Library does not use heap when built with
+    * NTPCLIENT_NO_HEAP, so this is its whole RAM footprint apart from stack and other NTPClient instances.
+    * @param[out] Size in bytes.
+    */
+    static size_t getStaticRamUsage ();
+
+    /**
+    * Advances NTP request state machine by one step. It never waits for server response: if no request is
+    * in progress a new one is sent, otherwise incoming packets are checked once. Returns a time in UNIX time
+    * format only when a response has just been decoded. Normally only called from library.
     * Kept in public section to allow direct NTP request.
-    * @param[out] Time in UNIX time format.
+    * @param[out] Time in UNIX time format. 0 if response is not available yet or request failed.
     */
     time_t getTime ();
 
     /**
-    * Sets timezone.
+    * Polls for NTP response while a request is in progress. Call it from your sketch loop() so that response
+    * is processed as soon as it arrives. If it is not called, sync is still completed by Time library calls
+    * to now(), with up to 1 second delay.
+    */
+    void loop ();
+
+    /**
+    * Keeps UDP socket open between syncs instead of opening it on every request.
+    * @param[in] true to keep socket open.
+    */
+    void setPersistentSocket (bool persistent);
+
+    /**
+    * Gets socket mode.
+    * @param[out] true if UDP socket is kept open between syncs.
+    */
+    bool getPersistentSocket ();
+
+    /**
+    * Discards all cached server addresses, so that names are resolved again on next sync.
+    */
+    void flushDnsCache ();
+
+    /**
+    * Gets current state of NTP request.
+    * @param[out] Request state.
+    */
+    NTPSyncStatus_t getSyncStatus ();
+
+    /**
+    * Gets current UTC time with microsecond resolution, interpolated from last sync with micros().
+    * Before first sync it counts from UNIX epoch at boot.
+    * @param[out] Microseconds since UNIX epoch.
+    */
+    uint64_t nowUs ();
+
+    /**
+    * Gets current UTC time with millisecond resolution, interpolated from last sync. Cheaper than nowUs ()
+    * on 8 bit MCUs as it avoids 64 bit divisions.
+    * @param[out] Milliseconds since UNIX epoch.
+    */
+    uint64_t nowMs ();
+
+    /**
+    * Gets current UTC time as a NTP timestamp, interpolated from last sync.
+    * @param[out] 32 bit seconds since 1900 in high word, 32 bit fraction of second in low word.
+    */
+    uint64_t nowNtp ();
+
+    /**
+    * Gets estimated frequency error of local oscillator. It is calculated from offsets measured on successive
+    * syncs, and local clock is corrected by this value between syncs.
+    * @param[out] Frequency error in ppm. Positive value means local oscillator is slow.
+    */
+    float getDrift ();
+
+    /**
+    * Gets clock offset measured on last successful sync, calculated from the four NTP timestamps and combined
+    * from all servers that passed selection. Positive value means local clock was behind server clock.
+    * On first sync it includes the provisional step made after first burst round.
+    * @param[out] Offset in microseconds.
+    */
+    int64_t getLastOffset ();
+
+    /**
+    * Gets round trip network delay to best server on last successful sync, excluding server processing time.
+    * @param[out] Delay in microseconds.
+    */
+    uint32_t getLastDelay ();
+
+    /**
+    * Sets timezone. If daylight saving is enabled, central European rule applies: summer time from
+    * last Sunday of March to last Sunday of October, changing at 01:00 UTC. Use setTimeZoneRules ()
+    * for any other zone.
     * @param[in] New time offset in hours (-11 <= timeZone <= +13).
     * @param[out] True if everything went ok.
     */
     bool setTimeZone (int8_t timeZone, int8_t minutes = 0);
 
+    /**
+    * Sets time zone and daylight saving rules from a POSIX TZ string, like "EST5EDT,M3.2.0,M11.1.0"
+    * or "AEST-10AEDT,M10.1.0,M4.1.0/3". Call it after begin (), as begin () sets a fixed offset.
+    * @param[in] TZ string.
+    * @param[out] True if string was valid.
+    */
+    bool setTimeZoneRules (const char *tz);
+
+    /**
+    * Sets time zone and daylight saving rules, for instance one of NTP_TZ_* tables.
+    * Call it after begin (), as begin () sets a fixed offset.
+    * @param[in] Time zone rules.
+    */
+    void setTimeZoneRules (const NTPTzRules_t &rules);
+
+    /**
+    * Gets time zone and daylight saving rules in use.
+    * @param[out] Time zone rules.
+    */
+    const NTPTzRules_t& getTimeZoneRules () { return _tz.getRules (); }
+
+    /**
+    * Starts answering SNTP requests from other devices, as a server one stratum above the one we sync
+    * with. Requests are only answered while time is synced. Client requests are sent from the same
+    * UDP socket, that is kept open. Call it after begin () and call loop () often.
+    * @param[in] Local UDP port. Requests are usually sent to port 123.
+    * @param[out] True if socket could be opened.
+    */
+    bool beginServer (uint16_t port = DEFAULT_NTP_PORT);
+
+    /**
+    * Stops answering SNTP requests.
+    */
+    void stopServer ();
+
+    /**
+    * Checks if SNTP server is running.
+    * @param[out] True if requests are being answered.
+    */
+    bool isServing () { return _serving; }
+
+    /**
+    * Follows NTP broadcast (mode 5) packets instead of polling servers. Delay to broadcaster is measured
+    * once with a unicast request, then every broadcast received sets local clock and nothing else is sent.
+    * Only first broadcaster heard is followed. Call it after begin () and call loop () often.
+    * SNTP server, if started, has to use the same port.
+    * @param[in] Local UDP port that broadcasts are sent to, usually 123.
+    * @param[in] Multicast group to join, like 224.0.1.1 (NTP). Empty address for broadcasts only.
+    * @param[out] True if socket could be opened and group joined.
+    */
+    bool beginBroadcast (uint16_t port = DEFAULT_NTP_PORT, const IPAddress &group = IPAddress ());
+
+    /**
+    * Stops following broadcasts and polls servers again.
+    */
+    void stopBroadcast ();
+
+    /**
+    * Checks if time is taken from broadcasts.
+    * @param[out] True if client follows broadcasts.
+    */
+    bool isBroadcastClient () { return _broadcastClient; }
+
+    /**
+    * Sets acquisition burst. Until time is synced for the first time, every sync sends several rounds of
+    * requests and uses the response with lowest round trip delay from every server, which has the smallest
+    * error. Time is set provisionally from first round that gets responses, so it is valid within one round trip.
+    * @param[in] Number of rounds, 1 to NTP_BURST_MAX. 1 disables burst.
+    * @param[in] Time between end of a round and next one, in milliseconds. Use at least 2000 with public servers.
+    */
+    void setBurst (uint8_t count, uint16_t spacing = NTP_BURST_SPACING);
+
+    /**
+    * Gets number of request rounds sent on first sync.
+    * @param[out] Number of rounds.
+    */
+    uint8_t getBurst () { return _burstCount; }
+
+    /**
+    * Enables slew mode. Offsets measured after first sync that are below threshold are absorbed gradually,
+    * running local clock up to NTP_SLEW_RATE ppm faster or slower, instead of stepping it. Local clock and
+    * Time library never go backwards nor skip seconds then. Larger offsets still step the clock.
+    * @param[in] true to slew small offsets, false to always step clock.
+    * @param[in] Largest offset that is slewed, in milliseconds. Up to NTP_SLEW_MAX_THRESHOLD.
+    */
+    void setSlewMode (bool enable, uint32_t threshold = NTP_STEP_THRESHOLD / 1000);
+
+    /**
+    * Gets slew mode.
+    * @param[out] true if small offsets are slewed.
+    */
+    bool getSlewMode () { return _slewThreshold != 0; }
+
+    /**
+    * Gets offset that local clock has still to absorb, in slew mode.
+    * @param[out] Remaining correction, in microseconds. Positive if local clock is behind.
+    */
+    int32_t getSlewRemaining ();
+
+    /**
+    * Enables hedged requests: when a server has not answered within its usual round trip delay
+    * (NTP_HEDGE_PERCENTILE percentile), a backup request is sent to another address of the same server
+    * name, or to the same one if there is no other, and first valid response is used. Enabled by default.
+    * @param[in] true to send backup requests.
+    */
+    void setHedging (bool enable) { _hedging = enable; }
+
+    /**
+    * Checks if hedged requests are enabled.
+    * @param[out] true if backup requests are sent.
+    */
+    bool getHedging () { return _hedging; }
+
+    /**
+    * Sets storage where sync state is kept across reboots: time, its error, drift and server addresses.
+    * Call it before begin (), that restores saved state. State is saved from loop () after first sync
+    * and then every NTP_STATE_SAVE_INTERVAL seconds.
+    * @param[in] Storage instance, like NTPRtcStorage or NTPFileStorage. It has to be kept alive while client is running.
+    */
+    void setStorage (NTPStorage *storage) { _storage = storage; }
+
+    /**
+    * Sets time between state saves. Flash and EEPROM wear out, so use a long one there. Restored time
+    * may be wrong by up to this interval, as time running after last save is unknown.
+    * @param[in] Interval in seconds. 0 to save only when saveState () is called.
+    */
+    void setStateSaveInterval (uint32_t interval) { _saveInterval = interval; }
+
+    /**
+    * Saves sync state now, for instance just before deep sleep. Time running after this save is considered
+    * zero when state is restored.
+    * @param[out] true if time was valid and state could be written.
+    */
+    bool saveState () { return saveState (true); }
+
+    /**
+    * Restores saved sync state, if time has not been synced yet. Local clock and Time library are set right
+    * away, and time is provisional until next successful sync. begin () calls it, so it is only needed
+    * again to tell how long device was stopped.
+    * If storage keeps a clock that runs while device is off, like NTPFileStorage does, elapsed time is taken
+    * from it and offTime is ignored. Otherwise, if neither offTime nor storage tell how long device was stopped,
+    * time is set as if it had not been stopped at all, but error is unbounded: getMaxError () gives 0xFFFFFFFF.
+    * @param[in] Time that passed between save and boot that local clock could not count, like deep sleep duration, in milliseconds.
+    * @param[out] true if a valid state was restored.
+    */
+    bool restoreState (uint32_t offTime = NTP_OFF_TIME_UNKNOWN);
+
+    /**
+    * Checks if time was restored from storage and has not been confirmed by a sync yet.
+    * @param[out] true if time is provisional.
+    */
+    bool isProvisional () { return _provisional; }
+
+    /**
+    * Gets maximum error of current time: distance to primary reference on last sync, or error of restored
+    * time, plus maximum local clock drift since then. It may be called from any thread.
+    * @param[out] Error in milliseconds. 0xFFFFFFFF if time is not valid or has no known bound.
+    */
+    uint32_t getMaxError ();
+
+    /**
+    * Gets sync statistics: per server request, reply, timeout and rejection counters, round trip
+    * delay figures and histograms, and histogram of offsets applied on every sync.
+    * @param[out] Statistics.
+    */
+    const NTPStats_t& getStats () { return _stats.get (); }
+
+    /**
+    * Clears sync statistics.
+    */
+    void resetStats () { _stats.reset (); }
+
+    /**
+    * Gets time since last successful sync. It is not affected by resetStats (). It may be called from any thread.
+    * @param[out] Time in milliseconds. -1 if time has never been synced.
+    */
+    int64_t getTimeSinceLastSync ();
+
+    /**
+    * Writes sync statistics as compact text, one line for global counters and one for every server.
+    * @param[out] Buffer. NTP_STATS_STR_SIZE bytes always fit.
+    * @param[in] Buffer size.
+    * @param[out] Number of characters written, not counting null terminator. 0 if buffer is too small.
+    */
+    size_t getStatsStr (char *buffer, size_t size);
+
+    /**
+    * Writes sync statistics in a compact binary form, described in NTPStats.h.
+    * @param[out] Buffer. Needs NTP_STATS_BIN_SIZE bytes.
+    * @param[in] Buffer size.
+    * @param[out] Number of bytes written. 0 if buffer is too small.
+    */
+    size_t getStatsBinary (uint8_t *buffer, size_t size);
+
     /**
     * Gets timezone.
-    * @param[out] Time offset in hours (plus or minus).
+    * @param[out] Standard time offset in hours (plus or minus).
     */
     int8_t getTimeZone ();
 
@@ -204,6 +694,32 @@ public:
     */
     int8_t getTimeZoneMinutes ();
 
+#ifdef NTPCLIENT_WORKER
+    /**
+    * Starts a background worker that runs loop () periodically on its own thread, a FreeRTOS task on ESP32.
+    * It owns all network I/O from then on: Time library sync provider is removed, and loop () and getTime ()
+    * do nothing when called from other threads. nowUs (), nowMs (), nowNtp (), getUptimeMs (), getMaxError ()
+    * and getTimeSinceLastSync () may be called from any thread without locks. Time library is not thread safe,
+    * so use them rather than now () on other threads.
+    * Sync event handlers run on the worker. Call it after begin ().
+    * @param[in] Time between loop () runs, in milliseconds.
+    * @param[out] true if worker was started or was already running.
+    */
+    bool beginWorker (uint32_t period = NTP_WORKER_PERIOD);
+
+    /**
+    * Stops background worker and waits for it to finish. Time library sync provider is set again if
+    * client is active. Do not call it from sync event handlers.
+    */
+    void stopWorker ();
+
+    /**
+    * Checks if background worker is running.
+    * @param[out] true if worker runs loop ().
+    */
+    bool isWorkerRunning () { return _workerRunning; }
+#endif
+
     /**
     * Stops time synchronization.
     * @param[out] True if everything went ok.
@@ -211,38 +727,65 @@ public:
     bool stop ();
 
     /**
-    * Changes sync period.
+    * Changes maximum sync period. Actual period adapts between short and long interval: it grows while
+    * measured offsets are small compared to jitter and shrinks when clock gets unstable or sync fails.
     * @param[in] New interval in seconds.
     * @param[out] True if everything went ok.
     */
     bool setInterval (int interval);
 
     /**
-    * Changes sync period in sync'd and not sync'd status.
-    * @param[in] New interval while time is not first adjusted yet, in seconds.
-    * @param[in] New interval for normal operation, in seconds.
+    * Changes minimum and maximum sync period.
+    * @param[in] New minimum interval, also used while time is not first adjusted yet, in seconds.
+    * @param[in] New maximum interval, in seconds.
     * @param[out] True if everything went ok.
     */
     bool setInterval (int shortInterval, int longInterval);
 
     /**
-    * Gets sync period.
-    * @param[out] Interval for normal operation, in seconds.
+    * Gets maximum sync period.
+    * @param[out] Maximum interval, in seconds.
     */
     int getInterval ();
 
     /**
-    * Changes sync period not sync'd status.
-    * @param[out] Interval while time is not first adjusted yet, in seconds.
+    * Gets minimum sync period.
+    * @param[out] Minimum interval, also used while time is not first adjusted yet, in seconds.
     */
     int	getShortInterval ();
 
     /**
-    * Gets sync period.
-    * @param[out] Interval for normal operation in seconds.
+    * Gets maximum sync period.
+    * @param[out] Maximum interval in seconds.
     */
     int	getLongInterval () { return getInterval (); }
 
+    /**
+    * Gets current sync period, selected by adaptive scheduler between short and long intervals.
+    * @param[out] Current interval in seconds.
+    */
+    int getPollInterval ();
+
+    /**
+    * Sets random spread of poll intervals chosen by adaptive scheduler. Every interval is moved randomly up to
+    * this share of it, earlier or later, so that devices that boot together, as after a power cut, do not
+    * keep querying servers at the same instant. Mean interval does not change.
+    * @param[in] Spread in percent, up to NTP_POLL_MAX_SPREAD. 0 to disable. NTP_POLL_SPREAD by default.
+    */
+    void setPollSpread (uint8_t percent) { _pollSpread = percent > NTP_POLL_MAX_SPREAD ? NTP_POLL_MAX_SPREAD : percent; }
+
+    /**
+    * Gets random spread of poll intervals.
+    * @param[out] Spread in percent.
+    */
+    uint8_t getPollSpread () { return _pollSpread; }
+
+    /**
+    * Gets offset jitter, average magnitude of offsets measured on recent syncs.
+    * @param[out] Jitter in microseconds.
+    */
+    uint32_t getJitter ();
+
     /**
     * Set daylight time saving option.
     * @param[in] true is daylight time savings apply.
@@ -255,13 +798,26 @@ public:
     */
     bool getDayLight ();
 
+#ifndef NTPCLIENT_NO_HEAP
     /**
     * Convert current time to a String.
     * @param[out] String constructed from current time.
     * TODO: Add internationalization support
     */
     String getTimeStr () { return getTimeStr (now ()); }
+#endif
+
+    /**
+    * Writes a time as hh:mm:ss into a buffer, without using heap.
+    * @param[out] Buffer. Needs NTP_TIME_STR_SIZE bytes.
+    * @param[in] Buffer size.
+    * @param[in] time_t object to convert. Current time if not given.
+    * @param[out] Number of characters written, not counting null terminator. 0 if buffer is too small.
+    */
+    size_t getTimeStr (char *buffer, size_t size) { return getTimeStr (buffer, size, now ()); }
+    size_t getTimeStr (char *buffer, size_t size, time_t moment);
 
+#ifndef NTPCLIENT_NO_HEAP
     /**
     * Convert a time in UNIX format to a String representing time.
     * @param[out] String constructed from current time.
@@ -276,7 +832,19 @@ public:
     * TODO: Add internationalization support
     */
     String getDateStr () { return getDateStr (now ()); }
+#endif
 
+    /**
+    * Writes a date as dd/mm/yyyy into a buffer, without using heap.
+    * @param[out] Buffer. Needs NTP_DATE_STR_SIZE bytes.
+    * @param[in] Buffer size.
+    * @param[in] time_t object to convert. Current time if not given.
+    * @param[out] Number of characters written, not counting null terminator. 0 if buffer is too small.
+    */
+    size_t getDateStr (char *buffer, size_t size) { return getDateStr (buffer, size, now ()); }
+    size_t getDateStr (char *buffer, size_t size, time_t moment);
+
+#ifndef NTPCLIENT_NO_HEAP
     /**
     * Convert a time in UNIX format to a String representing its date.
     * @param[out] String constructed from current date.
@@ -299,6 +867,38 @@ public:
     * TODO: Add internationalization support
     */
     String getTimeDateString (time_t moment);
+#endif
+
+    /**
+    * Writes time and date as hh:mm:ss dd/mm/yyyy into a buffer, without using heap.
+    * @param[out] Buffer. Needs NTP_TIME_DATE_STR_SIZE bytes.
+    * @param[in] Buffer size.
+    * @param[in] time_t object to convert. Current time if not given.
+    * @param[out] Number of characters written, not counting null terminator. 0 if buffer is too small.
+    */
+    size_t getTimeDateString (char *buffer, size_t size) { return getTimeDateString (buffer, size, now ()); }
+    size_t getTimeDateString (char *buffer, size_t size, time_t moment);
+
+    /**
+    * Writes UTC time with milliseconds in ISO 8601 format (2018-07-22T18:30:05.123Z) into a buffer.
+    * @param[out] Buffer. Needs NTP_ISO8601_STR_SIZE bytes.
+    * @param[in] Buffer size.
+    * @param[in] UTC time in milliseconds since 1970, as given by nowMs (). Current time if not given.
+    * @param[out] Number of characters written, not counting null terminator. 0 if buffer is too small.
+    */
+    size_t getISO8601Str (char *buffer, size_t size) { return getISO8601Str (buffer, size, nowMs ()); }
+    size_t getISO8601Str (char *buffer, size_t size, uint64_t utcMs);
+
+    /**
+    * Writes local time with milliseconds and UTC offset in RFC 3339 format (2018-07-22T20:30:05.123+02:00)
+    * into a buffer. Offset includes daylight saving when active.
+    * @param[out] Buffer. Needs NTP_RFC3339_STR_SIZE bytes.
+    * @param[in] Buffer size.
+    * @param[in] UTC time in milliseconds since 1970, as given by nowMs (). Current time if not given.
+    * @param[out] Number of characters written, not counting null terminator. 0 if buffer is too small.
+    */
+    size_t getRFC3339Str (char *buffer, size_t size) { return getRFC3339Str (buffer, size, nowMs ()); }
+    size_t getRFC3339Str (char *buffer, size_t size, uint64_t utcMs);
 
     /**
     * Gets last successful sync time in UNIX format.
@@ -306,18 +906,42 @@ public:
     */
     time_t getLastNTPSync ();
 
+#ifndef NTPCLIENT_NO_HEAP
     /**
     * Get uptime in human readable String format.
     * @param[out] Uptime.
     */
     String getUptimeString ();
+#endif
 
     /**
-    * Get uptime in UNIX format, time since MCU was last rebooted.
+    * Writes uptime as dddd days hh:mm:ss into a buffer, without using heap.
+    * @param[out] Buffer. Needs NTP_UPTIME_STR_SIZE bytes.
+    * @param[in] Buffer size.
+    * @param[out] Number of characters written, not counting null terminator. 0 if buffer is too small.
+    */
+    size_t getUptimeString (char *buffer, size_t size);
+
+    /**
+    * Get uptime in UNIX format, time since MCU was last rebooted. Only from thread that runs loop ().
     * @param[out] Uptime. 0 equals never.
     */
     time_t getUptime ();
 
+    /**
+    * Gets time since MCU was last rebooted in milliseconds. Does not wrap after 49 days as millis () does.
+    * Counted from local clock state, so it may be called from any thread while loop () or worker runs.
+    * @param[out] Uptime in milliseconds.
+    */
+    uint64_t getUptimeMs ();
+
+    /**
+    * Gets time since MCU was last rebooted in microseconds. Does not wrap as micros () does.
+    * Counted from local clock state, so it may be called from any thread.
+    * @param[out] Uptime in microseconds.
+    */
+    uint64_t getUptimeUs ();
+
     /**
     * Get first boot time in UNIX format, time when MCU was last rebooted.
     * @param[out] Uptime. 0 equals never.
@@ -331,12 +955,33 @@ public:
     time_t getFirstSync ();
 
     /**
-    * Set a callback that triggers after a sync trial.
-    * @param[in] function with void(NTPSyncEvent_t) or std::function<void(NTPSyncEvent_t)> (only for ESP8266)
+    * Set a callback that triggers after a sync trial. It is called from loop () or handleEvents (), never
+    * while time is being set nor from Time library sync, so events are not delivered if neither is called.
+    * @param[in] function with void(NTPSyncEvent_t) or std::function<void(NTPSyncEvent_t)> (only for ESP8266, ESP32 and hosts)
     *				NTPSyncEvent_t equals 0 is there is no error
     */
     void onNTPSyncEvent (onSyncEvent_t handler);
 
+    /**
+    * Set a callback that triggers after a sync trial, with server, offset, delay, stratum and time details.
+    * It is called from loop () or handleEvents (), never while time is being set nor from Time library sync.
+    * @param[in] function with void(const NTPSyncEventInfo_t&) or std::function<void(const NTPSyncEventInfo_t&)>
+    *				(only for ESP8266, ESP32 and hosts)
+    */
+    void onNTPSyncEvent (onSyncEventInfo_t handler);
+
+    /**
+    * Calls event handlers for every queued sync event. loop () calls it, so it is only needed if loop ()
+    * is not used. Handlers may read time, as they never run inside now ().
+    */
+    void handleEvents ();
+
+    /**
+    * Gets number of sync events lost because queue was full when they happened.
+    * @param[out] Lost events.
+    */
+    uint16_t getDroppedEvents () { return _droppedEvents; }
+
     /**
     * True if current time is inside DST period (aka. summer time). False otherwise of if NTP object has DST
     * calculation disabled
@@ -352,7 +997,7 @@ public:
 
     /**
     * True if given time is inside DST period (aka. summer time). False otherwise.
-    * @param[in] time to make the calculation with
+    * @param[in] Local time to make the calculation with, as given by now ()
     * @param[out] True = time in summertime period
     *			  False = time ouside summertime period
     */
@@ -360,21 +1005,102 @@ public:
 
 protected:
 
+    NTPTransport *_transport = NULL; ///< Network transport used to talk to servers
+#if NETWORK_TYPE == NETWORK_POSIX
+    NTPPosixTransport _posixTransport; ///< Default transport on POSIX hosts
+#else
+    NTPUdpTransport _udpTransport; ///< Default transport, wrapping board UDP instance
+#endif
+    NTPClock *_clock;           ///< Local time source
+    NTPClock _defaultClock;     ///< millis () and micros (). Every client counts rollovers on its own
+    bool _timeLib = true;       ///< This client sets Time library time and is its sync provider
+#ifdef NTPCLIENT_NO_HEAP
+    char _serverNames[NTP_MAX_SERVERS][NTP_SERVER_NAME_SIZE] = {}; ///< Server name storage. _servers names point here
 #if NETWORK_TYPE == NETWORK_W5100
-    EthernetUDP *udp;
-#elif NETWORK_TYPE == NETWORK_ESP8266 || NETWORK_TYPE == NETWORK_WIFI101 || NETWORK_TYPE == NETWORK_ESP32
-    WiFiUDP *udp;
+    EthernetUDP _udp;           ///< UDP instance used when none is given to begin ()
+#elif NETWORK_TYPE != NETWORK_POSIX
+    WiFiUDP _udp;               ///< UDP instance used when none is given to begin ()
+#endif
 #endif
-    bool _daylight;             ///< Does this time zone have daylight saving?
+    uint16_t _serverPort = DEFAULT_NTP_SERVER_PORT; ///< Udp port that servers listen on
+    bool _daylight = false;     ///< Does this time zone have daylight saving?
+    NTPTimeZone _tz;            ///< Time zone rules, with next offset change cached
+    NTPCalendar _calendar;      ///< Broken-down time of last formatted instant
+    NTPStats _stats;            ///< Sync statistics
     int8_t _timeZone = 0;       ///< Keep track of set time zone offset
     int8_t _minutesOffset = 0;   ///< Minutes offset for time zones with decimal numbers
-    char* _ntpServerName;       ///< Name of NTP server on Internet or LAN
-    int _shortInterval;         ///< Interval to set periodic time sync until first synchronization.
-    int _longInterval;          ///< Interval to set periodic time sync
+    NTPServer_t _servers[NTP_MAX_SERVERS] = {}; ///< NTP servers on Internet or LAN
+    int _shortInterval = DEFAULT_NTP_SHORTINTERVAL; ///< Minimum sync interval, also used until first synchronization
+    int _longInterval = DEFAULT_NTP_INTERVAL; ///< Maximum sync interval
+    int _pollInterval = DEFAULT_NTP_SHORTINTERVAL; ///< Current sync interval, between _shortInterval and _longInterval
+    int8_t _pollCounter = 0;    ///< Stable syncs minus twice unstable syncs since last interval change
+    uint8_t _pollSpread = NTP_POLL_SPREAD; ///< Random spread of poll intervals, in percent
+    uint32_t _random = 1;       ///< Xorshift random generator state, used to spread poll intervals. Never 0
+    uint8_t _failures = 0;      ///< Consecutive failed syncs
+    uint32_t _jitter = 0;       ///< Average offset magnitude on recent syncs, in microseconds
+    bool _active = false;       ///< True between begin () and stop ()
+    bool _persistentSocket = false; ///< Keep UDP socket open between syncs
+    bool _socketOpen = false;   ///< UDP socket is open
+    NTPDnsCacheEntry_t _dnsCache[NTP_MAX_SERVERS] = {}; ///< Resolved addresses by server name
     time_t _lastSyncd = 0;      ///< Stored time of last successful sync
     time_t _firstSync = 0;      ///< Stored time of first successful sync after boot
-    unsigned long _uptime = 0;  ///< Time since boot
-    onSyncEvent_t onSyncEvent;  ///< Event handler callback
+    onSyncEvent_t onSyncEvent = NULL; ///< Event handler callback
+    onSyncEventInfo_t onSyncEventInfo = NULL; ///< Event handler callback with event details
+    NTPSyncEventInfo_t _events[NTP_EVENT_QUEUE_SIZE]; ///< Events waiting to be delivered by handleEvents ()
+    uint8_t _eventHead = 0;     ///< Count of queued events. Only written by queueEvent ()
+    uint8_t _eventTail = 0;     ///< Count of delivered events. Only written by handleEvents ()
+    uint16_t _droppedEvents = 0; ///< Events lost because queue was full
+#ifdef NTPCLIENT_WORKER
+    std::atomic<uint32_t> _anchorSeq; ///< Seqlock sequence of published local clock state. Odd while it is being written
+    std::atomic<uint32_t> _published[NTP_ANCHOR_WORDS]; ///< Local clock state, as read by readAnchor ()
+    std::atomic<bool> _workerRunning; ///< Background worker runs loop ()
+    uint32_t _workerPeriod = NTP_WORKER_PERIOD; ///< Milliseconds between worker loop () runs
+#if NETWORK_TYPE == NETWORK_POSIX
+    std::thread _worker;        ///< Background worker thread
+#else
+    TaskHandle_t volatile _workerTask = NULL; ///< Background worker task. Cleared by the task when it ends
+#endif
+#endif
+    int8_t _bestServer = -1;    ///< Server with lowest root distance on last successful sync
+    uint16_t _localPort = DEFAULT_NTP_PORT; ///< Local udp port
+    bool _serving = false;      ///< Answer SNTP requests
+    uint8_t _stratum = 0;       ///< Stratum of server synced with
+    IPAddress _refAddress;      ///< Address of server synced with, sent to clients as reference ID
+    uint32_t _rootDelay = 0;    ///< Round trip delay to primary reference on last sync, in microseconds
+    uint32_t _rootDispersion = 0; ///< Maximum error relative to primary reference on last sync, in microseconds
+    bool _broadcastClient = false; ///< Follow broadcasts instead of polling servers
+    NTPServer_t _broadcaster = {}; ///< Server broadcasts are taken from. Replied once round trip delay to it is known
+    uint16_t _broadcasterPort = 0; ///< Udp port broadcasts come from, used to measure delay
+    time_t _broadcastTime = 0;  ///< Local time of last sync from broadcaster, returned by next getTime ()
+    NTPStorage *_storage = NULL; ///< Storage where state is saved. NULL if state is not kept
+    uint32_t _saveInterval = NTP_STATE_SAVE_INTERVAL; ///< Seconds between state saves from loop ()
+    uint64_t _saveDue = 0;      ///< Uptime in milliseconds when state has to be saved again
+    bool _provisional = false;  ///< Time restored from storage, not confirmed by a sync yet
+    NTPSyncStatus_t _syncStatus = syncIdle; ///< State of current NTP request
+    uint64_t _requestSent = 0;  ///< Uptime in milliseconds when last request was sent
+    uint64_t _receiveUs = 0;    ///< Local clock when last response was received, in microseconds (T4)
+    IPAddress _receiveAddress;  ///< Source address of last response
+    bool _hedging = true;       ///< Send backup requests to servers that answer late
+    uint8_t _burstCount = NTP_BURST_COUNT; ///< Request rounds on first sync
+    uint16_t _burstSpacing = NTP_BURST_SPACING; ///< Milliseconds between burst rounds
+    uint8_t _burstLeft = 0;     ///< Request rounds still to be sent on current sync
+    bool _burstPause = false;   ///< Waiting between burst rounds
+    bool _burstStepped = false; ///< Local clock has been set from a previous round of current burst
+    int64_t _burstStep = 0;     ///< Offset applied to local clock by provisional step of current burst, in microseconds
+    uint64_t _burstDue = 0;     ///< Uptime in milliseconds when next burst round is sent
+    uint8_t _resolveIndex = 0;  ///< Next server slot to resolve while status is syncResolving
+    bool _resolveRound = false; ///< Request being resolved is next round of a burst
+    NTPClockAnchor_t _anchor = { 0, 0, (uint64_t)SEVENTY_YEARS << 32, 0, 0, NTP_UNBOUNDED_ERROR, 0, 0, 0, 0, 0, 0 }; ///< Local clock state
+    uint32_t _slewThreshold = 0; ///< Offsets below this value are slewed, in microseconds. 0 means always step
+    uint8_t _driftSamples = 0;  ///< Number of offsets used to estimate drift, up to 4
+    uint64_t _lastSyncUs = 0;   ///< Local clock on last successful sync, in microseconds. 0 equals never
+    uint64_t _syncDue = 0;      ///< Uptime in milliseconds when Time library will call sync provider again
+    bool _alignPending = false; ///< Time library second has to be aligned to local clock on next loop ()
+    uint64_t _alignedMillis = 0; ///< Uptime in milliseconds when Time library was last aligned to local clock
+    uint32_t _alignPeriod = 0;  ///< Time library is aligned every this number of milliseconds to follow drift correction
+    uint32_t _alignSecond = 0;  ///< Last local clock second seen while alignment is pending
+    int64_t _offset = 0;        ///< Clock offset measured on last sync, in microseconds
+    uint32_t _delay = 0;        ///< Round trip delay measured on last sync, in microseconds
 
     /**
     * Function that gets time from NTP server and convert it to Unix time format
@@ -383,15 +1109,219 @@ protected:
     static time_t s_getTime ();
 
     /**
-    * Calculates the daylight saving for a given date.
-    * @param[in] Year.
-    * @param[in] Month.
-    * @param[in] Day.
-    * @param[in] Hour.
-    * @param[in] Time zone offset.
-    * @param[out] true if date and time are inside summertime period.
+    * Makes this client Time library sync provider, or stops being it.
+    * @param[in] true to attach. Nothing is done if Time library sync is disabled for this client.
+    */
+    void attachTimeLib (bool attach);
+
+    /**
+    * Sets Time library time, if this client keeps it in sync.
+    * @param[in] Local time in UNIX format.
+    */
+    void setLibraryTime (time_t moment) {
+        if (_timeLib)
+            setTime (moment);
+    }
+
+    /**
+    * Builds time zone rules from hourly offset, minutes and daylight saving flag.
+    * @param[out] Rules for current _timeZone, _minutesOffset and _daylight values.
+    */
+    NTPTzRules_t legacyTimeZoneRules ();
+
+    /**
+    * Applies new time zone rules, moving Time library to new local time.
+    * @param[in] Time zone rules.
+    */
+    void applyTimeZone (const NTPTzRules_t &rules);
+
+    /**
+    * Stores a sync event, with details of last sync, to be delivered by handleEvents ().
+    * @param[in] Sync result.
+    */
+    void queueEvent (NTPSyncEvent_t event);
+
+    /**
+    * Reads up to NTP_SERVER_BURST received packets. Responses are decoded and requests are answered.
+    */
+    void receivePackets ();
+
+    /**
+    * Answers an SNTP request.
+    * @param[in] Request. It is turned into response.
+    * @param[in] Receive timestamp, in NTP format.
+    * @param[in] Client address.
+    * @param[in] Client port.
+    */
+    void serveRequest (uint8_t *packet, uint64_t receiveTimestamp, const IPAddress &address, uint16_t port);
+
+    /**
+    * Processes a broadcast packet. Local clock is set from it if delay to broadcaster is known,
+    * otherwise a request is sent to measure it.
+    * @param[in] Broadcast packet.
+    * @param[in] Local clock when it was received, in microseconds.
+    * @param[in] Broadcaster address.
+    * @param[in] Broadcaster port.
+    */
+    void receiveBroadcast (const uint8_t *packet, uint64_t receiveUs, const IPAddress &address, uint16_t port);
+
+    /**
+    * Sets local clock from broadcaster.
+    * @param[in] Offset measured from broadcast or from delay measurement response, in microseconds.
+    * @param[in] Packet offset was measured from.
+    */
+    void syncFromBroadcaster (int64_t offset, const uint8_t *packet);
+
+    /**
+    * Steps local clock by _offset and updates sync state, drift, statistics and events.
+    * _delay and data sent to our own clients have to be set before.
+    * @param[out] Local time after sync, in UNIX format.
+    */
+    time_t applySync ();
+
+    /**
+    * Writes sync state to storage.
+    * @param[in] true if state is saved on request, so that no time runs after it. false for periodic saves.
+    * @param[out] true if time was valid and state could be written.
+    */
+    bool saveState (bool final);
+
+    /**
+    * Recalculates how often Time library has to be aligned to local clock, from drift.
+    */
+    void updateAlignPeriod ();
+
+    /**
+    * Converts UTC time to local time, adding time zone and daylight saving offsets.
+    * @param[in] UTC time in UNIX format.
+    * @param[out] Local time in UNIX format.
+    */
+    time_t utcToLocal (time_t utc);
+
+    /**
+    * Sets Time library sync interval, keeping track of when next sync is due.
+    * @param[in] Interval in seconds.
+    * @param[in] true to move it randomly by up to _pollSpread percent.
+    */
+    void scheduleSync (int interval, bool spread = false);
+
+    /**
+    * Mixes a value that varies from device to device, like a network delay measurement, into random generator.
+    * @param[in] Value.
+    */
+    void stirRandom (uint32_t value) {
+        _random ^= value * 2654435761UL; // Knuth multiplicative hash spreads low bits
+        if (!_random)
+            _random = 1;
+    }
+
+    /**
+    * Gets next random number.
+    * @param[out] Pseudo random 32 bit value.
+    */
+    uint32_t nextRandom () {
+        _random ^= _random << 13;
+        _random ^= _random >> 17;
+        _random ^= _random << 5;
+        return _random;
+    }
+
+    /**
+    * Adapts sync interval after a sync trial and schedules next one.
+    * @param[in] True if sync was successful. Offset is taken from _offset.
+    */
+    void adjustPollInterval (bool success);
+
+    /**
+    * Updates oscillator frequency estimation with offset measured on this sync.
+    * @param[in] Offset due to frequency error, in microseconds. Part of a previous slew that was not absorbed yet is excluded.
+    * @param[in] Time since previous sync, in microseconds.
+    */
+    void updateDrift (int64_t offset, uint64_t interval);
+
+    /**
+    * Sets local clock to given time from this instant on.
+    * @param[in] UTC time in microseconds since UNIX epoch.
+    */
+    void setLocalClock (uint64_t us) { setLocalClock (us, _clock->uptimeMs (), _clock->micros ()); }
+
+    /**
+    * Sets local clock to given time at the instant given by millis () and micros () readings.
+    * @param[in] UTC time in microseconds since UNIX epoch.
+    * @param[in] Uptime in milliseconds at that instant.
+    * @param[in] micros () value at that instant.
+    */
+    void setLocalClock (uint64_t us, uint64_t uptimeMs, uint32_t micros);
+
+    /**
+    * Steps local clock by given offset from this instant on. Drift correction is kept and any slew is cancelled.
+    * @param[in] Offset in microseconds. 0 just sets a new anchor with no discontinuity.
+    */
+    void shiftLocalClock (int64_t offset);
+
+    /**
+    * Gets time elapsed since local clock was last set, corrected by estimated drift. millis() gives elapsed
+    * time for up to 49 days and micros() refines it, so no periodic call is needed to follow micros() overflow.
+    * @param[in] Local clock state.
+    * @param[in] Milliseconds elapsed since local clock was set, as given by readAnchor ().
+    * @param[in] micros () elapsed since local clock was set, read after elapsed milliseconds.
+    * @param[out] Elapsed time in microseconds.
     */
-    bool summertime (int year, byte month, byte day, byte hour, byte tzHours);
+    uint64_t elapsedUs (const NTPClockAnchor_t &anchor, uint64_t elapsedMillis, uint32_t elapsedMicros);
+
+    /**
+    * Gets local clock state and milliseconds elapsed since it was set. With NTPCLIENT_WORKER it is a
+    * consistent copy of last published state, so that it may be called from any thread without locks.
+    * @param[in] Storage for the copy.
+    * @param[out] Milliseconds elapsed since local clock was set.
+    * @param[out] micros () elapsed since local clock was set, read after milliseconds.
+    * @param[out] Local clock state.
+    */
+    const NTPClockAnchor_t& readAnchor (NTPClockAnchor_t &copy, uint64_t &elapsedMillis, uint32_t &elapsedMicros);
+
+    /**
+    * Makes local clock state visible to readers on other threads, after it has changed.
+    */
+    void publishAnchor ();
+
+#ifdef NTPCLIENT_WORKER
+    /**
+    * Sets local clock again from itself once NTP_ANCHOR_REBASE milliseconds have passed since it was set, as
+    * readers on other threads count elapsed time with 32 bit millis (). Called from worker, loop () and getTime ().
+    */
+    void rebaseAnchor ();
+
+    /**
+    * Checks if caller is not the background worker while it runs, so that it must not touch client state.
+    * @param[out] true if worker is running and caller is another thread.
+    */
+    bool otherThanWorker ();
+
+    /**
+    * Background worker body. Runs loop () until stopWorker () is called.
+    */
+    void workerLoop ();
+
+#if NETWORK_TYPE != NETWORK_POSIX
+    /**
+    * FreeRTOS task function of background worker.
+    * @param[in] Client that owns the worker.
+    */
+    static void workerTask (void *client);
+#endif
+#endif
+
+    /**
+    * Gets part of slew correction that has been applied after some time since local clock was set.
+    * @param[in] Local clock state.
+    * @param[in] Elapsed time since local clock was set, in microseconds.
+    * @param[out] Applied correction, in microseconds.
+    */
+    static int32_t slewApplied (const NTPClockAnchor_t &anchor, uint64_t elapsed) {
+        if (elapsed >= anchor.slewEndUs)
+            return anchor.slewUs;
+        return ((int64_t)elapsed * anchor.slewRate) >> 32;
+    }
 
     /**
     * Helper function to add leading 0 to hour, minutes or seconds if < 10.
@@ -403,9 +1333,12 @@ protected:
 
 public:
     /**
-    * Decode NTP response contained in buffer.
+    * Decode NTP response contained in buffer. Response is matched to the server it was requested to by its
+    * originate timestamp and source address. Kiss-o'-Death responses, and responses from unsynchronized servers
+    * or with invalid fields are discarded. Clock offset and round trip delay are calculated from originate,
+    * receive and transmit timestamps, and from request send and response receive instants.
     * @param[in] Pointer to message buffer.
-    * @param[out] Decoded time from message, 0 if error ocurred.
+    * @param[out] Decoded time from message, 0 if error ocurred or response does not match any request.
     */
     time_t decodeNtpMessage (char *messageBuffer);
 
@@ -417,12 +1350,87 @@ public:
 
 private:
     /**
-    * Sends NTP request packet to given IP address.
-    * @param[in] NTP server's IP address.
-    * @param[out] True if everything went ok.
+    * Resolves all NTP server names and sends request packets to them. At most one name is looked up on every
+    * call. While status is syncResolving, next calls go on with following servers until all of them have an address.
+    * @param[in] true to send next round of a burst to the same addresses, keeping samples of previous rounds.
+    * @param[out] True if any request was sent.
+    */
+    bool sendRequest (bool nextRound = false);
+
+    /**
+    * Sets local clock provisionally from best response of a burst round, so that time is valid before
+    * burst ends. Samples of that round and previous ones are moved to the new local clock.
+    */
+    void stepFromBurst ();
+
+    /**
+    * Gets an address for server from DNS cache, resolving its name when cache entry has expired or all
+    * cached addresses have been used on this sync. Addresses are handed out in round robin.
+    * @param[in] Server slot.
+    * @param[in,out] true if name may be looked up. Set to false once a lookup has ended.
+    * @param[out] 1 if server has an address, 0 if not. NTP_RESOLVE_PENDING if a lookup is needed but not allowed, or still in progress.
+    */
+    int8_t resolveServer (NTPServer_t &server, bool &lookUp);
+
+    /**
+    * Gets DNS cache entry for a server name, taking a free one if name is not cached.
+    * @param[in] Server name.
+    * @param[out] Cache entry.
+    */
+    NTPDnsCacheEntry_t* getDnsCacheEntry (const char* name);
+
+    /**
+    * Removes an address that did not answer from DNS cache, so that it is not used again.
+    * @param[in] Server slot.
+    */
+    void discardServerAddress (NTPServer_t &server);
+
+    /**
+    * Processes a Kiss-o'-Death response. Server is parked, longer on every repeated rate limit and for
+    * the longest time if it denies access, and its address is discarded so that pool servers get a new one.
+    * @param[in] Server slot.
+    * @param[in] Kiss code, 4 ASCII characters.
+    */
+    void processKissCode (NTPServer_t &server, const char *code);
+
+    /**
+    * Removes DNS cache entry for a server name that is going to be freed, or moves it to another
+    * slot with same name.
+    * @param[in] Server name pointer.
+    */
+    void releaseDnsCacheEntry (const char* name);
+
+    /**
+    * Closes UDP socket unless it has to be kept open.
+    * @param[in] true to close it even in persistent mode.
+    */
+    void closeSocket (bool force = false);
+
+    /**
+    * Sends a backup request to every server whose response is later than its usual round trip delay.
+    */
+    void sendHedges ();
+
+    /**
+    * Gets address for a backup request: a cached address of server name that no server is using on
+    * this sync, or the same one if there is none.
+    * @param[in] Server slot.
+    * @param[out] Address.
+    */
+    IPAddress alternateAddress (NTPServer_t &server);
+
+    /**
+    * Checks once for NTP response and processes timeout.
+    * @param[out] Decoded time when all responses were received or timeout, 0 otherwise.
+    */
+    time_t checkResponse ();
+
+    /**
+    * Discards servers that do not agree with majority (intersection and clustering steps of NTP clock
+    * selection) and combines offsets of survivors weighted by their root distance.
+    * @param[out] True if any server survived. Offset and delay are stored in _offset and _delay.
     */
-    //bool sendNTPpacket(IPAddress &address);
-//#endif
+    bool selectServers ();
 };
 
 extern NTPClient NTP;
@@ -0,0 +1,77 @@
+/*
+ Name:		NTPBurstTest.cpp
+ Author:	Germán Martín (gmag11@gmail.com)
+ Maintainer:Germán Martín (gmag11@gmail.com)
+
+ Unit test of first sync burst on simulated time: provisional step from first round, offset
+ reported by final sync, and responses that arrive after their round has timed out, when
+ local clock has already been stepped.
+*/
+
+#include "NTPTestSim.h"
+
+static NTPSyncEventInfo_t s_event;
+static int s_events = 0;
+
+static void onEvent (const NTPSyncEventInfo_t &info) {
+    s_event = info;
+    s_events++;
+}
+
+/**
+* Syncs with a server that answers right away and another one whose responses always arrive
+* after round timeout but before next round, with local clock starting at given error.
+*/
+static void lateServer (const char *name, SimStorage *storage) {
+    printf ("%s\n", name);
+    SimServer fast, late;
+    fast.address = IPAddress (10, 0, 0, 1);
+    late.address = IPAddress (10, 0, 0, 2);
+    late.holdUs = NTP_TIMEOUT * 1000 + 300000;
+    SimTransport transport;
+    transport.servers.push_back (&fast);
+    transport.servers.push_back (&late);
+    SimClock clock;
+    NTPClient client;
+    client.setStorage (storage);
+    client.setBurst (3, 2000);
+    client.setNtpServerName ("10.0.0.2", 1);
+    client.onNTPSyncEvent (onEvent);
+    s_events = 0;
+    simBegin (client, clock, transport, "10.0.0.1");
+    int64_t startError = simClockError (client);
+    simRun (client, 10000);
+    const NTPServerStats_t &stats = client.getStats ().servers[1];
+    printf ("  offset %lld us, delay %u us, late server replies %u timeouts %u invalid %u\n", (long long)s_event.offset,
+            client.getLastDelay (), stats.replies, stats.timeouts, stats.invalid);
+    check (s_events == 1 && s_event.event == timeSyncd && s_event.server == 0, "synced from server that answers in time");
+    check (near (s_event.offset, -startError, 1000), "offset reports whole correction");
+    check (near (simClockError (client), 0, 1000), "local clock follows server");
+    check (near (client.getLastDelay (), 2000, 100), "delay measured");
+    check (stats.replies == 0 && stats.invalid == 0, "late responses are not taken");
+    check (stats.timeouts == 3, "every round of late server times out");
+}
+
+int main () {
+    s_simUs = 1000000;
+    lateServer ("Late responses after positive step", NULL);
+
+    // Save state from a clock 5 s ahead, so that burst steps it back
+    SimStorage storage;
+    {
+        SimServer ahead;
+        ahead.address = IPAddress (10, 0, 0, 1);
+        ahead.offsetUs = 5000000;
+        SimTransport transport;
+        transport.servers.push_back (&ahead);
+        SimClock clock;
+        NTPClient client;
+        client.setStorage (&storage);
+        simBegin (client, clock, transport, "10.0.0.1");
+        simRun (client, 10000);
+        client.saveState ();
+    }
+    s_simUs += 60000000;
+    lateServer ("Late responses after negative step", &storage);
+    return checkSummary ();
+}
@@ -0,0 +1,77 @@
+/*
+ Name:		NTPCalendarTest.cpp
+ Author:	Germán Martín (gmag11@gmail.com)
+ Maintainer:Germán Martín (gmag11@gmail.com)
+
+ Unit test of loop free calendar: every day from year 1 to 9999 converts to its date and back,
+ and NTPCalendar::breakTime () matches libc gmtime_r () on sequential, backwards and scattered
+ moments, before and after 1970, whether its cached day is reused or not.
+*/
+
+#include "NTPTestSim.h"
+#include <time.h>
+
+/**
+* Compares calendar fields with gmtime_r () result for the same moment.
+*/
+static bool sameTime (const NTPDateTime_t &date, time_t moment) {
+    struct tm tm;
+    gmtime_r (&moment, &tm);
+    return date.year == tm.tm_year + 1900 && date.month == tm.tm_mon + 1 && date.day == tm.tm_mday &&
+        date.hour == tm.tm_hour && date.minute == tm.tm_min && date.second == tm.tm_sec && date.weekday == tm.tm_wday + 1;
+}
+
+int main () {
+    printf ("Civil dates\n");
+    check (!ntpIsLeapYear (1900) && ntpIsLeapYear (2000) && ntpIsLeapYear (2024) && !ntpIsLeapYear (2100), "leap years");
+    check (ntpDaysInMonth (2024, 2) == 29 && ntpDaysInMonth (2023, 2) == 28 && ntpDaysInMonth (2023, 4) == 30 && ntpDaysInMonth (2023, 12) == 31,
+           "days in month");
+    check (ntpDaysFromCivil (1970, 1, 1) == 0 && ntpDaysFromCivil (2000, 3, 1) == 11017 && ntpDaysFromCivil (1969, 12, 31) == -1, "known days");
+    int32_t first = ntpDaysFromCivil (1, 1, 1);
+    int16_t year = 1;
+    uint8_t month = 1, day = 1;
+    uint8_t weekday = 2; // 0001-01-01 is a Monday in proleptic Gregorian calendar
+    bool fromCivil = true, toCivil = true, yearOk = true;
+    for (int32_t days = first; year <= 9999; days++) {
+        NTPDateTime_t date;
+        ntpCivilFromDays (days, date);
+        fromCivil = fromCivil && ntpDaysFromCivil (year, month, day) == days;
+        toCivil = toCivil && date.year == year && date.month == month && date.day == day && date.weekday == weekday;
+        yearOk = yearOk && ntpYearFromDays (days) == year;
+        weekday = weekday % 7 + 1;
+        if (++day > ntpDaysInMonth (year, month)) {
+            day = 1;
+            if (++month > 12) {
+                month = 1;
+                year++;
+            }
+        }
+    }
+    check (fromCivil, "days from every date of years 1 to 9999");
+    check (toCivil, "date and weekday of every day");
+    check (yearOk, "year of every day");
+    check (ntpDaysFromTime (0) == 0 && ntpDaysFromTime (86399) == 0 && ntpDaysFromTime (-1) == -1 && ntpDaysFromTime (-86400) == -1 &&
+           ntpDaysFromTime (-86401) == -2, "days of instants round towards past");
+
+    printf ("Broken-down time\n");
+    NTPCalendar calendar;
+    bool sequential = true;
+    for (time_t moment = 1711846800 - 2 * 86400; moment < 1711846800 + 2 * 86400; moment += 7) {
+        sequential = sequential && sameTime (calendar.breakTime (moment), moment);
+    }
+    check (sequential, "sequential moments across days");
+    bool backwards = true;
+    for (time_t moment = 1711846800 + 2 * 86400; moment > 1711846800 - 2 * 86400; moment -= 13) {
+        backwards = backwards && sameTime (calendar.breakTime (moment), moment);
+    }
+    check (backwards, "backwards moments across days");
+    bool scattered = true;
+    uint32_t random = 1;
+    for (int i = 0; i < 1000000; i++) {
+        random = random * 1103515245 + 12345;
+        time_t moment = (int64_t)random * 2 + (i & 1) - 0x80000000LL;
+        scattered = scattered && sameTime (calendar.breakTime (moment), moment);
+    }
+    check (scattered, "scattered moments from 1901 to 2174");
+    return checkSummary ();
+}
@@ -0,0 +1,57 @@
+/*
+ Name:		NTPDriftTest.cpp
+ Author:	Germán Martín (gmag11@gmail.com)
+ Maintainer:Germán Martín (gmag11@gmail.com)
+
+ Unit test of oscillator drift estimation on simulated time: drift of a fast and a slow local
+ oscillator is measured from successive sync offsets, local clock is corrected by it between
+ syncs, and estimation is limited to NTP_MAX_DRIFT.
+*/
+
+#include "NTPTestSim.h"
+
+/**
+* Syncs a device whose oscillator runs off by given frequency error for some hours.
+* @param[in] Test name.
+* @param[in] Oscillator frequency error, in parts per billion. Positive runs fast.
+* @param[in] Expected drift estimation, in ppm. Positive means oscillator is slow.
+*/
+static void drift (const char *name, int32_t driftPpb, float expected) {
+    printf ("%s\n", name);
+    SimServer server;
+    server.address = IPAddress (10, 0, 0, 1);
+    SimTransport transport;
+    transport.servers.push_back (&server);
+    SimClock clock;
+    clock.driftPpb = driftPpb;
+    NTPClient client;
+    client.setPollSpread (0);
+    simBegin (client, clock, transport, "10.0.0.1");
+    client.setInterval (16, 256); // begin () sets default intervals
+    simRun (client, 3 * 3600 * 1000); // Responses are read as soon as they arrive, or offsets would include read latency
+    printf ("  drift %.3f ppm, poll interval %d s\n", client.getDrift (), client.getPollInterval ());
+    check (client.getDrift () > expected - 0.5 && client.getDrift () < expected + 0.5, "drift estimated");
+    if (expected <= -NTP_MAX_DRIFT || expected >= NTP_MAX_DRIFT)
+        return; // Remaining frequency error is not corrected
+    // Corrected local clock keeps following true time until next sync
+    int64_t worst = 0;
+    uint32_t requests = server.requests;
+    for (int i = 0; i < client.getPollInterval () - 1 && server.requests == requests; i++) {
+        simRun (client, 1000);
+        int64_t error = simClockError (client);
+        if (error < 0)
+            error = -error;
+        if (error > worst)
+            worst = error;
+    }
+    printf ("  largest error between syncs %lld us\n", (long long)worst);
+    check (worst < 1000, "local clock corrected between syncs");
+}
+
+int main () {
+    s_simUs = 1000000;
+    drift ("Fast oscillator", 40000, -40);
+    drift ("Slow oscillator", -25000, 25);
+    drift ("Drift above limit", 800000, -NTP_MAX_DRIFT);
+    return checkSummary ();
+}
@@ -0,0 +1,89 @@
+/*
+ Name:		NTPEventTest.cpp
+ Author:	Germán Martín (gmag11@gmail.com)
+ Maintainer:Germán Martín (gmag11@gmail.com)
+
+ Unit test of sync event queue on simulated time: events are only delivered from loop () and
+ handleEvents (), never from getTime (), which is Time library sync provider. Queue keeps order,
+ drops and counts events when full, and carries sync details.
+*/
+
+#include "NTPTestSim.h"
+
+#define EVENT_LOG_SIZE 16
+
+static NTPSyncEventInfo_t s_log[EVENT_LOG_SIZE];
+static int s_events = 0;
+static NTPClient *s_client;
+static uint32_t s_requestsInHandler = 0;
+static SimServer *s_server;
+
+static void onEvent (const NTPSyncEventInfo_t &info) {
+    if (s_events < EVENT_LOG_SIZE)
+        s_log[s_events] = info;
+    s_events++;
+    // Handlers may read time. Nothing must be sent meanwhile
+    uint32_t requests = s_server->requests;
+    s_client->nowMs ();
+    s_requestsInHandler += s_server->requests - requests;
+}
+
+/**
+* Runs getTime () alone, as Time library does when loop () is not called, until given number of syncs end.
+*/
+static void runGetTime (NTPClient &client, uint32_t ms) {
+    for (uint32_t elapsed = 0; elapsed < ms; elapsed++) {
+        s_simUs += 1000;
+        client.getTime ();
+    }
+}
+
+int main () {
+    s_simUs = 1000000;
+    SimServer server;
+    server.address = IPAddress (10, 0, 0, 1);
+    server.dead = true;
+    s_server = &server;
+    SimTransport transport;
+    transport.servers.push_back (&server);
+    SimClock clock;
+    NTPClient client;
+    s_client = &client;
+    client.setBurst (1);
+    client.onNTPSyncEvent (onEvent);
+    simBegin (client, clock, transport, "10.0.0.1");
+
+    printf ("Delivery only from loop () and handleEvents ()\n");
+    runGetTime (client, (NTP_TIMEOUT + 10) * (NTP_EVENT_QUEUE_SIZE + 2));
+    check (client.getStats ().noResponse == NTP_EVENT_QUEUE_SIZE + 2, "failed syncs");
+    check (s_events == 0, "getTime () does not deliver events");
+    check (client.getDroppedEvents () == 2, "events above queue size dropped and counted");
+    client.handleEvents ();
+    check (s_events == NTP_EVENT_QUEUE_SIZE, "handleEvents () delivers queued events");
+    bool noResponses = true;
+    for (int i = 0; i < NTP_EVENT_QUEUE_SIZE; i++) {
+        noResponses = noResponses && s_log[i].event == noResponse && s_log[i].server == -1 && !s_log[i].time;
+    }
+    check (noResponses, "failure details");
+    client.handleEvents ();
+    check (s_events == NTP_EVENT_QUEUE_SIZE, "every event is delivered once");
+
+    printf ("Sync details\n");
+    server.dead = false;
+    server.offsetUs = 0;
+    server.delayUs = 3000;
+    server.stratum = 2;
+    s_events = 0;
+    // A request to dead server may still be in progress. Run until its timeout and retry have been delivered
+    for (int i = 0; i < 60000 && !(s_events && s_log[s_events - 1].event == timeSyncd); i++) {
+        simRun (client, 1);
+    }
+    const NTPSyncEventInfo_t &info = s_log[s_events - 1];
+    check (info.event == timeSyncd, "sync delivered from loop ()");
+    check (info.server == 0 && info.stratum == 2, "server and stratum");
+    check (near (info.delay, 6000, 100), "delay");
+    check (near (info.offset, client.getLastOffset (), 0), "offset");
+    check (near (info.time, SIM_EPOCH + s_simUs / 1000000, 1), "event time");
+    check (s_requestsInHandler == 0, "handler reading time sends nothing");
+    return checkSummary ();
+}
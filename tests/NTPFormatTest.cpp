@@ -0,0 +1,107 @@
+/*
+ Name:		NTPFormatTest.cpp
+ Author:	Germán Martín (gmag11@gmail.com)
+ Maintainer:Germán Martín (gmag11@gmail.com)
+
+ Unit test of heap free time formatters: output is compared with libc formatting on moments
+ spread over 1970 to 2106, buffers that are too small give an empty string, RFC 3339 strings
+ carry time zone offset and uptime string counts from boot on simulated clock.
+*/
+
+#include "NTPTestSim.h"
+#include <time.h>
+
+/**
+* Formats a moment with strftime () as reference.
+*/
+static void reference (char *buffer, size_t size, const char *format, time_t moment) {
+    struct tm tm;
+    gmtime_r (&moment, &tm);
+    strftime (buffer, size, format, &tm);
+}
+
+int main () {
+    SimClock clock;
+    NTPClient client;
+    client.setClock (&clock);
+    char buffer[64];
+    char expected[64];
+
+    printf ("Time and date\n");
+    bool timeOk = true, dateOk = true, timeDateOk = true, isoOk = true, lengthOk = true;
+    for (uint64_t moment = 0; moment < 0xFFFFFFFFULL; moment += 86400ULL * 7 + 3661 * 5 + 1) {
+        reference (expected, sizeof (expected), "%H:%M:%S", moment);
+        lengthOk = lengthOk && client.getTimeStr (buffer, NTP_TIME_STR_SIZE, moment) == NTP_TIME_STR_SIZE - 1;
+        timeOk = timeOk && !strcmp (buffer, expected);
+        reference (expected, sizeof (expected), "%d/%m/%Y", moment);
+        lengthOk = lengthOk && client.getDateStr (buffer, NTP_DATE_STR_SIZE, moment) == NTP_DATE_STR_SIZE - 1;
+        dateOk = dateOk && !strcmp (buffer, expected);
+        reference (expected, sizeof (expected), "%H:%M:%S %d/%m/%Y", moment);
+        lengthOk = lengthOk && client.getTimeDateString (buffer, NTP_TIME_DATE_STR_SIZE, moment) == NTP_TIME_DATE_STR_SIZE - 1;
+        timeDateOk = timeDateOk && !strcmp (buffer, expected);
+        reference (expected, sizeof (expected), "%Y-%m-%dT%H:%M:%S", moment);
+        snprintf (expected + strlen (expected), 8, ".%03dZ", (int)(moment % 1000));
+        lengthOk = lengthOk && client.getISO8601Str (buffer, NTP_ISO8601_STR_SIZE, moment * 1000 + moment % 1000) == NTP_ISO8601_STR_SIZE - 1;
+        isoOk = isoOk && !strcmp (buffer, expected);
+    }
+    check (timeOk, "getTimeStr () matches strftime ()");
+    check (dateOk, "getDateStr () matches strftime ()");
+    check (timeDateOk, "getTimeDateString () matches strftime ()");
+    check (isoOk, "getISO8601Str () matches strftime ()");
+    check (lengthOk, "length returned");
+#ifndef NTPCLIENT_NO_HEAP
+    client.getTimeDateString (buffer, sizeof (buffer), 1532284205);
+    check (client.getTimeDateString (1532284205) == buffer, "String version gives same text");
+#endif
+
+    printf ("Small buffers\n");
+    bool emptyOk = true;
+    for (size_t size = 0; size < NTP_RFC3339_STR_SIZE; size++) {
+        memset (buffer, 'x', sizeof (buffer));
+        size_t length = 0;
+        if (size < NTP_TIME_STR_SIZE)
+            length += client.getTimeStr (buffer, size, 1532284205);
+        if (size < NTP_DATE_STR_SIZE)
+            length += client.getDateStr (buffer, size, 1532284205);
+        if (size < NTP_TIME_DATE_STR_SIZE)
+            length += client.getTimeDateString (buffer, size, 1532284205);
+        if (size < NTP_UPTIME_STR_SIZE)
+            length += client.getUptimeString (buffer, size);
+        if (size < NTP_ISO8601_STR_SIZE)
+            length += client.getISO8601Str (buffer, size, 1532284205123ULL);
+        length += client.getRFC3339Str (buffer, size, 1532284205123ULL);
+        emptyOk = emptyOk && !length && (size ? buffer[0] == '\0' : buffer[0] == 'x') && (size < 2 || buffer[1] == 'x');
+    }
+    check (emptyOk, "nothing written but terminator");
+
+    printf ("RFC 3339\n");
+    client.getRFC3339Str (buffer, sizeof (buffer), 1532284205123ULL);
+    check (!strcmp (buffer, "2018-07-22T18:30:05.123+00:00"), "UTC");
+    client.setTimeZone (5, 30);
+    client.getRFC3339Str (buffer, sizeof (buffer), 1532284205123ULL);
+    check (!strcmp (buffer, "2018-07-23T00:00:05.123+05:30"), "positive offset with minutes");
+    client.setTimeZone (-3, -30); // Minutes carry offset sign
+    client.getRFC3339Str (buffer, sizeof (buffer), 1532284205123ULL);
+    check (!strcmp (buffer, "2018-07-22T15:00:05.123-03:30"), "negative offset with minutes");
+    client.setTimeZoneRules ("CET-1CEST,M3.5.0,M10.5.0/3");
+    client.getRFC3339Str (buffer, sizeof (buffer), 1532284205123ULL);
+    check (!strcmp (buffer, "2018-07-22T20:30:05.123+02:00"), "daylight saving");
+    client.getRFC3339Str (buffer, sizeof (buffer), 1543689005000ULL);
+    check (!strcmp (buffer, "2018-12-01T19:30:05.000+01:00"), "standard time");
+
+    printf ("Uptime\n");
+    s_simUs = 1000000;
+    clock.bootUs = s_simUs;
+    s_simUs += 5000000;
+    client.getUptimeString (buffer, sizeof (buffer));
+    check (!strcmp (buffer, "   0 days 00:00:05"), "seconds");
+    s_simUs += (2 * 86400ULL + 3 * 3600 + 4 * 60) * 1000000;
+    client.getUptimeString (buffer, sizeof (buffer));
+    check (!strcmp (buffer, "   2 days 03:04:05"), "days");
+    for (int i = 0; i < 12345 / 15; i++) {
+        s_simUs += 15 * 86400ULL * 1000000; // millis () wraps many times, but uptime is read often enough to notice it
+        client.getUptime ();
+    }
+    check (client.getUptimeString (buffer, sizeof (buffer)) == 19 && !strcmp (buffer, "12347 days 03:04:05"), "five digit days");
+    return checkSummary ();
+}
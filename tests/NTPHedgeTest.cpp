@@ -0,0 +1,134 @@
+/*
+ Name:		NTPHedgeTest.cpp
+ Author:	Germán Martín (gmag11@gmail.com)
+ Maintainer:Germán Martín (gmag11@gmail.com)
+
+ Unit test of hedged requests on simulated time: a backup request goes to another address of the
+ same name when first one does not answer within NTP_HEDGE_DELAY, once per sync. With enough
+ samples it is sent after the usual round trip delay instead, to the same address if there is no
+ other, and nothing is sent when hedging is disabled.
+*/
+
+#include "NTPTestSim.h"
+
+static NTPSyncEventInfo_t s_event;
+static int s_events = 0;
+
+static void onEvent (const NTPSyncEventInfo_t &info) {
+    s_event = info;
+    s_events++;
+}
+
+/**
+* Runs until a sync event is received.
+* @param[out] Time it took, in milliseconds.
+*/
+static uint32_t waitEvent (NTPClient &client) {
+    int events = s_events;
+    uint32_t elapsed = 0;
+    while (s_events == events && elapsed < 60000) {
+        simRun (client, 1);
+        elapsed++;
+    }
+    return elapsed;
+}
+
+/**
+* Runs until server receives a new request.
+* @param[out] Time it took, in milliseconds.
+*/
+static uint32_t waitRequest (NTPClient &client, SimServer &server) {
+    uint32_t requests = server.requests;
+    uint32_t elapsed = 0;
+    while (server.requests == requests && elapsed < 60000) {
+        simRun (client, 1);
+        elapsed++;
+    }
+    return elapsed;
+}
+
+static void alternateAddress () {
+    printf ("Backup request to another address\n");
+    SimServer lost, answering;
+    lost.address = IPAddress (10, 0, 0, 1);
+    lost.dead = true;
+    answering.address = IPAddress (10, 0, 0, 2);
+    SimTransport transport;
+    transport.servers.push_back (&lost);
+    transport.servers.push_back (&answering);
+    transport.names["pool.sim"].push_back (lost.address);
+    transport.names["pool.sim"].push_back (answering.address);
+    SimClock clock;
+    NTPClient client;
+    client.setBurst (1);
+    client.onNTPSyncEvent (onEvent);
+    simBegin (client, clock, transport, "pool.sim");
+    uint32_t elapsed = waitEvent (client);
+    const NTPServerStats_t &stats = client.getStats ().servers[0];
+    printf ("  synced after %u ms, delay %u us\n", elapsed, client.getLastDelay ());
+    check (lost.requests == 1 && answering.requests == 1, "backup request sent to other address");
+    check (s_event.event == timeSyncd && near (elapsed, NTP_HEDGE_DELAY + 2, 2), "synced from backup response");
+    check (near (client.getLastDelay (), 2000, 100), "delay measured from backup request");
+    check (stats.hedges == 1 && stats.replies == 1 && stats.timeouts == 0, "counters");
+    check (near (simClockError (client), 0, 1000), "local clock follows server");
+}
+
+static void usualDelay () {
+    printf ("Backup request after usual round trip delay\n");
+    SimServer server;
+    server.address = IPAddress (10, 0, 0, 1);
+    SimTransport transport;
+    transport.servers.push_back (&server);
+    SimClock clock;
+    NTPClient client;
+    client.setBurst (1);
+    client.setPollSpread (0);
+    client.onNTPSyncEvent (onEvent);
+    simBegin (client, clock, transport, "10.0.0.1");
+    client.setInterval (16, 16);
+    for (int i = 0; i < NTP_HEDGE_MIN_SAMPLES; i++) {
+        waitEvent (client);
+    }
+    const NTPServerStats_t &stats = client.getStats ().servers[0];
+    check (stats.replies == NTP_HEDGE_MIN_SAMPLES && stats.hedges == 0, "no backup requests while server answers in time");
+    server.holdUs = 100000; // Server gets slow
+    waitRequest (client, server);
+    uint32_t wait = waitRequest (client, server);
+    printf ("  backup request %u ms after request\n", wait);
+    check (near (wait, NTP_HEDGE_MIN_DELAY, 1), "sent after usual round trip delay, NTP_HEDGE_MIN_DELAY at least");
+    waitEvent (client);
+    check (s_event.event == timeSyncd && stats.hedges == 1, "retransmitted to same address");
+    check (near (client.getLastDelay (), 2000, 100), "processing time not counted as delay");
+    server.dead = true;
+    waitEvent (client);
+    check (server.requests == NTP_HEDGE_MIN_SAMPLES + 4 && stats.hedges == 2, "one backup request per sync");
+}
+
+static void disabled () {
+    printf ("Hedging disabled\n");
+    SimServer lost, answering;
+    lost.address = IPAddress (10, 0, 0, 1);
+    lost.dead = true;
+    answering.address = IPAddress (10, 0, 0, 2);
+    SimTransport transport;
+    transport.servers.push_back (&lost);
+    transport.servers.push_back (&answering);
+    transport.names["pool.sim"].push_back (lost.address);
+    transport.names["pool.sim"].push_back (answering.address);
+    SimClock clock;
+    NTPClient client;
+    client.setBurst (1);
+    client.setHedging (false);
+    client.onNTPSyncEvent (onEvent);
+    simBegin (client, clock, transport, "pool.sim");
+    waitEvent (client);
+    check (s_event.event == noResponse && answering.requests == 0 && client.getStats ().servers[0].hedges == 0, "no backup request");
+}
+
+int main () {
+    s_simUs = 1000000;
+    alternateAddress ();
+    usualDelay ();
+    disabled ();
+    return checkSummary ();
+}
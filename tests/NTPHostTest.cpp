@@ -0,0 +1,279 @@
+/*
+ Name:		NTPHostTest.cpp
+ Author:	Germán Martín (gmag11@gmail.com)
+ Maintainer:Germán Martín (gmag11@gmail.com)
+
+ Host integration test of NtpClientLib, run by ctest. It starts ntp_test_server processes
+ on loopback and checks client results against system time: offset reported by a sync
+ that follows a provisional burst step, warm start from saved state with known and unknown
+ off time, slew mode, Kiss-o'-Death parking, broadcast client and server selection with a
+ falseticker. Every check is printed, and exit code is the number of failed ones.
+
+ Usage: ntp_host_test path/to/ntp_test_server
+*/
+
+#include <TimeLib.h>
+#include <NtpClientLib.h>
+#include <time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#define TEST_PORT 12420 // First of consecutive ports used by test servers
+#define TEST_STATE_FILE "ntp_host_test.state"
+#define SYNC_TIMEOUT 5000 // Milliseconds to wait for a sync event
+#define TOLERANCE_US 50000 // Allowed difference to expected time on loopback, in microseconds
+
+static const char *s_serverPath;
+static int s_failures = 0;
+static NTPSyncEventInfo_t s_event;
+static int s_events = 0;
+
+static void onEvent (const NTPSyncEventInfo_t &info) {
+    s_event = info;
+    s_events++;
+}
+
+static void check (bool ok, const char *what) {
+    printf ("  %s %s\n", ok ? "ok  " : "FAIL", what);
+    if (!ok)
+        s_failures++;
+}
+
+/**
+* Gets how far client local clock is from system time, in microseconds.
+*/
+static int64_t clockError (NTPClient &client) {
+    struct timespec ts;
+    clock_gettime (CLOCK_REALTIME, &ts);
+    return (int64_t)client.nowUs () - ((int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+static bool near (int64_t value, int64_t expected) {
+    return value >= expected - TOLERANCE_US && value <= expected + TOLERANCE_US;
+}
+
+/**
+* Starts ntp_test_server with given arguments.
+* @param[in] Arguments, ended by NULL.
+* @param[out] Process id. -1 if server could not be started or exited right away, like when it cannot bind.
+*/
+static pid_t startServer (const char *const *args) {
+    const char *argv[16] = { s_serverPath };
+    for (int i = 0; args[i] && i < 14; i++) {
+        argv[i + 1] = args[i];
+    }
+    pid_t pid = fork ();
+    if (!pid) {
+        int null = open ("/dev/null", O_WRONLY);
+        dup2 (null, STDOUT_FILENO);
+        execv (s_serverPath, (char *const *)argv);
+        _exit (127);
+    }
+    delay (200); // Let it bind
+    if (pid < 0 || waitpid (pid, NULL, WNOHANG) == pid)
+        return -1;
+    return pid;
+}
+
+static void stopServer (pid_t pid) {
+    if (pid <= 0)
+        return;
+    kill (pid, SIGTERM);
+    waitpid (pid, NULL, 0);
+}
+
+/**
+* Runs client loop until a sync event is received.
+* @param[out] true if an event was received before SYNC_TIMEOUT.
+*/
+static bool waitEvent (NTPClient &client) {
+    int events = s_events;
+    uint32_t start = millis ();
+    while (s_events == events && millis () - start < SYNC_TIMEOUT) {
+        client.loop ();
+        delay (1);
+    }
+    return s_events != events;
+}
+
+/**
+* Starts client against a server on loopback. First sync is due right away.
+*/
+static void startClient (NTPClient &client, const char *server, uint16_t port, uint8_t burst) {
+    client.setTimeLibSync (false); // Clients are read with nowUs ()
+    client.setNtpServerPort (port);
+    client.setBurst (burst, 200);
+    client.onNTPSyncEvent (onEvent);
+    client.begin (server, 0, false);
+}
+
+static bool synced () {
+    return s_event.event == timeSyncd;
+}
+
+// Test cases
+
+static void testWarmStart () {
+    printf ("Warm start and offset after burst step (-o)\n");
+    char port[8];
+    snprintf (port, sizeof (port), "%d", TEST_PORT);
+    const char *exact[] = { "-p", port, NULL };
+    char shiftedPort[8];
+    snprintf (shiftedPort, sizeof (shiftedPort), "%d", TEST_PORT + 1);
+    const char *shifted[] = { "-p", shiftedPort, "-o", "2500", NULL };
+    pid_t exactServer = startServer (exact);
+    pid_t shiftedServer = startServer (shifted);
+    check (exactServer > 0 && shiftedServer > 0, "servers started");
+    unlink (TEST_STATE_FILE);
+    NTPFileStorage storage (TEST_STATE_FILE);
+    {
+        NTPClient client;
+        client.setStorage (&storage);
+        startClient (client, "127.0.0.1", TEST_PORT, 2);
+        check (waitEvent (client) && synced (), "first sync");
+        check (near (clockError (client), 0), "local clock follows server");
+        check (client.saveState (), "state saved");
+    }
+    {
+        NTPClient client;
+        client.setStorage (&storage);
+        startClient (client, "127.0.0.1", TEST_PORT + 1, 2);
+        uint32_t maxError = client.getMaxError ();
+        int64_t error = clockError (client);
+        check (client.isProvisional (), "time restored");
+        check (maxError != 0xFFFFFFFF, "restored error is bounded");
+        check (maxError != 0xFFFFFFFF && error <= (int64_t)maxError * 1000 + TOLERANCE_US && error >= -(int64_t)maxError * 1000 - TOLERANCE_US,
+               "restored time is within its error");
+        check (waitEvent (client) && synced (), "sync against shifted server");
+        printf ("  event offset %lld us, last offset %lld us\n", (long long)s_event.offset, (long long)client.getLastOffset ());
+        check (near (s_event.offset, 2500000), "event offset includes burst step");
+        check (near (client.getLastOffset (), 2500000), "last offset includes burst step");
+        check (near (clockError (client), 2500000), "local clock follows shifted server");
+        check (client.getStats ().offsetHistogram[NTP_STATS_BUCKETS - 1] == 1, "offset histogram holds whole step"); // 2.1 s and above
+    }
+    {
+        // A state file written in the future cannot tell how long device was off
+        struct timeval times[2];
+        gettimeofday (&times[0], NULL);
+        times[0].tv_sec += 3600;
+        times[1] = times[0];
+        utimes (TEST_STATE_FILE, times);
+        NTPClient client;
+        client.setStorage (&storage);
+        startClient (client, "127.0.0.1", TEST_PORT, 1);
+        check (client.isProvisional () && client.getMaxError () == 0xFFFFFFFF, "unknown off time gives unbounded error");
+    }
+    unlink (TEST_STATE_FILE);
+    stopServer (exactServer);
+    stopServer (shiftedServer);
+}
+
+static void testSlew () {
+    printf ("Slew mode\n");
+    char port[8];
+    snprintf (port, sizeof (port), "%d", TEST_PORT);
+    const char *exact[] = { "-p", port, NULL };
+    char shiftedPort[8];
+    snprintf (shiftedPort, sizeof (shiftedPort), "%d", TEST_PORT + 1);
+    const char *shifted[] = { "-p", shiftedPort, "-o", "200", NULL };
+    pid_t exactServer = startServer (exact);
+    pid_t shiftedServer = startServer (shifted);
+    check (exactServer > 0 && shiftedServer > 0, "servers started");
+    NTPClient client;
+    startClient (client, "127.0.0.1", TEST_PORT, 1);
+    check (waitEvent (client) && synced (), "first sync");
+    client.setSlewMode (true, 1000);
+    client.setNtpServerPort (TEST_PORT + 1);
+    client.getTime ();
+    check (waitEvent (client) && synced (), "sync against shifted server");
+    printf ("  offset %lld us, remaining %d us\n", (long long)s_event.offset, client.getSlewRemaining ());
+    check (near (s_event.offset, 200000), "offset measured");
+    check (client.getSlewRemaining () > 100000, "offset is being slewed");
+    check (near (clockError (client), 0), "local clock not stepped");
+    stopServer (exactServer);
+    stopServer (shiftedServer);
+}
+
+static void testKissOfDeath () {
+    printf ("Kiss-o'-Death (-k)\n");
+    char port[8];
+    snprintf (port, sizeof (port), "%d", TEST_PORT + 2);
+    const char *kiss[] = { "-p", port, "-k", "RATE", NULL };
+    pid_t server = startServer (kiss);
+    check (server > 0, "server started");
+    NTPClient client;
+    startClient (client, "127.0.0.1", TEST_PORT + 2, 1);
+    check (waitEvent (client) && !synced (), "sync fails");
+    const NTPServerStats_t &stats = client.getStats ().servers[0];
+    check (stats.kods == 1 && stats.replies == 0, "Kiss-o'-Death counted, not taken as reply");
+    uint32_t requests = stats.requests;
+    for (int i = 0; i < 5; i++) {
+        client.getTime ();
+        delay (50);
+        client.loop ();
+    }
+    check (client.getStats ().servers[0].requests == requests, "parked server is not queried");
+    stopServer (server);
+}
+
+static void testBroadcast () {
+    printf ("Broadcast client (-b)\n");
+    char port[8];
+    snprintf (port, sizeof (port), "%d", TEST_PORT + 3);
+    char target[24];
+    snprintf (target, sizeof (target), "127.0.0.1:%d", TEST_PORT + 4);
+    const char *broadcast[] = { "-p", port, "-b", target, "-i", "1", NULL };
+    pid_t server = startServer (broadcast);
+    check (server > 0, "server started");
+    NTPClient client;
+    startClient (client, "127.0.0.1", TEST_PORT + 3, 1);
+    check (client.beginBroadcast (TEST_PORT + 4), "listening to broadcasts");
+    check (waitEvent (client) && synced (), "sync from broadcast");
+    check (s_event.server == -1, "event tells broadcast sync");
+    check (near (clockError (client), 0), "local clock follows broadcaster");
+    stopServer (server);
+}
+
+static void testSelection () {
+    printf ("Server selection with a falseticker\n");
+    char port[8];
+    snprintf (port, sizeof (port), "%d", TEST_PORT + 5);
+    const char *first[] = { "-p", port, "-a", "127.0.0.1", NULL };
+    const char *second[] = { "-p", port, "-a", "127.0.0.2", NULL };
+    const char *falseticker[] = { "-p", port, "-a", "127.0.0.3", "-o", "5000", NULL };
+    pid_t servers[] = { startServer (first), startServer (second), startServer (falseticker) };
+    if (servers[0] > 0 && (servers[1] <= 0 || servers[2] <= 0)) {
+        printf ("  skipped: cannot listen on 127.0.0.2 and 127.0.0.3\n");
+    } else {
+        check (servers[0] > 0, "servers started");
+        NTPClient client;
+        client.setNtpServerName ("127.0.0.2", 1);
+        client.setNtpServerName ("127.0.0.3", 2);
+        startClient (client, "127.0.0.1", TEST_PORT + 5, 1);
+        check (waitEvent (client) && synced (), "sync");
+        check (s_event.server != 2, "falseticker not chosen");
+        check (client.getStats ().servers[2].rejected == 1, "falseticker rejected");
+        check (near (clockError (client), 0), "local clock follows truechimers");
+    }
+    for (int i = 0; i < 3; i++) {
+        stopServer (servers[i]);
+    }
+}
+
+int main (int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf (stderr, "Usage: %s path/to/ntp_test_server\n", argv[0]);
+        return 1;
+    }
+    s_serverPath = argv[1];
+    testWarmStart ();
+    testSlew ();
+    testKissOfDeath ();
+    testBroadcast ();
+    testSelection ();
+    printf ("%d checks failed\n", s_failures);
+    return s_failures;
+}
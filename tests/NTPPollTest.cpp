@@ -0,0 +1,100 @@
+/*
+ Name:		NTPPollTest.cpp
+ Author:	Germán Martín (gmag11@gmail.com)
+ Maintainer:Germán Martín (gmag11@gmail.com)
+
+ Unit test of adaptive poll interval on simulated time: interval doubles from short to long
+ interval while clock is stable, halves on every failure, starts again from short interval
+ after a clock step, and is spread randomly around its value.
+*/
+
+#include "NTPTestSim.h"
+
+#define POLL_LOG_SIZE 64
+
+static NTPClient *s_client;
+static NTPSyncEvent_t s_event[POLL_LOG_SIZE];
+static int s_poll[POLL_LOG_SIZE];       // Poll interval chosen after every sync
+static uint64_t s_syncUs[POLL_LOG_SIZE]; // True time of every sync
+static int s_events = 0;
+
+static void onEvent (const NTPSyncEventInfo_t &info) {
+    if (s_events < POLL_LOG_SIZE) {
+        s_event[s_events] = info.event;
+        s_poll[s_events] = s_client->getPollInterval ();
+        s_syncUs[s_events] = s_simUs;
+    }
+    s_events++;
+}
+
+/**
+* Runs until given number of sync events are received.
+*/
+static void runSyncs (NTPClient &client, int syncs) {
+    int last = s_events + syncs;
+    while (s_events < last) {
+        simRun (client, 1);
+    }
+}
+
+int main () {
+    s_simUs = 1000000;
+    SimServer server;
+    server.address = IPAddress (10, 0, 0, 1);
+    SimTransport transport;
+    transport.servers.push_back (&server);
+    SimClock clock;
+    NTPClient client;
+    s_client = &client;
+    client.setPollSpread (0);
+    client.onNTPSyncEvent (onEvent);
+    simBegin (client, clock, transport, "10.0.0.1");
+    client.setInterval (16, 256);
+
+    printf ("Stable clock\n");
+    runSyncs (client, 16);
+    bool grows = s_poll[0] == 16;
+    for (int i = 1; i < s_events; i++) {
+        grows = grows && s_event[i] == timeSyncd && (s_poll[i] == s_poll[i - 1] || s_poll[i] == 2 * s_poll[i - 1]);
+    }
+    check (grows, "interval doubles from short interval");
+    check (s_poll[s_events - 1] == 256, "interval limited to long interval");
+    bool onTime = true;
+    for (int i = 1; i < s_events; i++) {
+        onTime = onTime && near (s_syncUs[i] - s_syncUs[i - 1], s_poll[i - 1] * 1000000LL, 10000);
+    }
+    check (onTime, "syncs follow chosen interval");
+
+    printf ("Failures\n");
+    server.dead = true;
+    runSyncs (client, 3);
+    check (s_event[s_events - 1] == noResponse, "sync fails");
+    check (s_poll[s_events - 3] == 128 && s_poll[s_events - 2] == 64 && s_poll[s_events - 1] == 32, "interval halves on every failure");
+    runSyncs (client, 2);
+    check (s_poll[s_events - 1] == 16, "interval limited to short interval");
+
+    printf ("Clock step\n");
+    server.dead = false;
+    runSyncs (client, 6);
+    check (s_poll[s_events - 1] > 16, "interval grows again");
+    server.offsetUs = 1000000;
+    runSyncs (client, 1);
+    check (s_event[s_events - 1] == timeSyncd && s_poll[s_events - 1] == 16, "step starts again from short interval");
+
+    printf ("Spread\n");
+    client.setPollSpread (10);
+    server.offsetUs = 0;
+    client.setInterval (16, 16);
+    int first = s_events;
+    runSyncs (client, 20);
+    int64_t shortest = 0x7FFFFFFF, longest = 0;
+    for (int i = first + 1; i < s_events; i++) {
+        int64_t interval = s_syncUs[i] - s_syncUs[i - 1];
+        shortest = interval < shortest ? interval : shortest;
+        longest = interval > longest ? interval : longest;
+    }
+    printf ("  intervals from %lld to %lld ms\n", (long long)shortest / 1000, (long long)longest / 1000);
+    check (shortest >= 14400000 && longest <= 17600000 + 10000, "intervals within spread");
+    check (longest - shortest > 1000000, "intervals are spread");
+    return checkSummary ();
+}
@@ -0,0 +1,120 @@
+/*
+ Name:		NTPServerTest.cpp
+ Author:	Germán Martín (gmag11@gmail.com)
+ Maintainer:Germán Martín (gmag11@gmail.com)
+
+ Unit test of SNTP server mode on simulated time: requests are only answered once time is synced,
+ responses carry synced time, client originate timestamp, stratum, reference and a root dispersion
+ that grows since last sync, and requests with bad version or mode are ignored.
+*/
+
+#include "NTPTestSim.h"
+
+#define TEST_CLIENT_PORT 40000
+
+static const IPAddress s_lanClient (192, 168, 1, 50);
+
+/**
+* Sends a request to client as a LAN device would.
+* @param[in] Transport of device under test.
+* @param[in] First byte: leap indicator, version and mode.
+* @param[in] Transmit timestamp, returned as originate timestamp.
+*/
+static void request (SimTransport &transport, uint8_t header, uint64_t transmit) {
+    uint8_t packet[NTP_PACKET_SIZE] = { header, 0, 6, 0 };
+    simWriteTimestamp (packet + 40, transmit);
+    transport.inject (packet, s_lanClient, TEST_CLIENT_PORT, 500);
+}
+
+static uint32_t readUint32 (const uint8_t *buffer) {
+    return (uint32_t)buffer[0] << 24 | (uint32_t)buffer[1] << 16 | (uint32_t)buffer[2] << 8 | buffer[3];
+}
+
+int main () {
+    s_simUs = 1000000;
+    SimServer upstream;
+    upstream.address = IPAddress (10, 0, 0, 1);
+    upstream.stratum = 2;
+    upstream.rootDispersion = 0x200; // 1/128 s
+    upstream.delayUs = 3000;
+    SimTransport transport;
+    transport.servers.push_back (&upstream);
+    SimClock clock;
+    NTPClient client;
+    client.setBurst (1);
+    simBegin (client, clock, transport, "10.0.0.1");
+    check (client.beginServer (), "server started");
+
+    printf ("Not synced\n");
+    request (transport, 0x23, 0x1122334455667788ULL); // Version 4, client mode
+    simRun (client, 2);
+    check (transport.outbox.empty (), "no response before first sync");
+
+    printf ("Synced\n");
+    simRun (client, 1000);
+    check (client.getStats ().syncs == 1, "synced");
+    transport.outbox.clear ();
+    request (transport, 0x23, 0x1122334455667788ULL);
+    simRun (client, 2);
+    check (transport.outbox.size () == 1, "response sent");
+    if (transport.outbox.size () == 1) {
+        const SimPacket_t &response = transport.outbox[0];
+        const uint8_t *packet = response.data;
+        check (response.address == s_lanClient && response.port == TEST_CLIENT_PORT, "sent to requester");
+        check (packet[0] == 0x24 && packet[1] == 3 && packet[2] == 6, "version, server mode, stratum and poll");
+        check (simReadTimestamp (packet + 24) == 0x1122334455667788ULL, "originate is request transmit timestamp");
+        uint64_t receive = simReadTimestamp (packet + 32);
+        uint64_t transmit = simReadTimestamp (packet + 40);
+        uint64_t expected = simNtp (s_simUs);
+        check (expected - receive < (1ULL << 32) / 200 && expected - transmit < (1ULL << 32) / 200, "timestamps follow synced time");
+        check (!memcmp (packet + 12, "\x0A\x00\x00\x01", 4), "reference is upstream address");
+        check ((readUint32 (packet + 4) >> 16) == 0 && near (readUint32 (packet + 4), 6000 * 65536LL / 1000000, 2), "root delay");
+        check (near (readUint32 (packet + 8), 0x200, 2), "root dispersion is upstream one right after sync");
+    }
+
+    printf ("Dispersion grows\n");
+    client.setInterval (3600, 3600);
+    uint32_t dispersion = readUint32 (transport.outbox[0].data + 8);
+    simRun (client, 1000000, 10);
+    transport.outbox.clear ();
+    request (transport, 0x23, 1);
+    simRun (client, 2);
+    check (transport.outbox.size () == 1 && near (readUint32 (transport.outbox[0].data + 8) - dispersion, 65536LL * NTP_MAX_DISPERSION_RATE * 1000 / 1000000, 20),
+           "NTP_MAX_DISPERSION_RATE per second since sync");
+
+    printf ("Requests\n");
+    transport.outbox.clear ();
+    request (transport, 0x1B, 1); // Version 3
+    simRun (client, 2);
+    check (transport.outbox.size () == 1 && transport.outbox[0].data[0] == 0x1C, "version 3 answered with version 3");
+    transport.outbox.clear ();
+    request (transport, 0x03, 1); // Version 0
+    request (transport, 0x2B, 1); // Version 5
+    request (transport, 0x24, 1); // Server mode
+    request (transport, 0x21, 1); // Symmetric active mode
+    simRun (client, 2);
+    check (transport.outbox.empty (), "bad version and other modes ignored");
+    for (int i = 0; i < NTP_SERVER_BURST + 2; i++) {
+        request (transport, 0x23, i);
+    }
+    simRun (client, 3);
+    check (transport.outbox.size () == NTP_SERVER_BURST + 2, "every request of a burst answered");
+    uint32_t served = client.getStats ().served;
+    check (served == 3 + NTP_SERVER_BURST + 2, "served requests counted");
+
+    printf ("Served during sync\n");
+    transport.outbox.clear ();
+    client.getTime (); // Start a sync
+    request (transport, 0x23, 1);
+    simRun (client, 2);
+    check (client.getSyncStatus () == syncSent && transport.outbox.size () == 1, "request answered while response is expected");
+
+    printf ("Stopped\n");
+    simRun (client, 1000);
+    client.stopServer ();
+    transport.outbox.clear ();
+    request (transport, 0x23, 1);
+    simRun (client, 2);
+    check (transport.outbox.empty (), "no response after stopServer ()");
+    return checkSummary ();
+}
@@ -0,0 +1,102 @@
+/*
+ Name:		NTPStatsTest.cpp
+ Author:	Germán Martín (gmag11@gmail.com)
+ Maintainer:Germán Martín (gmag11@gmail.com)
+
+ Unit test of sync statistics on simulated time: counters and RTT histograms collected from a
+ server that answers and one that does not, text and binary dumps, histogram buckets, halving and
+ percentiles, and time since last sync, which resetStats () does not clear.
+*/
+
+#include "NTPTestSim.h"
+
+static uint32_t readUint32 (const uint8_t *buffer) {
+    return (uint32_t)buffer[0] << 24 | (uint32_t)buffer[1] << 16 | (uint32_t)buffer[2] << 8 | buffer[3];
+}
+
+static uint16_t readUint16 (const uint8_t *buffer) {
+    return buffer[0] << 8 | buffer[1];
+}
+
+int main () {
+    printf ("Histograms\n");
+    check (NTPStats::bucket (0) == 0 && NTPStats::bucket (127) == 0 && NTPStats::bucket (128) == 1 && NTPStats::bucket (255) == 1 &&
+           NTPStats::bucket (256) == 2, "bucket limits");
+    check (NTPStats::bucket (0xFFFFFFFFFFULL) == NTP_STATS_BUCKETS - 1, "last bucket holds every larger value");
+    check (NTPStats::bucketStart (0) == 0 && NTPStats::bucketStart (1) == 128 && NTPStats::bucketStart (5) == 2048, "bucket start");
+    NTPStats stats;
+    for (int i = 0; i < 90; i++) {
+        stats.addReply (0, 100);
+    }
+    for (int i = 0; i < 10; i++) {
+        stats.addReply (0, 5000);
+    }
+    check (stats.rttPercentile (0, 50) == 128 && stats.rttPercentile (0, 90) == 128 && stats.rttPercentile (0, 95) == 8192, "percentiles");
+    check (stats.rttPercentile (1, 50) == 0, "no percentile without samples");
+    for (uint32_t i = 90; i < 0x10000; i++) {
+        stats.addReply (0, 100);
+    }
+    const uint16_t *histogram = stats.get ().servers[0].rttHistogram;
+    check (histogram[0] == 0x8000 && histogram[NTPStats::bucket (5000)] == 5, "full bucket halves histogram");
+
+    printf ("Collected from syncs\n");
+    s_simUs = 1000000;
+    SimServer answering, dead;
+    answering.address = IPAddress (10, 0, 0, 1);
+    dead.address = IPAddress (10, 0, 0, 2);
+    dead.dead = true;
+    SimTransport transport;
+    transport.servers.push_back (&answering);
+    transport.servers.push_back (&dead);
+    SimClock clock;
+    NTPClient client;
+    client.setNtpServerName ("10.0.0.2", 1);
+    client.setBurst (1);
+    simBegin (client, clock, transport, "10.0.0.1");
+    check (client.getTimeSinceLastSync () == -1, "never synced");
+    const NTPStats_t &collected = client.getStats ();
+    while (collected.syncs < 5) {
+        simRun (client, 1);
+    }
+    simRun (client, 6500);
+    const NTPServerStats_t &first = collected.servers[0];
+    const NTPServerStats_t &second = collected.servers[1];
+    check (collected.syncs == 5 && collected.noResponse == 0, "syncs");
+    check (first.requests == 5 && first.replies == 5 && first.timeouts == 0, "answering server counters");
+    check (second.requests == 5 && second.hedges == 5 && second.replies == 0 && second.timeouts == 5, "dead server counters");
+    check (first.lastRtt == 2000 && first.minRtt == 2000 && first.maxRtt == 2000 && first.rttHistogram[NTPStats::bucket (2000)] == 5, "RTT");
+    int64_t since = client.getTimeSinceLastSync ();
+    check (since == 6500, "time since last sync");
+
+    printf ("Text dump\n");
+    char text[NTP_STATS_STR_SIZE];
+    size_t length = client.getStatsStr (text, sizeof (text));
+    printf ("%s", text);
+    check (length == strlen (text) && !strncmp (text, "syncs 5 noresp 0 noaddr 0 disagree 0 served 0 last 6s offset", 60), "global line");
+    check (strstr (text, "\ns0 10.0.0.1 req 5 hedge 0 ok 5 to 0 rej 0 dns 0 kod 0 bad 0 rtt 2000 2000/2000/2000 hist 4:5\n") != NULL, "answering server line");
+    check (strstr (text, "\ns1 10.0.0.2 req 5 hedge 5 ok 0 to 5 rej 0 dns 0 kod 0 bad 0 rtt 0 0/0/0 hist\n") != NULL, "dead server line");
+    check (!strstr (text, "\ns2"), "unused slot skipped");
+    check (client.getStatsStr (text, length) == 0 && text[0] == '\0', "empty if buffer is too small");
+
+    printf ("Binary dump\n");
+    uint8_t binary[NTP_STATS_BIN_SIZE];
+    check (client.getStatsBinary (binary, sizeof (binary) - 1) == 0, "nothing if buffer is too small");
+    check (client.getStatsBinary (binary, sizeof (binary)) == NTP_STATS_BIN_SIZE, "size");
+    check (binary[0] == NTP_STATS_VERSION && binary[1] == NTP_MAX_SERVERS && binary[2] == NTP_STATS_BUCKETS, "header");
+    check (readUint32 (binary + 4) == 5 && readUint32 (binary + 8) == 0 && readUint32 (binary + 24) == since, "global counters");
+    const uint8_t *server = binary + 28 + 2 * NTP_STATS_BUCKETS;
+    check (readUint32 (server) == 5 && readUint32 (server + 8) == 5 && readUint32 (server + 44) == 2000 &&
+           readUint16 (server + 48 + 2 * NTPStats::bucket (2000)) == 5, "first server");
+    server += 48 + 2 * NTP_STATS_BUCKETS;
+    check (readUint32 (server) == 5 && readUint32 (server + 4) == 5 && readUint32 (server + 12) == 5 && readUint32 (server + 36) == 0, "second server");
+
+    printf ("Reset\n");
+    client.resetStats ();
+    simRun (client, 1000);
+    check (collected.syncs == 0 && first.requests == 0 && first.minRtt == 0xFFFFFFFF, "counters cleared");
+    client.getStatsStr (text, sizeof (text));
+    check (!strncmp (text, "syncs 0 noresp 0 noaddr 0 disagree 0 served 0 last never", 56), "dump starts again");
+    since = client.getTimeSinceLastSync ();
+    check (since == 7500, "time since last sync kept");
+    return checkSummary ();
+}
@@ -0,0 +1,170 @@
+/*
+ Name:		NTPTestSim.cpp
+ Author:	Germán Martín (gmag11@gmail.com)
+ Maintainer:Germán Martín (gmag11@gmail.com)
+
+ Simulated clock, network and servers for deterministic unit tests of NtpClientLib.
+*/
+
+#include "NTPTestSim.h"
+
+uint64_t s_simUs = 0;
+static int s_checks = 0;
+static int s_failures = 0;
+
+void check (bool ok, const char *what) {
+    printf ("  %s %s\n", ok ? "ok  " : "FAIL", what);
+    s_checks++;
+    if (!ok)
+        s_failures++;
+}
+
+int checkSummary () {
+    printf ("%d of %d checks failed\n", s_failures, s_checks);
+    return s_failures;
+}
+
+bool near (int64_t value, int64_t expected, int64_t tolerance) {
+    return value >= expected - tolerance && value <= expected + tolerance;
+}
+
+uint64_t simNtp (int64_t trueUs) {
+    int64_t us = SIM_EPOCH_US + trueUs;
+    uint64_t seconds = us / 1000000 + SEVENTY_YEARS;
+    uint64_t fraction = ((uint64_t)(us % 1000000) << 32) / 1000000;
+    return (seconds << 32) | fraction;
+}
+
+void simWriteTimestamp (uint8_t *buffer, uint64_t timestamp) {
+    for (int i = 0; i < 8; i++) {
+        buffer[i] = timestamp >> (56 - 8 * i);
+    }
+}
+
+uint64_t simReadTimestamp (const uint8_t *buffer) {
+    uint64_t timestamp = 0;
+    for (int i = 0; i < 8; i++) {
+        timestamp = (timestamp << 8) | buffer[i];
+    }
+    return timestamp;
+}
+
+uint8_t SimTransport::resolve (const char* name, IPAddress *addresses, uint8_t max) {
+    lookups++;
+    std::map<std::string, std::vector<IPAddress> >::iterator entry = names.find (name);
+    if (entry != names.end ()) {
+        uint8_t count = 0;
+        for (; count < max && count < entry->second.size (); count++) {
+            addresses[count] = entry->second[count];
+        }
+        return count;
+    }
+    IPAddress address;
+    if (!max || !address.fromString (name))
+        return 0;
+    addresses[0] = address;
+    return 1;
+}
+
+bool SimTransport::send (const IPAddress &address, uint16_t port, const uint8_t *buffer, size_t length) {
+    if (!open)
+        return false;
+    SimServer *server = NULL;
+    for (size_t i = 0; i < servers.size (); i++) {
+        if (servers[i]->address == address)
+            server = servers[i];
+    }
+    if (!server) {
+        SimPacket_t packet = { s_simUs, address, port, {} };
+        memcpy (packet.data, buffer, length < NTP_PACKET_SIZE ? length : NTP_PACKET_SIZE);
+        outbox.push_back (packet);
+        return true;
+    }
+    server->requests++;
+    if (server->dead || length < NTP_PACKET_SIZE || (buffer[0] & 0x07) != 3)
+        return true;
+
+    uint64_t arrival = s_simUs + server->delayUs;
+    SimPacket_t response = { arrival + server->holdUs + server->delayUs, address, port, {} };
+    uint8_t *packet = response.data;
+    packet[0] = (buffer[0] & 0x38) | 4; // LI 0, same version, server mode
+    packet[1] = server->stratum;
+    packet[2] = buffer[2];
+    packet[3] = 0xEC; // Precision, about 60 ns
+    packet[10] = server->rootDispersion >> 8;
+    packet[11] = server->rootDispersion;
+    memcpy (packet + 12, "SIM", 3);
+    if (server->kiss) {
+        packet[0] |= 0xC0; // Unsynchronized
+        packet[1] = 0;
+        memset (packet + 12, ' ', 4);
+        memcpy (packet + 12, server->kiss, strlen (server->kiss) < 4 ? strlen (server->kiss) : 4);
+    }
+    simWriteTimestamp (packet + 16, simNtp (arrival + server->offsetUs));
+    memcpy (packet + 24, buffer + 40, 8); // Originate is client transmit
+    simWriteTimestamp (packet + 32, simNtp (arrival + server->offsetUs));
+    simWriteTimestamp (packet + 40, simNtp (arrival + server->holdUs + server->offsetUs));
+    inbox.push_back (response);
+    return true;
+}
+
+int SimTransport::receive (uint8_t *buffer, size_t length, IPAddress &address, uint16_t &port) {
+    if (!open)
+        return 0;
+    for (size_t i = 0; i < inbox.size (); i++) {
+        if (inbox[i].deliverUs <= s_simUs) {
+            size_t size = length < NTP_PACKET_SIZE ? length : NTP_PACKET_SIZE;
+            memcpy (buffer, inbox[i].data, size);
+            address = inbox[i].address;
+            port = inbox[i].port;
+            inbox.erase (inbox.begin () + i);
+            return size;
+        }
+    }
+    return 0;
+}
+
+void SimTransport::inject (const uint8_t *packet, const IPAddress &address, uint16_t port, uint32_t delayUs) {
+    SimPacket_t received = { s_simUs + delayUs, address, port, {} };
+    memcpy (received.data, packet, NTP_PACKET_SIZE);
+    inbox.push_back (received);
+}
+
+bool SimStorage::load (uint8_t *data, size_t size) {
+    if (!saved || size > sizeof (state))
+        return false;
+    memcpy (data, state, size);
+    return true;
+}
+
+bool SimStorage::save (const uint8_t *data, size_t size) {
+    if (size > sizeof (state))
+        return false;
+    memcpy (state, data, size);
+    saved = true;
+    savedUs = s_simUs;
+    return true;
+}
+
+bool SimStorage::getTimeSinceSave (uint64_t &ms) {
+    ms = (s_simUs - savedUs) / 1000;
+    return saved;
+}
+
+void simBegin (NTPClient &client, SimClock &clock, SimTransport &transport, const char *server) {
+    clock.bootUs = s_simUs;
+    client.setClock (&clock);
+    client.setTimeLibSync (false);
+    client.begin (server, 0, false, 0, &transport);
+}
+
+void simRun (NTPClient &client, uint32_t ms, uint32_t tickMs) {
+    for (uint32_t elapsed = 0; elapsed < ms; elapsed += tickMs) {
+        s_simUs += tickMs * 1000;
+        client.loop ();
+    }
+}
+
+int64_t simClockError (NTPClient &client) {
+    return (int64_t)client.nowUs () - (int64_t)(SIM_EPOCH_US + s_simUs);
+}
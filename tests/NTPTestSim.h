@@ -0,0 +1,158 @@
+/*
+ Name:		NTPTestSim.h
+ Author:	Germán Martín (gmag11@gmail.com)
+ Maintainer:Germán Martín (gmag11@gmail.com)
+
+ Simulated clock, network and servers for deterministic unit tests of NtpClientLib. Time only
+ moves when a test advances it, so every run gives the same results, and no socket or process
+ is needed. Servers answer from true simulated time shifted by their own offset, after a
+ configurable delay, as ntp_test_server does on a real network.
+*/
+
+#ifndef _NTPTestSim_h
+#define _NTPTestSim_h
+
+#include <NtpClientLib.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#define SIM_EPOCH 1790000000ULL // Simulated true time starts on 2026-09-21 UTC
+#define SIM_EPOCH_US (SIM_EPOCH * 1000000)
+
+extern uint64_t s_simUs;        // Simulated true time since simulation start, in microseconds
+
+/**
+* Prints a check result and counts failures.
+* @param[in] Check result.
+* @param[in] Description.
+*/
+void check (bool ok, const char *what);
+
+/**
+* Prints number of failed checks.
+* @param[out] Number of failed checks, to be used as exit code.
+*/
+int checkSummary ();
+
+/**
+* Tells whether a value is within some distance of the expected one.
+*/
+bool near (int64_t value, int64_t expected, int64_t tolerance);
+
+// Local clock of a simulated device. It starts on boot and runs off true time by a fixed frequency error
+class SimClock : public NTPClock {
+public:
+    uint64_t bootUs = 0;        ///< True time of boot
+    int32_t driftPpb = 0;       ///< Frequency error, in parts per billion
+    uint32_t millisStart = 0;   ///< millis () value on boot, to test rollovers
+
+    uint32_t millis () { return millisStart + localUs () / 1000; }
+    uint32_t micros () { return millisStart * 1000 + localUs (); }
+
+    /**
+    * Gets local time since boot, as counted by device oscillator.
+    */
+    uint64_t localUs () {
+        int64_t elapsed = s_simUs - bootUs;
+        return elapsed + elapsed * driftPpb / 1000000000;
+    }
+};
+
+// Stand-in NTP server reachable through SimTransport
+struct SimServer {
+    IPAddress address;          ///< Server address
+    int64_t offsetUs = 0;       ///< Server clock error against true time
+    uint32_t delayUs = 1000;    ///< One way network delay
+    uint32_t holdUs = 0;        ///< Time between request reception and response transmission
+    uint32_t rootDispersion = 0x100; ///< 16.16 fixed point seconds. 1/256 s
+    uint8_t stratum = 1;        ///< Stratum. Ignored if kiss is given
+    const char *kiss = NULL;    ///< Kiss-o'-Death code to answer with
+    bool dead = false;          ///< Requests are lost
+    uint32_t requests = 0;      ///< Requests received
+};
+
+typedef struct {
+    uint64_t deliverUs;         ///< True time when packet reaches its destination
+    IPAddress address;          ///< Source address of received packets, destination of sent ones
+    uint16_t port;              ///< Source port of received packets, destination of sent ones
+    uint8_t data[NTP_PACKET_SIZE];
+} SimPacket_t;
+
+// Datagram transport of a simulated device
+class SimTransport : public NTPTransport {
+public:
+    std::vector<SimServer *> servers; ///< Servers reachable by address
+    std::map<std::string, std::vector<IPAddress> > names; ///< Names that resolve to several addresses, like pool names
+    std::vector<SimPacket_t> inbox; ///< Packets on their way to device
+    std::vector<SimPacket_t> outbox; ///< Packets sent to addresses without a server, like SNTP responses
+    bool open = false;          ///< Socket is open
+    uint32_t lookups = 0;       ///< Names resolved
+
+    bool begin (uint16_t /* port */) { open = true; return true; }
+    bool beginMulticast (const IPAddress &/* group */, uint16_t /* port */) { open = true; return true; }
+    void stop () { open = false; inbox.clear (); } // Packets to a closed socket are lost
+    uint8_t resolve (const char* name, IPAddress *addresses, uint8_t max); // Dotted quad or names in names table
+    bool send (const IPAddress &address, uint16_t port, const uint8_t *buffer, size_t length);
+    int receive (uint8_t *buffer, size_t length, IPAddress &address, uint16_t &port);
+
+    /**
+    * Queues a packet for device.
+    * @param[in] Packet, NTP_PACKET_SIZE bytes.
+    * @param[in] Source address.
+    * @param[in] Source port.
+    * @param[in] Delay until it is received, in microseconds.
+    */
+    void inject (const uint8_t *packet, const IPAddress &address, uint16_t port, uint32_t delayUs = 0);
+};
+
+// State storage in memory, like RTC memory that keeps running while device is off
+class SimStorage : public NTPStorage {
+public:
+    uint8_t state[NTP_STATE_SIZE];
+    bool saved = false;         ///< State has been saved
+    uint64_t savedUs = 0;       ///< True time of last save
+
+    bool load (uint8_t *data, size_t size);
+    bool save (const uint8_t *data, size_t size);
+    bool getTimeSinceSave (uint64_t &ms);
+};
+
+/**
+* Gets NTP timestamp of a simulated true time.
+*/
+uint64_t simNtp (int64_t trueUs);
+
+/**
+* Writes an NTP timestamp in network order.
+*/
+void simWriteTimestamp (uint8_t *buffer, uint64_t timestamp);
+
+/**
+* Reads an NTP timestamp in network order.
+*/
+uint64_t simReadTimestamp (const uint8_t *buffer);
+
+/**
+* Starts a client on simulated clock and network, without Time library. First sync is due right away.
+* @param[in] Client.
+* @param[in] Clock.
+* @param[in] Transport.
+* @param[in] First server name, a dotted quad address.
+*/
+void simBegin (NTPClient &client, SimClock &clock, SimTransport &transport, const char *server);
+
+/**
+* Advances simulated time running client loop () on every tick.
+* @param[in] Client.
+* @param[in] Time to run, in milliseconds.
+* @param[in] Time between loop () calls, in milliseconds.
+*/
+void simRun (NTPClient &client, uint32_t ms, uint32_t tickMs = 1);
+
+/**
+* Gets how far client local clock is from true time, in microseconds.
+*/
+int64_t simClockError (NTPClient &client);
+
+#endif // _NTPTestSim_h
@@ -0,0 +1,127 @@
+/*
+ Name:		NTPTimeZoneTest.cpp
+ Author:	Germán Martín (gmag11@gmail.com)
+ Maintainer:Germán Martín (gmag11@gmail.com)
+
+ Unit test of time zone rule engine: POSIX TZ strings are parsed, and offsets, daylight saving
+ flag and transitions are compared with libc localtime_r () for the same TZ string from 2000 to
+ 2037. Rule tables match their TZ strings, invalid strings are rejected and local time converts
+ back to UTC.
+*/
+
+#include "NTPTestSim.h"
+#include <stdlib.h>
+#include <time.h>
+
+#define TZ_FROM 946684800 // 2000-01-01
+#define TZ_UNTIL 2145916800 // 2038-01-01
+
+static bool sameRule (const NTPTzRule_t &a, const NTPTzRule_t &b) {
+    return a.type == b.type && a.month == b.month && a.week == b.week && a.weekday == b.weekday && a.day == b.day && a.time == b.time;
+}
+
+static bool sameRules (const NTPTzRules_t &a, const NTPTzRules_t &b) {
+    return a.stdOffset == b.stdOffset && a.hasDst == b.hasDst &&
+        (!a.hasDst || (a.dstOffset == b.dstOffset && sameRule (a.dstStart, b.dstStart) && sameRule (a.dstEnd, b.dstEnd)));
+}
+
+/**
+* Compares offsets and transitions of a TZ string with libc.
+*/
+static void compare (const char *tz) {
+    printf ("%s\n", tz);
+    NTPTimeZone zone;
+    check (zone.setRules (tz), "parsed");
+    setenv ("TZ", tz, 1);
+    tzset ();
+    bool offsetOk = true, dstOk = true, transitionOk = true;
+    int transitions = 0;
+    time_t next = zone.getNextTransition (TZ_FROM);
+    for (time_t utc = TZ_FROM; utc < TZ_UNTIL; utc += 3 * 3600 + 61) {
+        struct tm tm;
+        localtime_r (&utc, &tm);
+        offsetOk = offsetOk && zone.getOffset (utc) == tm.tm_gmtoff;
+        dstOk = dstOk && zone.isDst (utc) == (tm.tm_isdst > 0);
+        if (next && utc >= next) {
+            // Offset changes right at transition, and next one is found from there
+            time_t before = next - 1;
+            struct tm tmBefore, tmAfter;
+            localtime_r (&before, &tmBefore);
+            localtime_r (&next, &tmAfter);
+            transitionOk = transitionOk && tmBefore.tm_gmtoff != tmAfter.tm_gmtoff;
+            transitionOk = transitionOk && zone.getOffset (before) == tmBefore.tm_gmtoff && zone.getOffset (next) == tmAfter.tm_gmtoff;
+            next = zone.getNextTransition (next);
+            transitions++;
+        }
+    }
+    check (offsetOk, "offset matches localtime_r ()");
+    check (dstOk, "daylight saving flag matches localtime_r ()");
+    check (transitionOk && (zone.getRules ().hasDst ? transitions == 2 * 38 : !next), "transitions");
+}
+
+int main () {
+    compare ("CET-1CEST,M3.5.0,M10.5.0/3");
+    compare ("GMT0BST,M3.5.0/1,M10.5.0");
+    compare ("EST5EDT,M3.2.0,M11.1.0");
+    compare ("AEST-10AEDT,M10.1.0,M4.1.0/3");
+    compare ("ACST-9:30ACDT,M10.1.0,M4.1.0/3");
+    compare ("NZST-12NZDT,M9.5.0,M4.1.0/3");
+    compare ("<+0330>-3:30");
+    compare ("<-03>3");
+    compare ("IST-1GMT0,M10.5.0,M3.5.0/1"); // Negative daylight saving, as in Irish zone
+    compare ("JJJ3KKK,J60/2,J300/2");
+    compare ("NNN3MMM,59/2,299/2");
+    compare ("LHST-10:30LHDT-11,M10.1.0,M4.1.0"); // Half hour daylight saving
+
+    printf ("Rule tables\n");
+    NTPTzRules_t rules;
+    const struct {
+        const char *tz;
+        const NTPTzRules_t &table;
+    } tables[] = {
+        { "UTC0", NTP_TZ_UTC },
+        { "GMT0BST,M3.5.0/1,M10.5.0", NTP_TZ_WET },
+        { "CET-1CEST,M3.5.0,M10.5.0/3", NTP_TZ_CET },
+        { "EET-2EEST,M3.5.0/3,M10.5.0/4", NTP_TZ_EET },
+        { "EST5EDT,M3.2.0,M11.1.0", NTP_TZ_US_EASTERN },
+        { "CST6CDT,M3.2.0,M11.1.0", NTP_TZ_US_CENTRAL },
+        { "MST7MDT,M3.2.0,M11.1.0", NTP_TZ_US_MOUNTAIN },
+        { "PST8PDT,M3.2.0,M11.1.0", NTP_TZ_US_PACIFIC },
+        { "AEST-10AEDT,M10.1.0,M4.1.0/3", NTP_TZ_AU_EASTERN },
+        { "ACST-9:30ACDT,M10.1.0,M4.1.0/3", NTP_TZ_AU_CENTRAL },
+    };
+    bool tablesOk = true;
+    for (size_t i = 0; i < sizeof (tables) / sizeof (tables[0]); i++) {
+        tablesOk = tablesOk && NTPTimeZone::parse (tables[i].tz, rules) && sameRules (rules, tables[i].table);
+    }
+    check (tablesOk, "tables match their TZ strings");
+    check (NTPTimeZone::parse ("EST5EDT", rules) && sameRules (rules, NTP_TZ_US_EASTERN), "US rules when none given");
+
+    printf ("Invalid strings\n");
+    const char *invalid[] = { "", "CET", "-1", "CET-1CEST,M13.5.0,M10.5.0", "CET-1CEST,M3.6.0,M10.5.0", "CET-1CEST,M3.5.7,M10.5.0",
+                              "CET-1CEST,M3.5.0", "CET-1CEST,M3.5.0,M10.5.0/", "<+03-3", "CET-25", "CET-1CEST,J0,J300", "CET-1CEST,366,300" };
+    NTPTimeZone zone;
+    zone.setRules (NTP_TZ_CET);
+    bool rejected = true;
+    for (size_t i = 0; i < sizeof (invalid) / sizeof (invalid[0]); i++) {
+        if (zone.setRules (invalid[i])) {
+            printf ("  accepted \"%s\"\n", invalid[i]);
+            rejected = false;
+        }
+    }
+    check (rejected, "rejected");
+    check (sameRules (zone.getRules (), NTP_TZ_CET), "rules not changed");
+
+    printf ("Local to UTC\n");
+    bool roundTrip = true;
+    for (time_t utc = TZ_FROM; utc < TZ_UNTIL; utc += 613) {
+        time_t local = zone.toLocal (utc);
+        // Hour after daylight saving ends repeats local times of previous one
+        bool repeated = !zone.isDst (utc) && zone.isDst (utc - 3600);
+        roundTrip = roundTrip && zone.toUtc (local) == (repeated ? utc - 3600 : utc);
+    }
+    check (roundTrip, "local time converts back");
+    // 2018-10-28 02:30 local happens twice in CET
+    check (zone.toUtc (1540693800) == 1540686600, "repeated hour taken as daylight saving");
+    return checkSummary ();
+}